@@ -0,0 +1,24 @@
+# Project-local configure checks, kept by zproject when it regenerates
+# configure.ac (see zproject_autotools.gsl).
+
+AC_DEFUN([AX_PROJECT_LOCAL_HOOK], [
+# Check for USDT probes intent
+AC_ARG_ENABLE([usdt],
+    AS_HELP_STRING([--enable-usdt],
+        [Compile the USDT probes in, needs sys/sdt.h [default=auto]]),
+    [enable_usdt=$enableval],
+    [enable_usdt=auto])
+
+AS_IF([test x$enable_usdt != xno], [
+    AC_CHECK_HEADER([sys/sdt.h],
+        [AC_DEFINE(FTY_SRR_HAVE_USDT, 1, [Have USDT probes])],
+        [AS_IF([test x$enable_usdt = xyes],
+            [AC_MSG_ERROR([USDT probes need sys/sdt.h (systemtap-sdt-dev)])])])
+])
+
+# Local malamute broker of fty-srr-bench: czmq and malamute are linked in it only
+AS_IF([test x$enable_fty_srr_bench != xno], [
+    PKG_CHECK_MODULES([czmq], [libczmq])
+    PKG_CHECK_MODULES([malamute], [libmlm])
+])
+])
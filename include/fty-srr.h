@@ -27,10 +27,65 @@
 
 //  SRR agent configuration
 constexpr auto REQUEST_TIMEOUT_KEY          = "requestTimeOut";
+constexpr auto AGENT_TIMEOUT_KEY_PREFIX     = "requestTimeOut/";
+constexpr auto OPERATION_TIMEOUT_KEY        = "operationTimeOut";
+constexpr auto DEFAULT_OPERATION_TIMEOUT    = "300000";
+constexpr auto PROBE_TIMEOUT_KEY            = "probeTimeOut";
+constexpr auto DEFAULT_PROBE_TIMEOUT        = "1000";
+constexpr auto HEALTH_CHECK_INTERVAL_KEY    = "healthCheckInterval";
+constexpr auto DEFAULT_HEALTH_CHECK_INTERVAL = "10000";
+constexpr auto BREAKER_THRESHOLD_KEY        = "breakerThreshold";
+constexpr auto DEFAULT_BREAKER_THRESHOLD    = "3";
+constexpr auto BREAKER_COOLDOWN_KEY         = "breakerCoolDown";
+constexpr auto DEFAULT_BREAKER_COOLDOWN     = "30000";
+constexpr auto RETRY_COUNT_KEY              = "retryCount";
+constexpr auto DEFAULT_RETRY_COUNT          = "2";
+constexpr auto RETRY_DELAY_KEY              = "retryDelay";
+constexpr auto DEFAULT_RETRY_DELAY          = "1000";
+constexpr auto WORKERS_KEY                  = "workers";
+constexpr auto MAX_JOBS_KEY                 = "maxJobs";
+constexpr auto DEFAULT_MAX_JOBS             = "2";
+constexpr auto SNAPSHOT_PATH_KEY            = "snapshotPath";
+constexpr auto SNAPSHOT_MAX_COUNT_KEY       = "snapshotMaxCount";
+constexpr auto SNAPSHOT_MAX_AGE_KEY         = "snapshotMaxAge";
+constexpr auto DEFAULT_SNAPSHOT_MAX_COUNT   = "8";
+constexpr auto BUNDLE_PATH_KEY              = "bundlePath";
+constexpr auto DEFAULT_BUNDLE_PATH          = "/var/lib/fty/fty-srr/bundles";
+constexpr auto FACTORY_BUNDLE_PATH_KEY      = "factoryBundlePath";
+constexpr auto DEFAULT_FACTORY_BUNDLE_PATH  = "";
+constexpr auto FACTORY_KEY_PATH_KEY         = "factoryKeyPath";
+constexpr auto DEFAULT_FACTORY_KEY_PATH     = "/etc/fty-srr/factory.key";
+constexpr auto FIRST_BOOT_MARKER_KEY        = "firstBootMarker";
+constexpr auto DEFAULT_FIRST_BOOT_MARKER    = "/var/lib/fty/fty-srr/first-boot";
+constexpr auto RESTORE_JOURNAL_PATH_KEY     = "restoreJournalPath";
+constexpr auto DEFAULT_RESTORE_JOURNAL_PATH = "/var/lib/fty/fty-srr/journal";
+constexpr auto RESTORE_JOURNAL_MAX_AGE_KEY  = "restoreJournalMaxAge";
+constexpr auto DEFAULT_RESTORE_JOURNAL_MAX_AGE = "168";
+constexpr auto RESTORE_BATCH_SIZE_KEY       = "restoreBatchSize";
+constexpr auto DEFAULT_RESTORE_BATCH_SIZE   = "4194304";
+constexpr auto METRICS_FILE_KEY             = "metricsFile";
+constexpr auto METRICS_DUMP_INTERVAL_KEY    = "metricsDumpInterval";
+constexpr auto DEFAULT_METRICS_DUMP_INTERVAL = "60000";
+constexpr auto TRACE_FILE_KEY               = "traceFile";
+constexpr auto FLIGHT_RECORDER_SIZE_KEY     = "flightRecorderSize";
+constexpr auto DEFAULT_FLIGHT_RECORDER_SIZE = "4096";
+constexpr auto FLIGHT_RECORDER_FILE_KEY     = "flightRecorderFile";
+constexpr auto DEFAULT_FLIGHT_RECORDER_FILE = "/var/lib/fty/fty-srr/flight-recorder.log";
+constexpr auto COMPRESSION_KEY              = "compression";
+constexpr auto COMPRESSION_LEVEL_KEY        = "compressionLevel";
+constexpr auto COMPRESSION_MIN_SIZE_KEY     = "compressionMinSize";
+constexpr auto DEFAULT_COMPRESSION          = "zstd";
+constexpr auto DEFAULT_COMPRESSION_LEVEL    = "3";
+constexpr auto DEFAULT_COMPRESSION_MIN_SIZE = "1024";
+constexpr auto CHUNK_SIZE_KEY               = "chunkSize";
+constexpr auto DEFAULT_CHUNK_SIZE           = "1048576";
+constexpr auto MAX_TRANSFER_SIZE_KEY        = "maxTransferSize";
+constexpr auto DEFAULT_MAX_TRANSFER_SIZE    = "268435456";
 constexpr auto AGENT_NAME_KEY               = "agentName";
 constexpr auto AGENT_NAME                   = "fty-srr";
 constexpr auto ENDPOINT_KEY                 = "endPoint";
 constexpr auto DEFAULT_ENDPOINT             = "ipc://@/malamute";
+constexpr auto INPROCESS_ENDPOINT_PREFIX    = "memory://";
 constexpr auto DEFAULT_LOG_CONFIG           = "/etc/fty/ftylog.cfg";
 constexpr auto SRR_QUEUE_NAME_KEY           = "queueName";
 constexpr auto SRR_MSG_QUEUE_NAME           = "ETN.Q.IPMCORE.SRR";
@@ -54,6 +109,60 @@ constexpr auto NETWORK                      = "network";
 constexpr auto AUTOMATIONS                  = "automations";
 constexpr auto VIRTUAL_ASSETS               = "virtual-assets";
 constexpr auto SECURITY_WALLET              = "security-wallet";
+// Read-only requests, handled apart from save and restore
+constexpr auto LIST_FEATURE_SUBJECT         = "get";
+// Incremental save definition
+constexpr auto SAVE_DELTA_SUBJECT           = "saveDelta";
+constexpr auto SRR_MANIFEST_FEATURE         = "srr-manifest";
+// Snapshot store definition
+constexpr auto SNAPSHOT_LIST_SUBJECT        = "listSnapshots";
+constexpr auto SNAPSHOT_GET_SUBJECT         = "getSnapshot";
+constexpr auto SNAPSHOT_DELETE_SUBJECT      = "deleteSnapshot";
+constexpr auto SNAPSHOT_RESTORE_SUBJECT     = "restoreSnapshot";
+// Bundle file definition
+constexpr auto SAVE_BUNDLE_SUBJECT          = "saveBundle";
+constexpr auto RESTORE_BUNDLE_SUBJECT       = "restoreBundle";
+// Restore journal definition
+constexpr auto RESUME_RESTORE_SUBJECT       = "resumeRestore";
+// Job definition
+constexpr auto START_JOB_SUBJECT            = "startJob";
+constexpr auto JOB_STATUS_SUBJECT           = "jobStatus";
+constexpr auto JOB_IN_PROGRESS              = "in-progress";
+constexpr auto JOB_FINISHED                 = "finished";
+constexpr auto JOB_UNKNOWN                  = "unknown";
+constexpr auto FEATURE_PENDING              = "pending";
+constexpr auto FEATURE_IN_PROGRESS          = "in-progress";
+constexpr auto FEATURE_DONE                 = "done";
+constexpr auto FEATURE_FAILED               = "failed";
+// Payload compression definition
+constexpr auto ACCEPT_ENCODING_META         = "acceptEncoding";
+constexpr auto CONTENT_ENCODING_META        = "contentEncoding";
+constexpr auto ENCODING_NONE                = "none";
+constexpr auto ENCODING_ZSTD                = "zstd";
+// Chunked transfer definition
+constexpr auto CHUNK_GET_SUBJECT            = "getChunk";
+constexpr auto ACCEPT_CHUNKS_META           = "acceptChunks";
+constexpr auto TRANSFER_ID_META             = "transferId";
+constexpr auto CHUNK_INDEX_META             = "chunkIndex";
+constexpr auto CHUNK_COUNT_META             = "chunkCount";
+// Metrics definition
+constexpr auto STATS_SUBJECT                = "stats";
+constexpr auto METRIC_REQUEST_DURATION      = "srr_request_duration_seconds";
+constexpr auto METRIC_REQUEST_ERRORS        = "srr_request_errors_total";
+constexpr auto METRIC_REQUESTS_IN_FLIGHT    = "srr_requests_in_flight";
+constexpr auto METRIC_QUEUE_WAIT            = "srr_queue_wait_seconds";
+constexpr auto METRIC_OPERATION_DURATION    = "srr_operation_duration_seconds";
+constexpr auto METRIC_OPERATIONS_IN_FLIGHT  = "srr_operations_in_flight";
+constexpr auto METRIC_AGENT_REQUEST_DURATION = "srr_agent_request_duration_seconds";
+constexpr auto METRIC_AGENT_REQUEST_BYTES   = "srr_agent_request_bytes";
+constexpr auto METRIC_AGENT_RESPONSE_BYTES  = "srr_agent_response_bytes";
+constexpr auto METRIC_AGENT_ERRORS          = "srr_agent_errors_total";
+constexpr auto METRIC_FEATURE_REQUEST_BYTES = "srr_feature_request_bytes_total";
+constexpr auto METRIC_FEATURE_RESPONSE_BYTES = "srr_feature_response_bytes_total";
+// Tracing definition
+constexpr auto TRACEPARENT_META             = "traceparent";
+// Flight recorder definition
+constexpr auto FLIGHT_RECORDER_SUBJECT      = "flightRecorder";
 // Common definition                    
 constexpr auto SRR_VERSION_KEY              = "version";
 constexpr auto ACTIVE_VERSION               = "1.0";
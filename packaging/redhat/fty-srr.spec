@@ -59,6 +59,11 @@ BuildRequires:  fty-common-messagebus-devel
 BuildRequires:  fty-common-dto-devel
 BuildRequires:  protobuf-devel
 BuildRequires:  fty-lib-certificate-devel
+BuildRequires:  libzstd-devel
+BuildRequires:  openssl-devel
+BuildRequires:  czmq-devel
+BuildRequires:  malamute-devel
+BuildRequires:  systemtap-sdt-devel
 BuildRoot:      %{_tmppath}/%{name}-%{version}-build
 
 %description
@@ -0,0 +1,437 @@
+/*  =========================================================================
+    fty-srr-bench - Binary
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty-srr-bench - End to end save, restore and list benchmark
+@discuss
+    Runs a SrrManager against mock fty-config, EMC4J and security-wallet agents,
+    on a local malamute broker or on the in-process bus, and prints the results in json.
+@end
+*/
+
+#include <fty_srr_dto.h>
+#include <fty_common_json.h>
+#include <cxxtools/serializationinfo.h>
+#include <malamute.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/resource.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+#define BENCH_NAME                      "fty-srr-bench"
+#define DEFAULT_BENCH_ENDPOINT          "ipc://@/fty-srr-bench"
+#define DEFAULT_PAYLOAD_SIZE            "65536"
+#define DEFAULT_LATENCY                 "0"
+#define DEFAULT_ITERATIONS              "20"
+#define DEFAULT_WORKLOADS               "list,save,restore"
+#define BENCH_PASSPHRASE                "Bench-Srr-2020"
+#define BENCH_TIME_OUT                  60
+
+void usage();
+
+/**
+ * \brief Agent answering the srr requests with generated features, after a fixed latency.
+ */
+class MockAgent
+{
+    public:
+        MockAgent(const std::string& endpoint, const std::string& agentName, const std::string& queueName, const std::string& payload, unsigned latencyMs) :
+            m_agentName(agentName), m_payload(payload), m_latency(latencyMs)
+        {
+            m_msgBus = std::unique_ptr<messagebus::MessageBus>(srr::createMessageBus(endpoint, agentName));
+            m_msgBus->connect();
+            m_msgBus->receive(queueName, std::bind(&MockAgent::handleRequest, this, std::placeholders::_1));
+        }
+
+    private:
+        std::string m_agentName;
+        std::string m_payload;
+        std::chrono::milliseconds m_latency;
+        std::unique_ptr<messagebus::MessageBus> m_msgBus;
+
+        void handleRequest(messagebus::Message msg)
+        {
+            std::this_thread::sleep_for(m_latency);
+            Query query;
+            msg.userData() >> query;
+            FeatureStatus success;
+            success.set_status(Status::SUCCESS);
+            Response response;
+            if (query.parameters_case() == Query::ParametersCase::kSave)
+            {
+                SaveResponse& save = *(response.mutable_save());
+                for (const auto& featureName : query.save().features())
+                {
+                    Feature feature;
+                    feature.set_version(ACTIVE_VERSION);
+                    feature.set_data(m_payload);
+                    (*(save.mutable_map_features_data()))[featureName] = feature;
+                }
+                *(save.mutable_status()) = success;
+            }
+            else if (query.parameters_case() == Query::ParametersCase::kRestore)
+            {
+                RestoreResponse& restore = *(response.mutable_restore());
+                for (const auto& feature : query.restore().map_features_data())
+                {
+                    (*(restore.mutable_map_features_status()))[feature.first] = success;
+                }
+                *(restore.mutable_status()) = success;
+            }
+            else if (query.parameters_case() == Query::ParametersCase::kReset)
+            {
+                ResetResponse& reset = *(response.mutable_reset());
+                for (const auto& featureName : query.reset().features())
+                {
+                    (*(reset.mutable_map_features_status()))[featureName] = success;
+                }
+                *(reset.mutable_status()) = success;
+            }
+            messagebus::Message reply;
+            reply.userData() << response;
+            reply.metaData()[messagebus::Message::SUBJECT] = msg.metaData().at(messagebus::Message::SUBJECT);
+            reply.metaData()[messagebus::Message::FROM] = m_agentName;
+            reply.metaData()[messagebus::Message::TO] = msg.metaData().at(messagebus::Message::FROM);
+            reply.metaData()[messagebus::Message::CORRELATION_ID] = msg.metaData().at(messagebus::Message::CORRELATION_ID);
+            m_msgBus->sendReply(msg.metaData().at(messagebus::Message::REPLY_TO), reply);
+        }
+};
+
+/**
+ * Results of a workload
+ */
+struct WorkloadResult
+{
+    size_t operations = 0;
+    size_t failures = 0;
+    double seconds = 0;
+    // Milliseconds, sorted
+    std::vector<double> latencies;
+};
+
+/**
+ * Get a percentile of sorted latencies
+ * @param latencies
+ * @param percentile Between 0 and 100
+ * @return The latency, 0 if none
+ */
+static double getPercentile(const std::vector<double>& latencies, double percentile)
+{
+    if (latencies.empty())
+    {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(std::ceil(percentile / 100 * latencies.size()));
+    return latencies[std::min(latencies.size(), std::max(rank, size_t(1))) - 1];
+}
+
+/**
+ * Run an operation several times
+ * @param iterations
+ * @param operation Returns false or throws on failure
+ * @return The results
+ */
+static WorkloadResult runWorkload(unsigned iterations, const std::function<bool()>& operation)
+{
+    WorkloadResult result;
+    auto workloadStart = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        bool succeeded = false;
+        try
+        {
+            succeeded = operation();
+        }
+        catch (const std::exception& e)
+        {
+            log_error("Operation failed: %s", e.what());
+        }
+        std::chrono::duration<double, std::milli> latency = std::chrono::steady_clock::now() - start;
+        result.latencies.push_back(latency.count());
+        result.operations++;
+        result.failures += succeeded ? 0 : 1;
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - workloadStart).count();
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+/**
+ * Send a query to srr and wait for its response
+ * @param msgBus
+ * @param clientId
+ * @param action
+ * @param query
+ * @return The response
+ */
+static Response sendQuery(messagebus::MessageBus& msgBus, const std::string& clientId, const std::string& action, const Query& query)
+{
+    messagebus::Message msg;
+    msg.userData() << query;
+    msg.metaData().emplace(messagebus::Message::SUBJECT, action);
+    msg.metaData().emplace(messagebus::Message::FROM, clientId);
+    msg.metaData().emplace(messagebus::Message::TO, AGENT_NAME);
+    msg.metaData().emplace(messagebus::Message::CORRELATION_ID, messagebus::generateUuid());
+    messagebus::Message resp = msgBus.request(SRR_MSG_QUEUE_NAME, msg, BENCH_TIME_OUT);
+    Response response;
+    resp.userData() >> response;
+    return response;
+}
+
+/**
+ * Get an option value as a number
+ * @param options
+ * @param name
+ * @return The value
+ */
+static unsigned long getNumber(const std::map<std::string, std::string>& options, const std::string& name)
+{
+    try
+    {
+        return std::stoul(options.at(name));
+    }
+    catch (const std::exception&)
+    {
+        throw std::runtime_error("Invalid " + name + ": " + options.at(name));
+    }
+}
+
+/**
+ * Main program
+ * @param argc
+ * @param argv
+ * @return
+ */
+int main(int argc, char *argv [])
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    ftylog_setInstance(BENCH_NAME, "");
+
+    std::map<std::string, std::string> options;
+    options["endpoint"] = DEFAULT_BENCH_ENDPOINT;
+    options["payload-size"] = DEFAULT_PAYLOAD_SIZE;
+    options["latency"] = DEFAULT_LATENCY;
+    options["iterations"] = DEFAULT_ITERATIONS;
+    options["workloads"] = DEFAULT_WORKLOADS;
+    options["output"] = "";
+    bool externalBroker = false;
+    bool verbose = false;
+    // Parse command line
+    for (int argn = 1; argn < argc; argn++)
+    {
+        std::string arg = argv [argn];
+        if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            return EXIT_SUCCESS;
+        }
+        else if (arg == "--verbose" || arg == "-v")
+        {
+            verbose = true;
+        }
+        else if (arg == "--external-broker")
+        {
+            externalBroker = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0 && options.count(arg.substr(2)) > 0 && argn < argc - 1)
+        {
+            options[arg.substr(2)] = argv [++argn];
+        }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (verbose)
+    {
+        ftylog_setVeboseMode(ftylog_getInstance());
+    }
+
+    zactor_t *broker = NULL;
+    try
+    {
+        const std::string& endpoint = options.at("endpoint");
+        size_t payloadSize = getNumber(options, "payload-size");
+        unsigned latency = static_cast<unsigned>(getNumber(options, "latency"));
+        unsigned iterations = static_cast<unsigned>(getNumber(options, "iterations"));
+
+        // Local broker, unless the agents talk in process.
+        if (!srr::SrrInProcessBus::isInProcessEndpoint(endpoint) && !externalBroker)
+        {
+            broker = zactor_new(mlm_server, (void *) BENCH_NAME);
+            zstr_sendx(broker, "BIND", endpoint.c_str(), NULL);
+        }
+
+        // Same payload for all features, random so that compression does not flatter it.
+        std::string payload(payloadSize, '\0');
+        std::mt19937 generator(42);
+        std::generate(payload.begin(), payload.end(), [&generator]() { return static_cast<char>(generator()); });
+        std::vector<std::unique_ptr<MockAgent>> agents;
+        agents.emplace_back(new MockAgent(endpoint, CONFIG_AGENT_NAME, CONFIG_MSG_QUEUE_NAME, payload, latency));
+        agents.emplace_back(new MockAgent(endpoint, EMC4J_AGENT_NAME, EMC4J_MSG_QUEUE_NAME, payload, latency));
+        agents.emplace_back(new MockAgent(endpoint, SECU_WALLET_AGENT_NAME, SECU_WALLET_MSG_QUEUE_NAME, payload, latency));
+
+        // Srr with its default parameters, nothing on disk.
+        std::map<std::string, std::string> parameters;
+        parameters[ENDPOINT_KEY] = endpoint;
+        parameters[AGENT_NAME_KEY] = AGENT_NAME;
+        parameters[SRR_QUEUE_NAME_KEY] = SRR_MSG_QUEUE_NAME;
+        parameters[SRR_VERSION_KEY] = ACTIVE_VERSION;
+        parameters[REQUEST_TIMEOUT_KEY] = std::to_string(BENCH_TIME_OUT * 1000);
+        parameters[WORKERS_KEY] = "4";
+        parameters[COMPRESSION_KEY] = DEFAULT_COMPRESSION;
+        parameters[COMPRESSION_LEVEL_KEY] = DEFAULT_COMPRESSION_LEVEL;
+        parameters[COMPRESSION_MIN_SIZE_KEY] = DEFAULT_COMPRESSION_MIN_SIZE;
+        parameters[CHUNK_SIZE_KEY] = DEFAULT_CHUNK_SIZE;
+        parameters[MAX_TRANSFER_SIZE_KEY] = DEFAULT_MAX_TRANSFER_SIZE;
+        parameters[FACTORY_BUNDLE_PATH_KEY] = "";
+        parameters[RESTORE_JOURNAL_PATH_KEY] = "";
+        srr::SrrManager srrManager(parameters);
+
+        std::string clientId = messagebus::getClientId(BENCH_NAME);
+        std::unique_ptr<messagebus::MessageBus> msgBus(srr::createMessageBus(endpoint, clientId));
+        msgBus->connect();
+
+        // All the features, saved once for the restore workload.
+        Response listResponse = sendQuery(*msgBus, clientId, "get", createListFeatureQuery());
+        std::set<FeatureName> features;
+        for (const auto& feature : listResponse.list_feature().map_features_dependencies())
+        {
+            features.insert(feature.first);
+        }
+        Query saveQuery = createSaveQuery(features, BENCH_PASSPHRASE);
+        Response saveResponse = sendQuery(*msgBus, clientId, "save", saveQuery);
+        if (saveResponse.save().status().status() != Status::SUCCESS)
+        {
+            throw std::runtime_error("Initial save failed: " + saveResponse.save().status().error());
+        }
+        Query restoreQuery;
+        RestoreQuery& restore = *(restoreQuery.mutable_restore());
+        restore.set_passpharse(BENCH_PASSPHRASE);
+        restore.set_version(saveResponse.save().version());
+        restore.set_checksum(saveResponse.save().checksum());
+        *(restore.mutable_map_features_data()) = saveResponse.save().map_features_data();
+
+        cxxtools::SerializationInfo si;
+        si.addMember("endpoint") <<= endpoint;
+        si.addMember("features") <<= static_cast<uint64_t>(features.size());
+        si.addMember("payloadSize") <<= static_cast<uint64_t>(payloadSize);
+        si.addMember("latencyMs") <<= latency;
+        si.addMember("iterations") <<= iterations;
+        cxxtools::SerializationInfo& siWorkloads = si.addMember("workloads");
+        std::istringstream workloads(options.at("workloads"));
+        std::string workload;
+        while (std::getline(workloads, workload, ','))
+        {
+            WorkloadResult result;
+            // Feature payload bytes carried by an operation.
+            size_t operationBytes = 0;
+            if (workload == "list")
+            {
+                result = runWorkload(iterations, [&]()
+                {
+                    return !sendQuery(*msgBus, clientId, "get", createListFeatureQuery()).list_feature().map_features_dependencies().empty();
+                });
+            }
+            else if (workload == "save")
+            {
+                operationBytes = features.size() * payloadSize;
+                result = runWorkload(iterations, [&]()
+                {
+                    return sendQuery(*msgBus, clientId, "save", saveQuery).save().status().status() == Status::SUCCESS;
+                });
+            }
+            else if (workload == "restore")
+            {
+                operationBytes = features.size() * payloadSize;
+                result = runWorkload(iterations, [&]()
+                {
+                    return sendQuery(*msgBus, clientId, "restore", restoreQuery).restore().status().status() == Status::SUCCESS;
+                });
+            }
+            else
+            {
+                throw std::runtime_error("Unknown workload: " + workload);
+            }
+            cxxtools::SerializationInfo& siWorkload = siWorkloads.addMember(workload);
+            siWorkload.addMember("operations") <<= static_cast<uint64_t>(result.operations);
+            siWorkload.addMember("failures") <<= static_cast<uint64_t>(result.failures);
+            siWorkload.addMember("seconds") <<= result.seconds;
+            siWorkload.addMember("operationsPerSecond") <<= (result.seconds > 0 ? result.operations / result.seconds : 0);
+            siWorkload.addMember("bytesPerSecond") <<= (result.seconds > 0 ? result.operations * operationBytes / result.seconds : 0);
+            siWorkload.addMember("p50Ms") <<= getPercentile(result.latencies, 50);
+            siWorkload.addMember("p99Ms") <<= getPercentile(result.latencies, 99);
+            siWorkload.addMember("maxMs") <<= (result.latencies.empty() ? 0 : result.latencies.back());
+        }
+        // Whole process: srr, the mock agents and the broker.
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        si.addMember("peakRssKb") <<= static_cast<int64_t>(usage.ru_maxrss);
+
+        std::string json = JSON::writeToString(si, true);
+        if (options.at("output").empty())
+        {
+            std::cout << json << std::endl;
+        }
+        else
+        {
+            std::ofstream output(options.at("output"));
+            output << json << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        zactor_destroy(&broker);
+        return EXIT_FAILURE;
+    }
+    zactor_destroy(&broker);
+    return EXIT_SUCCESS;
+}
+
+void usage()
+{
+    puts(BENCH_NAME " [options] ...");
+    puts("  -v|--verbose            verbose output");
+    puts("  -h|--help               this information");
+    puts("  --endpoint <endpoint>   broker endpoint, memory://<name> for the in-process bus (default " DEFAULT_BENCH_ENDPOINT ")");
+    puts("  --external-broker       use the broker already bound to the endpoint");
+    puts("  --payload-size <bytes>  size of each feature (default " DEFAULT_PAYLOAD_SIZE ")");
+    puts("  --latency <ms>          time each agent takes to answer (default " DEFAULT_LATENCY ")");
+    puts("  --iterations <count>    operations by workload (default " DEFAULT_ITERATIONS ")");
+    puts("  --workloads <list>      comma separated workloads run in order (default " DEFAULT_WORKLOADS ")");
+    puts("  --output <file>         json results file (default standard output)");
+}
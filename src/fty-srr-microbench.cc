@@ -0,0 +1,503 @@
+/*  =========================================================================
+    fty-srr-microbench - Binary
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+/*
+@header
+    fty-srr-microbench - Microbenchmarks of the worker hot paths
+@discuss
+    Times the request factorization, the feature list, the response merge and
+    the payload serialization in process, against a stub message bus answering
+    at once, and prints the results in json. Each benchmark runs until it lasts
+    the minimum time, like Google Benchmark does.
+@end
+*/
+
+#include <fty_srr_dto.h>
+#include <fty_common_json.h>
+#include <cxxtools/serializationinfo.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <thread>
+
+#include <time.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+#define MICROBENCH_NAME                 "fty-srr-microbench"
+#define MICROBENCH_ENDPOINT             "memory://fty-srr-microbench"
+#define DEFAULT_FEATURE_COUNTS          "1,16,256"
+#define DEFAULT_PAYLOAD_SIZES           "64,4096,262144"
+#define DEFAULT_MIN_TIME                "0.2"
+#define MAX_ITERATIONS                  1000000000ULL
+
+// Allocations made by the whole program, counted by the operators below.
+static std::atomic<uint64_t> g_allocations(0);
+// Results are accumulated there so that the compiler keeps the measured code.
+static volatile size_t g_sink = 0;
+
+void* operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void usage();
+
+namespace srr
+{
+    /**
+     * \brief Access to the private hot paths of the worker.
+     */
+    class SrrWorkerBench
+    {
+        public:
+            static std::map<std::string, std::set<FeatureName>> factorizationSaveCall(SrrWorker& worker, const SaveQuery& query)
+            {
+                return worker.factorizationSaveCall(query);
+            }
+
+            static size_t factorizationRestoreCall(SrrWorker& worker, const std::set<FeatureName>& features)
+            {
+                return worker.factorizationRestoreCall(features).size();
+            }
+    };
+}
+
+/**
+ * \brief Message bus answering the save requests at once with generated features.
+ * Nothing goes through a broker, the other calls are not supported.
+ */
+class StubMessageBus : public messagebus::MessageBus
+{
+    public:
+        explicit StubMessageBus(const std::string& payload) : m_payload(payload) {}
+
+        void connect() override {}
+
+        void publish(const std::string&, const messagebus::Message&) override
+        {
+            throw messagebus::MessageBusException("Publish not supported by the stub bus");
+        }
+
+        void subscribe(const std::string&, messagebus::MessageListener) override
+        {
+            throw messagebus::MessageBusException("Subscribe not supported by the stub bus");
+        }
+
+        void unsubscribe(const std::string&, messagebus::MessageListener) override {}
+
+        void sendRequest(const std::string&, const messagebus::Message&) override
+        {
+            throw messagebus::MessageBusException("Asynchronous requests not supported by the stub bus");
+        }
+
+        void sendRequest(const std::string&, const messagebus::Message&, messagebus::MessageListener) override
+        {
+            throw messagebus::MessageBusException("Asynchronous requests not supported by the stub bus");
+        }
+
+        void sendReply(const std::string&, const messagebus::Message&) override
+        {
+            throw messagebus::MessageBusException("Replies not supported by the stub bus");
+        }
+
+        void receive(const std::string&, messagebus::MessageListener) override
+        {
+            throw messagebus::MessageBusException("Receive not supported by the stub bus");
+        }
+
+        messagebus::Message request(const std::string&, const messagebus::Message& message, int) override
+        {
+            Query query;
+            query.ParseFromString(message.userData().front());
+            Response response;
+            SaveResponse& save = *(response.mutable_save());
+            for (const auto& featureName : query.save().features())
+            {
+                Feature& feature = (*(save.mutable_map_features_data()))[featureName];
+                feature.set_version(ACTIVE_VERSION);
+                feature.set_data(m_payload);
+            }
+            save.mutable_status()->set_status(Status::SUCCESS);
+            messagebus::Message reply;
+            reply.userData() << response;
+            reply.metaData()[messagebus::Message::CORRELATION_ID] = message.metaData().at(messagebus::Message::CORRELATION_ID);
+            return reply;
+        }
+
+    private:
+        std::string m_payload;
+};
+
+/**
+ * Results of a benchmark
+ */
+struct BenchmarkResult
+{
+    std::string name;
+    uint64_t iterations = 0;
+    // Nanoseconds by iteration
+    double realTime = 0;
+    double cpuTime = 0;
+    double bytesPerSecond = 0;
+    double allocationsPerIteration = 0;
+};
+
+/**
+ * Get the cpu time used by the process
+ * @return The cpu time in seconds
+ */
+static double getCpuTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Run a benchmark, with more iterations each time until it lasts the minimum time
+ * @param name
+ * @param minTime In seconds
+ * @param bytesPerIteration Payload bytes processed by an iteration, 0 if not relevant
+ * @param iteration
+ * @return The results of the last run
+ */
+static BenchmarkResult runBenchmark(const std::string& name, double minTime, size_t bytesPerIteration, const std::function<void()>& iteration)
+{
+    BenchmarkResult result;
+    result.name = name;
+    uint64_t iterations = 1;
+    while (true)
+    {
+        uint64_t allocations = g_allocations.load();
+        double cpuStart = getCpuTime();
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; i++)
+        {
+            iteration();
+        }
+        double realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double cpuSeconds = getCpuTime() - cpuStart;
+        if (realSeconds >= minTime || iterations >= MAX_ITERATIONS)
+        {
+            result.iterations = iterations;
+            result.realTime = realSeconds * 1e9 / iterations;
+            result.cpuTime = cpuSeconds * 1e9 / iterations;
+            result.bytesPerSecond = realSeconds > 0 ? bytesPerIteration * iterations / realSeconds : 0;
+            result.allocationsPerIteration = static_cast<double>(g_allocations.load() - allocations) / iterations;
+            break;
+        }
+        // Aim a bit above the minimum time, with at most 10 times more iterations.
+        double multiplier = realSeconds > 0 ? minTime * 1.4 / realSeconds : 10;
+        iterations = std::min<uint64_t>(MAX_ITERATIONS, static_cast<uint64_t>(iterations * std::max(1.1, std::min(multiplier, 10.0))) + 1);
+    }
+    log_debug("%s: %llu iterations, %.0f ns", name.c_str(), static_cast<unsigned long long>(result.iterations), result.realTime);
+    return result;
+}
+
+/**
+ * Build a save response with generated features
+ * @param featureCount
+ * @param payloadSize
+ * @param prefix Prefix of the feature names
+ * @return The save response
+ */
+static SaveResponse buildSaveResponse(size_t featureCount, size_t payloadSize, const std::string& prefix)
+{
+    SaveResponse response;
+    for (size_t i = 0; i < featureCount; i++)
+    {
+        Feature& feature = (*(response.mutable_map_features_data()))[prefix + std::to_string(i)];
+        feature.set_version(ACTIVE_VERSION);
+        feature.set_data(std::string(payloadSize, static_cast<char>('a' + i % 26)));
+    }
+    response.mutable_status()->set_status(Status::SUCCESS);
+    return response;
+}
+
+/**
+ * Parse a comma separated list of numbers
+ * @param list
+ * @return The numbers
+ */
+static std::vector<size_t> getNumbers(const std::string& list)
+{
+    std::vector<size_t> numbers;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        try
+        {
+            numbers.push_back(std::stoul(item));
+        }
+        catch (const std::exception&)
+        {
+            throw std::runtime_error("Invalid number: " + item);
+        }
+    }
+    return numbers;
+}
+
+/**
+ * Main program
+ * @param argc
+ * @param argv
+ * @return
+ */
+int main(int argc, char *argv [])
+{
+    GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+    ftylog_setInstance(MICROBENCH_NAME, "");
+
+    std::map<std::string, std::string> options;
+    options["feature-counts"] = DEFAULT_FEATURE_COUNTS;
+    options["payload-sizes"] = DEFAULT_PAYLOAD_SIZES;
+    options["min-time"] = DEFAULT_MIN_TIME;
+    options["filter"] = "";
+    options["output"] = "";
+    bool verbose = false;
+    // Parse command line
+    for (int argn = 1; argn < argc; argn++)
+    {
+        std::string arg = argv [argn];
+        if (arg == "--help" || arg == "-h")
+        {
+            usage();
+            return EXIT_SUCCESS;
+        }
+        else if (arg == "--verbose" || arg == "-v")
+        {
+            verbose = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0 && options.count(arg.substr(2)) > 0 && argn < argc - 1)
+        {
+            options[arg.substr(2)] = argv [++argn];
+        }
+        else
+        {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (verbose)
+    {
+        ftylog_setVeboseMode(ftylog_getInstance());
+    }
+
+    try
+    {
+        std::vector<size_t> featureCounts = getNumbers(options.at("feature-counts"));
+        std::vector<size_t> payloadSizes = getNumbers(options.at("payload-sizes"));
+        double minTime = std::stod(options.at("min-time"));
+        const std::string& filter = options.at("filter");
+
+        // Worker with nothing on disk and no background thread. Its agent requesters are never opened here.
+        std::map<std::string, std::string> parameters;
+        parameters[ENDPOINT_KEY] = MICROBENCH_ENDPOINT;
+        parameters[AGENT_NAME_KEY] = AGENT_NAME;
+        parameters[SRR_VERSION_KEY] = ACTIVE_VERSION;
+        parameters[HEALTH_CHECK_INTERVAL_KEY] = "0";
+        parameters[FACTORY_BUNDLE_PATH_KEY] = "";
+        parameters[RESTORE_JOURNAL_PATH_KEY] = "";
+        StubMessageBus workerBus("");
+        srr::SrrWorker worker(workerBus, parameters);
+
+        std::vector<FeatureName> managedFeatures;
+        for (const auto& feature : worker.getFeatureListManaged(ListFeatureQuery()).map_features_dependencies())
+        {
+            managedFeatures.push_back(feature.first);
+        }
+
+        std::vector<BenchmarkResult> results;
+        auto run = [&](const std::string& name, size_t bytesPerIteration, const std::function<void()>& iteration)
+        {
+            if (name.find(filter) != std::string::npos)
+            {
+                results.push_back(runBenchmark(name, minTime, bytesPerIteration, iteration));
+            }
+        };
+
+        run("GetFeatureListManaged", 0, [&]()
+        {
+            g_sink += worker.getFeatureListManaged(ListFeatureQuery()).map_features_dependencies().size();
+        });
+
+        for (size_t featureCount : featureCounts)
+        {
+            // Only the managed features can be factorized, the query repeats them up to the count.
+            SaveQuery saveQuery;
+            for (size_t i = 0; i < featureCount; i++)
+            {
+                saveQuery.add_features(managedFeatures[i % managedFeatures.size()]);
+            }
+            run("FactorizationSaveCall/" + std::to_string(featureCount), 0, [&]()
+            {
+                g_sink += srr::SrrWorkerBench::factorizationSaveCall(worker, saveQuery).size();
+            });
+        }
+
+        // A restore holds each feature once, at most all the managed ones.
+        std::set<size_t> restoreCounts;
+        for (size_t featureCount : featureCounts)
+        {
+            restoreCounts.insert(std::min(featureCount, managedFeatures.size()));
+        }
+        for (size_t featureCount : restoreCounts)
+        {
+            std::set<FeatureName> features(managedFeatures.begin(), managedFeatures.begin() + featureCount);
+            run("FactorizationRestoreCall/" + std::to_string(featureCount), 0, [&]()
+            {
+                g_sink += srr::SrrWorkerBench::factorizationRestoreCall(worker, features);
+            });
+        }
+
+        for (size_t featureCount : featureCounts)
+        {
+            for (size_t payloadSize : payloadSizes)
+            {
+                std::string args = "/" + std::to_string(featureCount) + "/" + std::to_string(payloadSize);
+                size_t bytes = featureCount * payloadSize;
+
+                // Merge of a partial response, as done for each agent of a save.
+                SaveResponse partial = buildSaveResponse(featureCount, payloadSize, "feature-");
+                run("SaveResponseMerge" + args, bytes, [&]()
+                {
+                    SaveResponse merged;
+                    merged += partial;
+                    g_sink += merged.map_features_data().size();
+                });
+
+                Response response;
+                *(response.mutable_save()) = partial;
+                run("UserDataSerialize" + args, bytes, [&]()
+                {
+                    dto::UserData userData;
+                    userData << response;
+                    g_sink += userData.front().size();
+                });
+
+                // Same decoding as the >> operator, without copying the frame it consumes.
+                dto::UserData serialized;
+                serialized << response;
+                run("UserDataParse" + args, bytes, [&]()
+                {
+                    Response parsed;
+                    parsed.ParseFromString(serialized.front());
+                    g_sink += parsed.save().map_features_data().size();
+                });
+
+                // Save request to an agent answering at once: both ends encode and decode.
+                StubMessageBus agentBus(std::string(payloadSize, 'x'));
+                Query saveQuery;
+                for (size_t i = 0; i < featureCount; i++)
+                {
+                    saveQuery.mutable_save()->add_features("feature-" + std::to_string(i));
+                }
+                run("StubSaveRequest" + args, bytes, [&]()
+                {
+                    messagebus::Message req;
+                    req.userData() << saveQuery;
+                    req.metaData()[messagebus::Message::CORRELATION_ID] = "microbench";
+                    messagebus::Message resp = agentBus.request(CONFIG_MSG_QUEUE_NAME, req, 0);
+                    Response saveResponse;
+                    resp.userData() >> saveResponse;
+                    g_sink += saveResponse.save().map_features_data().size();
+                });
+            }
+        }
+
+        // Same layout as the Google Benchmark json output.
+        cxxtools::SerializationInfo si;
+        cxxtools::SerializationInfo& siContext = si.addMember("context");
+        siContext.addMember("executable") <<= std::string(MICROBENCH_NAME);
+        siContext.addMember("num_cpus") <<= std::thread::hardware_concurrency();
+        siContext.addMember("min_time") <<= minTime;
+        cxxtools::SerializationInfo& siBenchmarks = si.addMember("benchmarks");
+        siBenchmarks.setCategory(cxxtools::SerializationInfo::Category::Array);
+        for (const auto& result : results)
+        {
+            cxxtools::SerializationInfo& siBenchmark = siBenchmarks.addMember("");
+            siBenchmark.addMember("name") <<= result.name;
+            siBenchmark.addMember("iterations") <<= result.iterations;
+            siBenchmark.addMember("real_time") <<= result.realTime;
+            siBenchmark.addMember("cpu_time") <<= result.cpuTime;
+            siBenchmark.addMember("time_unit") <<= std::string("ns");
+            siBenchmark.addMember("bytes_per_second") <<= result.bytesPerSecond;
+            siBenchmark.addMember("allocations_per_iteration") <<= result.allocationsPerIteration;
+        }
+
+        std::string json = JSON::writeToString(si, true);
+        if (options.at("output").empty())
+        {
+            std::cout << json << std::endl;
+        }
+        else
+        {
+            std::ofstream output(options.at("output"));
+            output << json << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+void usage()
+{
+    puts(MICROBENCH_NAME " [options] ...");
+    puts("  -v|--verbose              verbose output");
+    puts("  -h|--help                 this information");
+    puts("  --feature-counts <list>   comma separated feature counts (default " DEFAULT_FEATURE_COUNTS ")");
+    puts("  --payload-sizes <list>    comma separated feature sizes in bytes (default " DEFAULT_PAYLOAD_SIZES ")");
+    puts("  --min-time <seconds>      minimum duration of each benchmark (default " DEFAULT_MIN_TIME ")");
+    puts("  --filter <text>           only run the benchmarks whose name contains it");
+    puts("  --output <file>           json results file (default standard output)");
+}
@@ -27,7 +27,8 @@
  */
 
 #include <csignal>
-#include <mutex>
+
+#include <pthread.h>
 
 #include "fty_srr_classes.h"
 
@@ -36,26 +37,19 @@
 //functions
 
 void usage();
-volatile bool g_exit = false;
-std::condition_variable g_cv;
-std::mutex g_cvMutex;
-
-void sigHandler(int)
-{
-    g_exit = true;
-    g_cv.notify_one();
-}
 
 /**
- * Set Signal handler
+ * Block the signals handled by the main thread, before any other thread starts:
+ * the threads inherit the mask, the main thread takes the signals with sigwait.
+ * @param signals SIGINT and SIGUSR1
  */
-void setSignalHandler()
+void setSignalHandler(sigset_t& signals)
 {
-    struct sigaction sigIntHandler;
-    sigIntHandler.sa_handler = sigHandler;
-    sigemptyset(&sigIntHandler.sa_mask);
-    sigIntHandler.sa_flags = 0;
-    sigaction(SIGINT, &sigIntHandler, NULL);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    // Flight recorder dump
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 }
 
 /**
@@ -76,11 +70,13 @@ void terminateHandler()
 int main(int argc, char *argv [])
 {
     std::string DefaultTimeOut = "60000";
+    std::string DefaultWorkers = "4";
     using Parameters = std::map<std::string, std::string>;
     Parameters paramsConfig;
     
     // Set signal handler
-    setSignalHandler();
+    sigset_t signals;
+    setSignalHandler(signals);
     // Set terminate pg handler
     std::set_terminate (terminateHandler);
 
@@ -120,6 +116,24 @@ int main(int argc, char *argv [])
     paramsConfig[SRR_QUEUE_NAME_KEY] = SRR_MSG_QUEUE_NAME;
     paramsConfig[SRR_VERSION_KEY] = ACTIVE_VERSION;
     paramsConfig[REQUEST_TIMEOUT_KEY] = DefaultTimeOut;
+    paramsConfig[OPERATION_TIMEOUT_KEY] = DEFAULT_OPERATION_TIMEOUT;
+    paramsConfig[PROBE_TIMEOUT_KEY] = DEFAULT_PROBE_TIMEOUT;
+    paramsConfig[HEALTH_CHECK_INTERVAL_KEY] = DEFAULT_HEALTH_CHECK_INTERVAL;
+    paramsConfig[BREAKER_THRESHOLD_KEY] = DEFAULT_BREAKER_THRESHOLD;
+    paramsConfig[BREAKER_COOLDOWN_KEY] = DEFAULT_BREAKER_COOLDOWN;
+    paramsConfig[RETRY_COUNT_KEY] = DEFAULT_RETRY_COUNT;
+    paramsConfig[RETRY_DELAY_KEY] = DEFAULT_RETRY_DELAY;
+    paramsConfig[WORKERS_KEY] = DefaultWorkers;
+    paramsConfig[MAX_JOBS_KEY] = DEFAULT_MAX_JOBS;
+    paramsConfig[COMPRESSION_KEY] = DEFAULT_COMPRESSION;
+    paramsConfig[COMPRESSION_LEVEL_KEY] = DEFAULT_COMPRESSION_LEVEL;
+    paramsConfig[COMPRESSION_MIN_SIZE_KEY] = DEFAULT_COMPRESSION_MIN_SIZE;
+    paramsConfig[CHUNK_SIZE_KEY] = DEFAULT_CHUNK_SIZE;
+    paramsConfig[MAX_TRANSFER_SIZE_KEY] = DEFAULT_MAX_TRANSFER_SIZE;
+    paramsConfig[RESTORE_BATCH_SIZE_KEY] = DEFAULT_RESTORE_BATCH_SIZE;
+    paramsConfig[METRICS_DUMP_INTERVAL_KEY] = DEFAULT_METRICS_DUMP_INTERVAL;
+    paramsConfig[FLIGHT_RECORDER_SIZE_KEY] = DEFAULT_FLIGHT_RECORDER_SIZE;
+    paramsConfig[FLIGHT_RECORDER_FILE_KEY] = DEFAULT_FLIGHT_RECORDER_FILE;
 
     if (config_file)
     {
@@ -128,10 +142,44 @@ int main(int argc, char *argv [])
         // verbose mode
         std::istringstream(config.getEntry("server/verbose", "0")) >> verbose;
         paramsConfig[REQUEST_TIMEOUT_KEY] = config.getEntry("server/timeout", DefaultTimeOut);
+        paramsConfig[OPERATION_TIMEOUT_KEY] = config.getEntry("server/operationTimeout", DEFAULT_OPERATION_TIMEOUT);
+        paramsConfig[PROBE_TIMEOUT_KEY] = config.getEntry("server/probeTimeout", DEFAULT_PROBE_TIMEOUT);
+        paramsConfig[HEALTH_CHECK_INTERVAL_KEY] = config.getEntry("server/healthCheckInterval", DEFAULT_HEALTH_CHECK_INTERVAL);
+        paramsConfig[BREAKER_THRESHOLD_KEY] = config.getEntry("server/breakerThreshold", DEFAULT_BREAKER_THRESHOLD);
+        paramsConfig[BREAKER_COOLDOWN_KEY] = config.getEntry("server/breakerCoolDown", DEFAULT_BREAKER_COOLDOWN);
+        paramsConfig[RETRY_COUNT_KEY] = config.getEntry("server/retryCount", DEFAULT_RETRY_COUNT);
+        paramsConfig[RETRY_DELAY_KEY] = config.getEntry("server/retryDelay", DEFAULT_RETRY_DELAY);
+        // Agent time outs, the server one by default
+        for (const std::string agentName : {CONFIG_AGENT_NAME, EMC4J_AGENT_NAME, SECU_WALLET_AGENT_NAME})
+        {
+            paramsConfig[AGENT_TIMEOUT_KEY_PREFIX + agentName] = config.getEntry("agent-timeout/" + agentName, paramsConfig[REQUEST_TIMEOUT_KEY]);
+        }
+        paramsConfig[WORKERS_KEY] = config.getEntry("server/workers", DefaultWorkers);
+        paramsConfig[MAX_JOBS_KEY] = config.getEntry("server/maxJobs", DEFAULT_MAX_JOBS);
         paramsConfig[ENDPOINT_KEY] = config.getEntry("srr-msg-bus/endpoint", DEFAULT_ENDPOINT);
         paramsConfig[AGENT_NAME_KEY] = config.getEntry("srr-msg-bus/address", AGENT_NAME);
         paramsConfig[SRR_QUEUE_NAME_KEY] = config.getEntry("srr-msg-bus/srrQueueName", SRR_MSG_QUEUE_NAME);
         paramsConfig[SRR_VERSION_KEY] = config.getEntry("srr/version", ACTIVE_VERSION);
+        paramsConfig[SNAPSHOT_PATH_KEY] = config.getEntry("srr/snapshotPath", "");
+        paramsConfig[SNAPSHOT_MAX_COUNT_KEY] = config.getEntry("srr/snapshotMaxCount", DEFAULT_SNAPSHOT_MAX_COUNT);
+        paramsConfig[SNAPSHOT_MAX_AGE_KEY] = config.getEntry("srr/snapshotMaxAge", "0");
+        paramsConfig[BUNDLE_PATH_KEY] = config.getEntry("srr/bundlePath", DEFAULT_BUNDLE_PATH);
+        paramsConfig[FACTORY_BUNDLE_PATH_KEY] = config.getEntry("srr/factoryBundlePath", DEFAULT_FACTORY_BUNDLE_PATH);
+        paramsConfig[FACTORY_KEY_PATH_KEY] = config.getEntry("srr/factoryKeyPath", DEFAULT_FACTORY_KEY_PATH);
+        paramsConfig[FIRST_BOOT_MARKER_KEY] = config.getEntry("srr/firstBootMarker", DEFAULT_FIRST_BOOT_MARKER);
+        paramsConfig[RESTORE_JOURNAL_PATH_KEY] = config.getEntry("srr/restoreJournalPath", DEFAULT_RESTORE_JOURNAL_PATH);
+        paramsConfig[RESTORE_JOURNAL_MAX_AGE_KEY] = config.getEntry("srr/restoreJournalMaxAge", DEFAULT_RESTORE_JOURNAL_MAX_AGE);
+        paramsConfig[RESTORE_BATCH_SIZE_KEY] = config.getEntry("srr/restoreBatchSize", DEFAULT_RESTORE_BATCH_SIZE);
+        paramsConfig[METRICS_FILE_KEY] = config.getEntry("srr/metricsFile", "");
+        paramsConfig[METRICS_DUMP_INTERVAL_KEY] = config.getEntry("srr/metricsDumpInterval", DEFAULT_METRICS_DUMP_INTERVAL);
+        paramsConfig[TRACE_FILE_KEY] = config.getEntry("srr/traceFile", "");
+        paramsConfig[FLIGHT_RECORDER_SIZE_KEY] = config.getEntry("srr/flightRecorderSize", DEFAULT_FLIGHT_RECORDER_SIZE);
+        paramsConfig[FLIGHT_RECORDER_FILE_KEY] = config.getEntry("srr/flightRecorderFile", DEFAULT_FLIGHT_RECORDER_FILE);
+        paramsConfig[COMPRESSION_KEY] = config.getEntry("srr/compression", DEFAULT_COMPRESSION);
+        paramsConfig[COMPRESSION_LEVEL_KEY] = config.getEntry("srr/compressionLevel", DEFAULT_COMPRESSION_LEVEL);
+        paramsConfig[COMPRESSION_MIN_SIZE_KEY] = config.getEntry("srr/compressionMinSize", DEFAULT_COMPRESSION_MIN_SIZE);
+        paramsConfig[CHUNK_SIZE_KEY] = config.getEntry("srr/chunkSize", DEFAULT_CHUNK_SIZE);
+        paramsConfig[MAX_TRANSFER_SIZE_KEY] = config.getEntry("srr/maxTransferSize", DEFAULT_MAX_TRANSFER_SIZE);
     }
 
     if (verbose)
@@ -144,9 +192,16 @@ int main(int argc, char *argv [])
 
     srr::SrrManager srrManager(paramsConfig);
 
-    //wait until interrupt
-    std::unique_lock<std::mutex> lock(g_cvMutex);
-    g_cv.wait(lock, [] { return g_exit; });
+    //wait until interrupt, dump the flight recorder on SIGUSR1
+    int sig = 0;
+    do
+    {
+        if (sigwait(&signals, &sig) == 0 && sig == SIGUSR1)
+        {
+            srrManager.dumpFlightRecorder();
+        }
+    }
+    while (sig != SIGINT);
 
     log_info((AGENT_NAME + std::string(" interrupted")).c_str());
     
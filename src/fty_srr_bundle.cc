@@ -0,0 +1,473 @@
+/*  =========================================================================
+    fty_srr_bundle - Fty srr bundle file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_bundle - Fty srr bundle file
+@discuss
+@end
+ */
+
+#include <fty_srr_dto.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+namespace srr
+{
+    static const char BUNDLE_MAGIC[8] = {'S', 'R', 'R', 'B', 'N', 'D', 'L', '\0'};
+    static const uint32_t BUNDLE_FORMAT_VERSION = 1;
+    static const size_t BUNDLE_HEADER_SIZE = 32;
+
+    /**
+     * CRC32 (IEEE 802.3) of a buffer
+     * @param data
+     * @param size
+     * @return The CRC32
+     */
+    static uint32_t crc32(const unsigned char* data, size_t size)
+    {
+        static uint32_t table[256];
+        static bool initialized = [] {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (unsigned j = 0; j < 8; j++)
+                {
+                    crc = (crc & 1) ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1);
+                }
+                table[i] = crc;
+            }
+            return true;
+        }();
+        (void) initialized;
+
+        uint32_t crc = 0xFFFFFFFF;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    static uint32_t crc32(const std::string& data)
+    {
+        return crc32(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    }
+
+    static void appendInteger(std::string& buffer, uint64_t value, unsigned size)
+    {
+        for (unsigned i = 0; i < size; i++)
+        {
+            buffer.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+        }
+    }
+
+    static void appendString(std::string& buffer, const std::string& value)
+    {
+        appendInteger(buffer, value.size(), 4);
+        buffer.append(value);
+    }
+
+    /**
+     * Flush a file or a directory to the disk.
+     * @param path
+     * @return false on failure
+     */
+    static bool syncPath(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool synced = fsync(fd) == 0;
+        close(fd);
+        return synced;
+    }
+
+    /**
+     * Sequential reader of a memory buffer, with bound checks
+     */
+    class BundleBufferReader
+    {
+        public:
+            BundleBufferReader(const unsigned char* data, size_t size) : m_data(data), m_size(size), m_offset(0) {}
+
+            uint64_t readInteger(unsigned size)
+            {
+                check(size);
+                uint64_t value = 0;
+                for (unsigned i = 0; i < size; i++)
+                {
+                    value |= uint64_t(m_data[m_offset + i]) << (i * 8);
+                }
+                m_offset += size;
+                return value;
+            }
+
+            std::string readString()
+            {
+                size_t size = readInteger(4);
+                check(size);
+                std::string value(reinterpret_cast<const char*>(m_data + m_offset), size);
+                m_offset += size;
+                return value;
+            }
+
+            bool atEnd() const { return m_offset == m_size; }
+
+        private:
+            const unsigned char* m_data;
+            size_t m_size;
+            size_t m_offset;
+
+            void check(size_t size) const
+            {
+                if (size > m_size - m_offset)
+                {
+                    throw SrrException("Truncated bundle");
+                }
+            }
+    };
+
+    /**
+     * Write a save response as a bundle file, one feature at a time.
+     * @param path
+     * @param save
+     */
+    void SrrBundle::write(const std::string& path, const SaveResponse& save)
+    {
+        std::string tmpPath = path + ".tmp";
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            throw SrrException("Unable to create bundle " + tmpPath);
+        }
+        // Header is written once the index is known.
+        file.write(std::string(BUNDLE_HEADER_SIZE, '\0').data(), BUNDLE_HEADER_SIZE);
+
+        std::string index;
+        appendString(index, save.version());
+        appendString(index, save.checksum());
+        uint64_t offset = BUNDLE_HEADER_SIZE;
+        std::string section;
+        for (const auto& feature : save.map_features_data())
+        {
+            section.clear();
+            feature.second.SerializeToString(&section);
+            file.write(section.data(), section.size());
+            appendString(index, feature.first);
+            appendInteger(index, offset, 8);
+            appendInteger(index, section.size(), 8);
+            appendInteger(index, crc32(section), 4);
+            offset += section.size();
+        }
+        file.write(index.data(), index.size());
+
+        std::string header(BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+        appendInteger(header, BUNDLE_FORMAT_VERSION, 4);
+        appendInteger(header, save.map_features_data().size(), 4);
+        appendInteger(header, offset, 8);
+        appendInteger(header, index.size(), 4);
+        appendInteger(header, crc32(index), 4);
+        file.seekp(0);
+        file.write(header.data(), header.size());
+        file.close();
+        // Both the content and the new name must be on the disk: a crash never leaves an empty bundle.
+        if (!file || !syncPath(tmpPath))
+        {
+            throw SrrException("Unable to write bundle " + tmpPath);
+        }
+        if (rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            throw SrrException("Unable to write bundle " + path + ": " + strerror(errno));
+        }
+        size_t slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+        if (!syncPath(directory))
+        {
+            throw SrrException("Unable to write bundle " + path + ": " + strerror(errno));
+        }
+    }
+
+    /**
+     * Open a bundle file
+     * @param path
+     */
+    SrrBundle::SrrBundle(const std::string& path) :
+        m_path(path), m_data(nullptr), m_size(0)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw SrrException("Unable to open bundle " + path + ": " + strerror(errno));
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(BUNDLE_HEADER_SIZE))
+        {
+            close(fd);
+            throw SrrException("Invalid bundle " + path);
+        }
+        m_size = fileStat.st_size;
+        void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            throw SrrException("Unable to map bundle " + path + ": " + strerror(errno));
+        }
+        m_data = static_cast<const unsigned char*>(data);
+        try
+        {
+            readIndex();
+        }
+        catch (...)
+        {
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+            throw;
+        }
+    }
+
+    /**
+     * Destructor
+     */
+    SrrBundle::~SrrBundle()
+    {
+        munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+
+    /**
+     * Check the header and read the index
+     */
+    void SrrBundle::readIndex()
+    {
+        if (memcmp(m_data, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0)
+        {
+            throw SrrException("Not a bundle: " + m_path);
+        }
+        BundleBufferReader header(m_data + sizeof(BUNDLE_MAGIC), BUNDLE_HEADER_SIZE - sizeof(BUNDLE_MAGIC));
+        uint32_t formatVersion = header.readInteger(4);
+        if (formatVersion != BUNDLE_FORMAT_VERSION)
+        {
+            throw SrrException("Unsupported bundle format version " + std::to_string(formatVersion));
+        }
+        uint32_t featureCount = header.readInteger(4);
+        uint64_t indexOffset = header.readInteger(8);
+        uint32_t indexSize = header.readInteger(4);
+        uint32_t indexCrc = header.readInteger(4);
+        if (indexOffset < BUNDLE_HEADER_SIZE || indexOffset > m_size || indexSize != m_size - indexOffset)
+        {
+            throw SrrException("Invalid bundle index: " + m_path);
+        }
+        if (crc32(m_data + indexOffset, indexSize) != indexCrc)
+        {
+            throw SrrException("Corrupted bundle index: " + m_path);
+        }
+
+        BundleBufferReader index(m_data + indexOffset, indexSize);
+        m_version = index.readString();
+        m_checksum = index.readString();
+        for (uint32_t i = 0; i < featureCount; i++)
+        {
+            std::string featureName = index.readString();
+            section featureSection;
+            featureSection.offset = index.readInteger(8);
+            featureSection.size = index.readInteger(8);
+            featureSection.crc = index.readInteger(4);
+            if (featureSection.offset < BUNDLE_HEADER_SIZE || featureSection.offset > indexOffset || featureSection.size > indexOffset - featureSection.offset)
+            {
+                throw SrrException("Invalid bundle section for " + featureName);
+            }
+            m_index[featureName] = featureSection;
+        }
+        if (!index.atEnd())
+        {
+            throw SrrException("Invalid bundle index: " + m_path);
+        }
+    }
+
+    /**
+     * Get the bundle feature names
+     * @return The feature names
+     */
+    std::vector<std::string> SrrBundle::features() const
+    {
+        std::vector<std::string> featureNames;
+        for (const auto& feature : m_index)
+        {
+            featureNames.push_back(feature.first);
+        }
+        return featureNames;
+    }
+
+    bool SrrBundle::contains(const std::string& featureName) const
+    {
+        return m_index.find(featureName) != m_index.end();
+    }
+
+    /**
+     * Decode one feature, after having checked its section
+     * @param featureName
+     * @return The feature
+     */
+    Feature SrrBundle::getFeature(const std::string& featureName) const
+    {
+        auto it = m_index.find(featureName);
+        if (it == m_index.end())
+        {
+            throw SrrException("Feature " + featureName + " is not in bundle " + m_path);
+        }
+        const unsigned char* data = m_data + it->second.offset;
+        if (crc32(data, it->second.size) != it->second.crc)
+        {
+            throw SrrException("Corrupted bundle section for " + featureName);
+        }
+        Feature feature;
+        if (!feature.ParseFromArray(data, static_cast<int>(it->second.size)))
+        {
+            throw SrrException("Invalid bundle section for " + featureName);
+        }
+        return feature;
+    }
+
+    /**
+     * Get a fingerprint of a feature section from the index, without reading it
+     * @param featureName
+     * @return The section CRC32 and size
+     */
+    std::string SrrBundle::getFeatureFingerprint(const std::string& featureName) const
+    {
+        auto it = m_index.find(featureName);
+        if (it == m_index.end())
+        {
+            throw SrrException("Feature " + featureName + " is not in bundle " + m_path);
+        }
+        char fingerprint[32];
+        snprintf(fingerprint, sizeof(fingerprint), "%08x-%llx", it->second.crc, static_cast<unsigned long long>(it->second.size));
+        return fingerprint;
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_bundle_test (bool verbose)
+{
+    printf (" * fty_srr_bundle: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    // CRC32 known answer
+    assert (crc32 ("123456789") == 0xCBF43926);
+    assert (crc32 ("") == 0);
+
+    // Written, then read back through the mapping
+    std::string path = std::string (SELFTEST_DIR_RW) + "/bundle";
+    SaveResponse save;
+    save.set_version ("1.0");
+    save.set_checksum ("checksum");
+    Feature feature1;
+    feature1.set_version ("1.0");
+    feature1.set_data ("payload1");
+    Feature feature2;
+    feature2.set_version ("1.0");
+    feature2.set_data (std::string (1000, 'x'));
+    (*save.mutable_map_features_data ())["feature1"] = feature1;
+    (*save.mutable_map_features_data ())["feature2"] = feature2;
+    SrrBundle::write (path, save);
+    {
+        SrrBundle bundle (path);
+        assert (bundle.version () == "1.0");
+        assert (bundle.checksum () == "checksum");
+        assert ((bundle.features () == std::vector<std::string> {"feature1", "feature2"}));
+        assert (bundle.contains ("feature2"));
+        assert (!bundle.contains ("feature3"));
+        assert (bundle.getFeature ("feature1").data () == "payload1");
+        assert (bundle.getFeature ("feature2").data () == feature2.data ());
+        assert (bundle.getFeatureFingerprint ("feature1") != bundle.getFeatureFingerprint ("feature2"));
+    }
+
+    // A corrupted section is only rejected when it is read.
+    {
+        std::fstream file (path, std::ios::in | std::ios::out | std::ios::binary);
+        std::string content ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char> ());
+        size_t payload = content.find (feature2.data ());
+        assert (payload != std::string::npos);
+        file.seekp (payload + feature2.data ().size () / 2);
+        file.put ('y');
+    }
+    {
+        SrrBundle bundle (path);
+        assert (bundle.getFeature ("feature1").data () == "payload1");
+        bool rejected = false;
+        try {
+            bundle.getFeature ("feature2");
+        }
+        catch (const SrrException&) {
+            rejected = true;
+        }
+        assert (rejected);
+    }
+
+    // A corrupted or truncated index is rejected at once.
+    struct stat fileStat;
+    stat (path.c_str (), &fileStat);
+    {
+        std::fstream file (path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp (fileStat.st_size - 1);
+        file.put ('\xff');
+    }
+    for (off_t size : {fileStat.st_size, fileStat.st_size - 1, off_t (BUNDLE_HEADER_SIZE - 1)}) {
+        assert (truncate (path.c_str (), size) == 0);
+        bool rejected = false;
+        try {
+            SrrBundle bundle (path);
+        }
+        catch (const SrrException&) {
+            rejected = true;
+        }
+        assert (rejected);
+    }
+    unlink (path.c_str ());
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,84 @@
+/*  =========================================================================
+    fty_srr_bundle - Fty srr bundle file
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_BUNDLE_H_INCLUDED
+#define FTY_SRR_BUNDLE_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace srr
+{
+    /**
+     * \brief Save bundle file, with random access to each feature.
+     *
+     * Layout (integers are little endian):
+     *  - header: magic "SRRBNDL\0", format version (u32), feature count (u32),
+     *    index offset (u64), index size (u32), index CRC32 (u32)
+     *  - feature sections: each one a serialized dto::srr::Feature
+     *  - index: srr version and checksum, then for each feature its name,
+     *    section offset (u64), section size (u64) and section CRC32 (u32)
+     * Strings are stored as their size (u32) followed by their bytes.
+     *
+     * The file is memory mapped when read, and only the requested features are decoded.
+     */
+    class SrrBundle
+    {
+        public:
+            static void write(const std::string& path, const dto::srr::SaveResponse& save);
+
+            explicit SrrBundle(const std::string& path);
+            ~SrrBundle();
+            SrrBundle(const SrrBundle&) = delete;
+            SrrBundle& operator=(const SrrBundle&) = delete;
+
+            const std::string& version() const { return m_version; }
+            const std::string& checksum() const { return m_checksum; }
+            std::vector<std::string> features() const;
+            bool contains(const std::string& featureName) const;
+            dto::srr::Feature getFeature(const std::string& featureName) const;
+            std::string getFeatureFingerprint(const std::string& featureName) const;
+
+        private:
+            struct section {
+                uint64_t offset;
+                uint64_t size;
+                uint32_t crc;
+            };
+
+            std::string m_path;
+            const unsigned char* m_data;
+            size_t m_size;
+            std::string m_version;
+            std::string m_checksum;
+            std::map<std::string, section> m_index;
+
+            void readIndex();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_bundle_test (bool verbose);
+
+#endif
@@ -0,0 +1,441 @@
+/*  =========================================================================
+    fty_srr_chunk_transfer - Fty srr chunked transfer
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_chunk_transfer - Fty srr chunked transfer
+@discuss
+@end
+ */
+
+#include <cassert>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    // Transfers without news for longer than that are dropped.
+    static const std::chrono::minutes TRANSFER_EXPIRATION(5);
+    static const size_t FRAME_HEADER_SIZE = 4;
+
+    /**
+     * Constructor
+     * @param chunkSize Maximum size of a chunk, 0 to never cut payloads
+     * @param maxTransferSize Maximum size of a received payload
+     */
+    SrrChunkTransfer::SrrChunkTransfer(size_t chunkSize, size_t maxTransferSize) :
+        m_chunkSize(chunkSize), m_maxTransferSize(maxTransferSize)
+    {
+    }
+
+    /**
+     * Check if a message is a chunk of a bigger one
+     * @param msg
+     * @return True for a chunk
+     */
+    bool SrrChunkTransfer::isChunk(const messagebus::Message& msg)
+    {
+        return msg.metaData().find(CHUNK_COUNT_META) != msg.metaData().end();
+    }
+
+    /**
+     * Check if the sender of a message reads chunks
+     * @param msg
+     * @return True if chunks may be sent to it
+     */
+    bool SrrChunkTransfer::acceptsChunks(const messagebus::Message& msg)
+    {
+        auto acceptChunks = msg.metaData().find(ACCEPT_CHUNKS_META);
+        return acceptChunks != msg.metaData().end() && acceptChunks->second == "true";
+    }
+
+    /**
+     * Build the request pulling a chunk of a reply
+     * @param chunk A chunk of the reply
+     * @param chunkIndex Index of the chunk to pull
+     * @return The request, without its routing meta data
+     */
+    messagebus::Message SrrChunkTransfer::createChunkRequest(const messagebus::Message& chunk, unsigned chunkIndex)
+    {
+        messagebus::Message req;
+        req.metaData().emplace(messagebus::Message::SUBJECT, CHUNK_GET_SUBJECT);
+        req.metaData().emplace(TRANSFER_ID_META, chunk.metaData().at(TRANSFER_ID_META));
+        req.metaData().emplace(CHUNK_INDEX_META, std::to_string(chunkIndex));
+        return req;
+    }
+
+    /**
+     * Tell the peer it may send chunks
+     * @param msg
+     */
+    void SrrChunkTransfer::advertise(messagebus::Message& msg) const
+    {
+        if (isEnabled())
+        {
+            msg.metaData()[ACCEPT_CHUNKS_META] = "true";
+        }
+    }
+
+    /**
+     * Get the client of a request, the one its reply goes to
+     * @param msg
+     * @return The client, empty if not known
+     */
+    static std::string getClient(const messagebus::Message& msg)
+    {
+        auto replyTo = msg.metaData().find(messagebus::Message::REPLY_TO);
+        return replyTo != msg.metaData().end() ? replyTo->second : "";
+    }
+
+    /**
+     * Constructor
+     * @param msg Message to cut, owned by the chunks
+     * @param chunkSize Maximum size of a chunk, 0 to keep the message whole
+     */
+    SrrChunkTransfer::Chunks::Chunks(messagebus::Message msg, size_t chunkSize) :
+        m_msg(std::move(msg)), m_chunkSize(chunkSize), m_count(1), m_nextIndex(0), m_remaining(0), m_frameOffset(0)
+    {
+        for (const auto& frame : m_msg.userData())
+        {
+            m_remaining += FRAME_HEADER_SIZE + frame.size();
+        }
+        if (m_chunkSize > 0 && m_remaining > m_chunkSize)
+        {
+            m_transferId = messagebus::generateUuid();
+            m_count = (m_remaining + m_chunkSize - 1) / m_chunkSize;
+        }
+    }
+
+    /**
+     * Cut the next chunk
+     * @return The chunk message, or the message itself if it is small enough
+     */
+    messagebus::Message SrrChunkTransfer::Chunks::next()
+    {
+        if (!hasNext())
+        {
+            throw SrrException("No chunk left in transfer " + m_transferId);
+        }
+        if (m_transferId.empty())
+        {
+            m_nextIndex++;
+            return std::move(m_msg);
+        }
+
+        // Frame size (big endian) then frame content, taken from the first frame left.
+        std::string content;
+        content.reserve(std::min(m_chunkSize, m_remaining));
+        dto::UserData& frames = m_msg.userData();
+        while (content.size() < m_chunkSize && !frames.empty())
+        {
+            const std::string& frame = frames.front();
+            size_t written;
+            if (m_frameOffset < FRAME_HEADER_SIZE)
+            {
+                uint32_t frameSize = static_cast<uint32_t>(frame.size());
+                const char header[FRAME_HEADER_SIZE] = {
+                    static_cast<char>(frameSize >> 24), static_cast<char>(frameSize >> 16),
+                    static_cast<char>(frameSize >> 8), static_cast<char>(frameSize) };
+                written = std::min(FRAME_HEADER_SIZE - m_frameOffset, m_chunkSize - content.size());
+                content.append(header + m_frameOffset, written);
+            }
+            else
+            {
+                size_t offset = m_frameOffset - FRAME_HEADER_SIZE;
+                written = std::min(frame.size() - offset, m_chunkSize - content.size());
+                content.append(frame, offset, written);
+            }
+            m_frameOffset += written;
+            if (m_frameOffset == FRAME_HEADER_SIZE + frame.size())
+            {
+                frames.erase(frames.begin());
+                m_frameOffset = 0;
+            }
+        }
+        m_remaining -= content.size();
+
+        messagebus::Message chunk;
+        chunk.metaData() = m_msg.metaData();
+        chunk.metaData()[TRANSFER_ID_META] = m_transferId;
+        chunk.metaData()[CHUNK_INDEX_META] = std::to_string(m_nextIndex);
+        chunk.metaData()[CHUNK_COUNT_META] = std::to_string(m_count);
+        chunk.userData().push_back(std::move(content));
+        m_nextIndex++;
+        return chunk;
+    }
+
+    /**
+     * Cut a reply in chunks, keep all but the first one for the client to pull them.
+     * @param request The request of the client
+     * @param msg The reply
+     * @return The first chunk, or the reply itself if it is small enough
+     */
+    messagebus::Message SrrChunkTransfer::storeChunks(const messagebus::Message& request, messagebus::Message msg)
+    {
+        Chunks chunks(std::move(msg), m_chunkSize);
+        messagebus::Message firstChunk = chunks.next();
+        if (!chunks.hasNext())
+        {
+            return firstChunk;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        removeExpiredTransfers();
+        m_outboxes.emplace(firstChunk.metaData().at(TRANSFER_ID_META), outbox{std::move(chunks), getClient(request), std::chrono::steady_clock::now()});
+        return firstChunk;
+    }
+
+    /**
+     * Get the next stored chunk, the transfer is dropped after its last chunk.
+     * @param request The getChunk request, from the client of the transfer
+     * @return The chunk
+     */
+    messagebus::Message SrrChunkTransfer::getStoredChunk(const messagebus::Message& request)
+    {
+        const std::string& transferId = request.metaData().at(TRANSFER_ID_META);
+        size_t chunkIndex = std::stoul(request.metaData().at(CHUNK_INDEX_META));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto transfer = m_outboxes.find(transferId);
+        // The chunks are cut in order, as they are pulled.
+        if (transfer == m_outboxes.end() || transfer->second.client != getClient(request) || chunkIndex != transfer->second.chunks.getNextIndex())
+        {
+            throw SrrException("Unknown chunk " + std::to_string(chunkIndex) + " of transfer " + transferId);
+        }
+        messagebus::Message chunk = transfer->second.chunks.next();
+        transfer->second.lastUpdate = std::chrono::steady_clock::now();
+        if (!transfer->second.chunks.hasNext())
+        {
+            m_outboxes.erase(transfer);
+        }
+        return chunk;
+    }
+
+    /**
+     * Add a received chunk to its transfer. The chunks must come in order, from the same client.
+     * @param msg The chunk, replaced by the whole message once the last chunk is received
+     * @return True when the transfer is complete
+     */
+    bool SrrChunkTransfer::addChunk(messagebus::Message& msg)
+    {
+        std::string transferId = msg.metaData().at(TRANSFER_ID_META);
+        unsigned chunkIndex = std::stoul(msg.metaData().at(CHUNK_INDEX_META));
+        unsigned chunkCount = std::stoul(msg.metaData().at(CHUNK_COUNT_META));
+        std::string client = getClient(msg);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        removeExpiredTransfers();
+        auto it = m_assemblies.find(transferId);
+        if (it != m_assemblies.end() && it->second.client != client)
+        {
+            throw SrrException("Chunk " + std::to_string(chunkIndex) + " of transfer " + transferId + " is from another client");
+        }
+        if (it == m_assemblies.end())
+        {
+            it = m_assemblies.emplace(transferId, assembly()).first;
+            it->second.client = client;
+        }
+        assembly& transfer = it->second;
+        try
+        {
+            if (chunkIndex != transfer.nextIndex)
+            {
+                throw SrrException("Chunk " + std::to_string(chunkIndex) + " of transfer " + transferId + " is out of sequence");
+            }
+            for (const auto& content : msg.userData())
+            {
+                decodeFrames(transfer, content);
+            }
+            transfer.nextIndex++;
+            transfer.lastUpdate = std::chrono::steady_clock::now();
+            if (transfer.nextIndex < chunkCount)
+            {
+                msg.userData().clear();
+                return false;
+            }
+            if (transfer.frameMissing > 0 || transfer.headerSize > 0)
+            {
+                throw SrrException("Transfer " + transferId + " is truncated");
+            }
+        }
+        catch (...)
+        {
+            m_assemblies.erase(it);
+            throw;
+        }
+        msg.userData() = std::move(transfer.frames);
+        m_assemblies.erase(it);
+        msg.metaData().erase(TRANSFER_ID_META);
+        msg.metaData().erase(CHUNK_INDEX_META);
+        msg.metaData().erase(CHUNK_COUNT_META);
+        return true;
+    }
+
+    /**
+     * Add the content of a chunk to the frames of its transfer, lock held.
+     * @param transfer
+     * @param content
+     */
+    void SrrChunkTransfer::decodeFrames(assembly& transfer, const std::string& content) const
+    {
+        if (content.size() > m_maxTransferSize - transfer.size)
+        {
+            throw SrrException("Transfer is too big");
+        }
+        size_t pos = 0;
+        while (pos < content.size())
+        {
+            if (transfer.frameMissing > 0)
+            {
+                size_t read = std::min(transfer.frameMissing, content.size() - pos);
+                transfer.frames.back().append(content, pos, read);
+                transfer.frameMissing -= read;
+                pos += read;
+                continue;
+            }
+            transfer.header[transfer.headerSize++] = content[pos++];
+            if (transfer.headerSize == FRAME_HEADER_SIZE)
+            {
+                const unsigned char* header = reinterpret_cast<const unsigned char*>(transfer.header);
+                size_t frameSize = (size_t(header[0]) << 24) | (size_t(header[1]) << 16) | (size_t(header[2]) << 8) | size_t(header[3]);
+                // The frame must still fit in the transfer.
+                if (frameSize > m_maxTransferSize - (transfer.size + pos))
+                {
+                    throw SrrException("Transfer is too big");
+                }
+                transfer.frames.emplace_back();
+                transfer.frames.back().reserve(frameSize);
+                transfer.frameMissing = frameSize;
+                transfer.headerSize = 0;
+            }
+        }
+        transfer.size += content.size();
+    }
+
+    /**
+     * Drop the transfers abandoned by the peer, lock held.
+     */
+    void SrrChunkTransfer::removeExpiredTransfers()
+    {
+        auto expiration = std::chrono::steady_clock::now() - TRANSFER_EXPIRATION;
+        for (auto it = m_assemblies.begin(); it != m_assemblies.end();)
+        {
+            it = (it->second.lastUpdate < expiration) ? m_assemblies.erase(it) : std::next(it);
+        }
+        for (auto it = m_outboxes.begin(); it != m_outboxes.end();)
+        {
+            it = (it->second.lastUpdate < expiration) ? m_outboxes.erase(it) : std::next(it);
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_chunk_transfer_test (bool verbose)
+{
+    printf (" * fty_srr_chunk_transfer: ");
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    using srr::SrrChunkTransfer;
+
+    // Split and reassemble: frames cut anywhere, headers included.
+    messagebus::Message msg;
+    msg.metaData()[messagebus::Message::SUBJECT] = "restore";
+    msg.metaData()[messagebus::Message::REPLY_TO] = "client-1";
+    msg.userData().push_back("");
+    msg.userData().push_back("a");
+    msg.userData().push_back(std::string(100, 'b'));
+    msg.userData().push_back("1234567");
+    dto::UserData frames = msg.userData();
+
+    SrrChunkTransfer receiver(10, 1000);
+    SrrChunkTransfer::Chunks chunks(msg, 10);
+    // 4 headers, 108 bytes of content
+    assert (chunks.count() == 13);
+    bool complete = false;
+    while (chunks.hasNext())
+    {
+        messagebus::Message chunk = chunks.next();
+        assert (SrrChunkTransfer::isChunk(chunk));
+        assert (chunk.userData().front().size() <= 10);
+        assert (!complete);
+        complete = receiver.addChunk(chunk);
+        if (complete)
+        {
+            assert (chunk.userData() == frames);
+            assert (!SrrChunkTransfer::isChunk(chunk));
+            assert (chunk.metaData().at(messagebus::Message::SUBJECT) == "restore");
+        }
+    }
+    assert (complete);
+
+    // A small message is not cut.
+    SrrChunkTransfer::Chunks whole(msg, 1000);
+    assert (whole.count() == 1);
+    messagebus::Message wholeMsg = whole.next();
+    assert (!SrrChunkTransfer::isChunk(wholeMsg));
+    assert (wholeMsg.userData() == frames);
+
+    // Stored reply pulled by its client only.
+    SrrChunkTransfer sender(10, 1000);
+    messagebus::Message request;
+    request.metaData()[messagebus::Message::REPLY_TO] = "client-1";
+    messagebus::Message firstChunk = sender.storeChunks(request, msg);
+    assert (SrrChunkTransfer::isChunk(firstChunk));
+    messagebus::Message reply = firstChunk;
+    complete = receiver.addChunk(reply);
+    for (unsigned chunkIndex = 1; !complete; chunkIndex++)
+    {
+        messagebus::Message chunkRequest = SrrChunkTransfer::createChunkRequest(firstChunk, chunkIndex);
+        chunkRequest.metaData()[messagebus::Message::REPLY_TO] = "client-2";
+        try
+        {
+            sender.getStoredChunk(chunkRequest);
+            assert (false);
+        }
+        catch (const srr::SrrException&)
+        {
+        }
+        chunkRequest.metaData()[messagebus::Message::REPLY_TO] = "client-1";
+        reply = sender.getStoredChunk(chunkRequest);
+        complete = receiver.addChunk(reply);
+    }
+    assert (reply.userData() == frames);
+
+    // Too big for the receiver
+    SrrChunkTransfer smallReceiver(10, 50);
+    SrrChunkTransfer::Chunks bigChunks(msg, 10);
+    try
+    {
+        while (bigChunks.hasNext())
+        {
+            messagebus::Message chunk = bigChunks.next();
+            smallReceiver.addChunk(chunk);
+        }
+        assert (false);
+    }
+    catch (const srr::SrrException&)
+    {
+    }
+    //  @end
+    printf ("OK\n");
+}
@@ -0,0 +1,129 @@
+/*  =========================================================================
+    fty_srr_chunk_transfer - Fty srr chunked transfer
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_CHUNK_TRANSFER_H_INCLUDED
+#define FTY_SRR_CHUNK_TRANSFER_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace srr
+{
+    /**
+     * \brief Transfer of big payloads in bounded chunks.
+     *
+     * The frames of a payload are serialized in one stream, cut in chunks of at
+     * most chunkSize bytes. Every chunk message holds the transfer id, its index
+     * and the chunk count in its meta data. A request is sent chunk by chunk, each
+     * one acknowledged by an empty reply, the last one getting the real reply.
+     * A reply only holds its first chunk, the receiver pulls the others with the
+     * getChunk subject. Chunks are only sent to peers which advertised it.
+     *
+     * Chunks are cut one at a time as they are sent, and the frames rebuilt as
+     * the chunks come: a transfer holds about one copy of its payload.
+     */
+    class SrrChunkTransfer
+    {
+        public:
+            /**
+             * \brief Chunks of a message, each one cut when it is taken.
+             * The frames of the message are freed once taken.
+             */
+            class Chunks
+            {
+                public:
+                    // chunkSize 0 to keep the message whole.
+                    Chunks(messagebus::Message msg, size_t chunkSize);
+
+                    size_t count() const { return m_count; }
+                    size_t getNextIndex() const { return m_nextIndex; }
+                    bool hasNext() const { return m_nextIndex < m_count; }
+                    messagebus::Message next();
+
+                private:
+                    messagebus::Message m_msg;
+                    size_t m_chunkSize;
+                    // Empty when the message is not cut.
+                    std::string m_transferId;
+                    size_t m_count;
+                    size_t m_nextIndex;
+                    // Bytes of the stream still to take.
+                    size_t m_remaining;
+                    // Bytes of the first frame already taken, its header included.
+                    size_t m_frameOffset;
+            };
+
+            // chunkSize 0 to disable the chunks.
+            SrrChunkTransfer(size_t chunkSize, size_t maxTransferSize);
+            ~SrrChunkTransfer() = default;
+
+            static bool isChunk(const messagebus::Message& msg);
+            static bool acceptsChunks(const messagebus::Message& msg);
+            static messagebus::Message createChunkRequest(const messagebus::Message& chunk, unsigned chunkIndex);
+
+            bool isEnabled() const { return m_chunkSize > 0; }
+            size_t getChunkSize() const { return m_chunkSize; }
+            void advertise(messagebus::Message& msg) const;
+            messagebus::Message storeChunks(const messagebus::Message& request, messagebus::Message msg);
+            messagebus::Message getStoredChunk(const messagebus::Message& request);
+            bool addChunk(messagebus::Message& msg);
+
+        private:
+            // Transfer being received, decoded as the chunks come
+            struct assembly {
+                std::string client;
+                unsigned nextIndex = 0;
+                // Bytes of the stream received
+                size_t size = 0;
+                // The last frame misses frameMissing bytes.
+                dto::UserData frames;
+                size_t frameMissing = 0;
+                // Header of the next frame, when cut between two chunks
+                char header[4];
+                size_t headerSize = 0;
+                std::chrono::steady_clock::time_point lastUpdate;
+            };
+            // Transfer being pulled, by the client which requested it only
+            struct outbox {
+                Chunks chunks;
+                std::string client;
+                std::chrono::steady_clock::time_point lastUpdate;
+            };
+
+            size_t m_chunkSize;
+            size_t m_maxTransferSize;
+            std::mutex m_mutex;
+            std::map<std::string, assembly> m_assemblies;
+            std::map<std::string, outbox> m_outboxes;
+
+            void decodeFrames(assembly& transfer, const std::string& content) const;
+            void removeExpiredTransfers();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_chunk_transfer_test (bool verbose);
+
+#endif
@@ -41,6 +41,54 @@ typedef struct _fty_srr_manager_t fty_srr_manager_t;
 typedef struct _fty_srr_worker_t fty_srr_worker_t;
 #define FTY_SRR_WORKER_T_DEFINED
 #endif
+#ifndef FTY_SRR_JOB_MANAGER_T_DEFINED
+typedef struct _fty_srr_job_manager_t fty_srr_job_manager_t;
+#define FTY_SRR_JOB_MANAGER_T_DEFINED
+#endif
+#ifndef FTY_SRR_THREAD_POOL_T_DEFINED
+typedef struct _fty_srr_thread_pool_t fty_srr_thread_pool_t;
+#define FTY_SRR_THREAD_POOL_T_DEFINED
+#endif
+#ifndef FTY_SRR_SNAPSHOT_STORE_T_DEFINED
+typedef struct _fty_srr_snapshot_store_t fty_srr_snapshot_store_t;
+#define FTY_SRR_SNAPSHOT_STORE_T_DEFINED
+#endif
+#ifndef FTY_SRR_BUNDLE_T_DEFINED
+typedef struct _fty_srr_bundle_t fty_srr_bundle_t;
+#define FTY_SRR_BUNDLE_T_DEFINED
+#endif
+#ifndef FTY_SRR_COMPRESSION_T_DEFINED
+typedef struct _fty_srr_compression_t fty_srr_compression_t;
+#define FTY_SRR_COMPRESSION_T_DEFINED
+#endif
+#ifndef FTY_SRR_RESTORE_JOURNAL_T_DEFINED
+typedef struct _fty_srr_restore_journal_t fty_srr_restore_journal_t;
+#define FTY_SRR_RESTORE_JOURNAL_T_DEFINED
+#endif
+#ifndef FTY_SRR_CHUNK_TRANSFER_T_DEFINED
+typedef struct _fty_srr_chunk_transfer_t fty_srr_chunk_transfer_t;
+#define FTY_SRR_CHUNK_TRANSFER_T_DEFINED
+#endif
+#ifndef FTY_SRR_FEATURE_SOURCE_T_DEFINED
+typedef struct _fty_srr_feature_source_t fty_srr_feature_source_t;
+#define FTY_SRR_FEATURE_SOURCE_T_DEFINED
+#endif
+#ifndef FTY_SRR_INPROCESS_BUS_T_DEFINED
+typedef struct _fty_srr_inprocess_bus_t fty_srr_inprocess_bus_t;
+#define FTY_SRR_INPROCESS_BUS_T_DEFINED
+#endif
+#ifndef FTY_SRR_METRICS_T_DEFINED
+typedef struct _fty_srr_metrics_t fty_srr_metrics_t;
+#define FTY_SRR_METRICS_T_DEFINED
+#endif
+#ifndef FTY_SRR_TRACER_T_DEFINED
+typedef struct _fty_srr_tracer_t fty_srr_tracer_t;
+#define FTY_SRR_TRACER_T_DEFINED
+#endif
+#ifndef FTY_SRR_FLIGHT_RECORDER_T_DEFINED
+typedef struct _fty_srr_flight_recorder_t fty_srr_flight_recorder_t;
+#define FTY_SRR_FLIGHT_RECORDER_T_DEFINED
+#endif
 
 //  Extra headers
 
@@ -85,6 +133,19 @@ safe_malloc (size_t size, const char *file, unsigned line)
 
 #include "fty_srr_manager.h"
 #include "fty_srr_worker.h"
+#include "fty_srr_job_manager.h"
+#include "fty_srr_thread_pool.h"
+#include "fty_srr_snapshot_store.h"
+#include "fty_srr_bundle.h"
+#include "fty_srr_compression.h"
+#include "fty_srr_restore_journal.h"
+#include "fty_srr_chunk_transfer.h"
+#include "fty_srr_feature_source.h"
+#include "fty_srr_inprocess_bus.h"
+#include "fty_srr_metrics.h"
+#include "fty_srr_tracer.h"
+#include "fty_srr_flight_recorder.h"
+#include "fty_srr_probes.h"
 
 //  *** To avoid double-definitions, only define if building without draft ***
 #ifndef FTY_SRR_BUILD_DRAFT_API
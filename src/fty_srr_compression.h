@@ -0,0 +1,67 @@
+/*  =========================================================================
+    fty_srr_compression - Fty srr payload compression
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_COMPRESSION_H_INCLUDED
+#define FTY_SRR_COMPRESSION_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <string>
+
+namespace srr
+{
+    /**
+     * \brief Compression of the message payloads, negotiated with the peer.
+     *
+     * Each side advertises the encodings it can read in the accept encoding
+     * meta data. A payload is only compressed when the peer advertised the
+     * configured encoding, the content encoding meta data then tells how to
+     * read it. Peers which know nothing about it keep exchanging plain payloads.
+     */
+    class SrrCompression
+    {
+        public:
+            explicit SrrCompression(const std::string& encoding, int level, size_t minSize);
+            ~SrrCompression() = default;
+
+            const std::string& getEncoding() const;
+            bool isEnabled() const;
+            bool isAcceptedBy(const std::string& peerAcceptEncoding) const;
+
+            void encode(messagebus::Message& msg, const std::string& peerAcceptEncoding) const;
+            void decode(messagebus::Message& msg) const;
+
+            static std::string getAcceptEncoding(const messagebus::Message& msg);
+            static std::string compress(const std::string& data, int level);
+            static std::string decompress(const std::string& data);
+
+        private:
+            std::string m_encoding;
+            int m_level;
+            // Payloads smaller than that are not worth compressing.
+            size_t m_minSize;
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_compression_test (bool verbose);
+
+#endif
@@ -0,0 +1,231 @@
+/*  =========================================================================
+    fty_srr_feature_source - Fty srr feature sources
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_feature_source - Fty srr feature sources
+@discuss
+@end
+ */
+
+#include <fty_srr_dto.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+namespace srr
+{
+    SrrQueryFeatureSource::SrrQueryFeatureSource(RestoreQuery& query) :
+        m_query(query)
+    {
+    }
+
+    std::set<FeatureName> SrrQueryFeatureSource::getFeatures() const
+    {
+        std::set<FeatureName> features;
+        for (const auto& feature : m_query.map_features_data())
+        {
+            features.insert(feature.first);
+        }
+        return features;
+    }
+
+    void SrrQueryFeatureSource::getFeature(const FeatureName& featureName, Feature& feature)
+    {
+        std::lock_guard<std::mutex> lock(m_queryMutex);
+        feature.Swap(&(m_query.mutable_map_features_data()->at(featureName)));
+    }
+
+    /**
+     * Constructor
+     * @param path Bundle file
+     * @param features Features to restore, all when empty
+     */
+    SrrBundleFeatureSource::SrrBundleFeatureSource(const std::string& path, const std::set<FeatureName>& features) :
+        m_bundle(path), m_features(features)
+    {
+        if (m_features.empty())
+        {
+            std::vector<std::string> bundleFeatures = m_bundle.features();
+            m_features.insert(bundleFeatures.begin(), bundleFeatures.end());
+        }
+        for (const auto& featureName : m_features)
+        {
+            if (!m_bundle.contains(featureName))
+            {
+                throw SrrException("Feature " + featureName + " is not in bundle " + path);
+            }
+        }
+    }
+
+    std::set<FeatureName> SrrBundleFeatureSource::getFeatures() const
+    {
+        return m_features;
+    }
+
+    void SrrBundleFeatureSource::getFeature(const FeatureName& featureName, Feature& feature)
+    {
+        feature = m_bundle.getFeature(featureName);
+    }
+
+    /**
+     * Constructor
+     * @param store
+     * @param snapshot
+     * @param deltaQuery Incremental save query, its manifest excepted, or nullptr
+     */
+    SrrSnapshotFeatureSource::SrrSnapshotFeatureSource(SrrSnapshotStore& store, const SrrSnapshotStore::manifest& snapshot, RestoreQuery* deltaQuery) :
+        m_store(store), m_snapshot(snapshot), m_deltaQuery(deltaQuery)
+    {
+    }
+
+    std::set<FeatureName> SrrSnapshotFeatureSource::getFeatures() const
+    {
+        std::set<FeatureName> features;
+        for (const auto& feature : m_snapshot.featuresHash)
+        {
+            features.insert(feature.first);
+        }
+        return features;
+    }
+
+    void SrrSnapshotFeatureSource::getFeature(const FeatureName& featureName, Feature& feature)
+    {
+        if (m_deltaQuery)
+        {
+            std::lock_guard<std::mutex> lock(m_deltaQueryMutex);
+            auto deltaFeature = m_deltaQuery->mutable_map_features_data()->find(featureName);
+            if (deltaFeature != m_deltaQuery->mutable_map_features_data()->end())
+            {
+                feature.Swap(&(deltaFeature->second));
+                return;
+            }
+        }
+        if (!m_store.get(m_snapshot.featuresHash.at(featureName), feature))
+        {
+            throw SrrException("Content of " + featureName + " from snapshot " + m_snapshot.id + " is no more available");
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_feature_source_test (bool verbose)
+{
+    printf (" * fty_srr_feature_source: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    SaveResponse save;
+    save.set_version ("1.0");
+    save.set_checksum ("checksum");
+    for (const std::string featureName : {"feature1", "feature2"}) {
+        Feature feature;
+        feature.set_version ("1.0");
+        feature.set_data ("payload of " + featureName);
+        (*save.mutable_map_features_data ())[featureName] = feature;
+    }
+    std::set<FeatureName> allFeatures = {"feature1", "feature2"};
+
+    // Query: a feature is moved out when loaded.
+    {
+        RestoreQuery query;
+        *query.mutable_map_features_data () = save.map_features_data ();
+        SrrQueryFeatureSource source (query);
+        assert (source.getFeatures () == allFeatures);
+        Feature feature;
+        source.getFeature ("feature1", feature);
+        assert (feature.data () == "payload of feature1");
+        assert (query.map_features_data ().at ("feature1").data ().empty ());
+    }
+
+    // Bundle: all its features or the requested ones, which must be in it.
+    {
+        std::string path = std::string (SELFTEST_DIR_RW) + "/feature-source.bundle";
+        SrrBundle::write (path, save);
+        SrrBundleFeatureSource all (path, {});
+        assert (all.getFeatures () == allFeatures);
+        SrrBundleFeatureSource source (path, {"feature2"});
+        assert ((source.getFeatures () == std::set<FeatureName> {"feature2"}));
+        Feature feature;
+        source.getFeature ("feature2", feature);
+        assert (feature.data () == "payload of feature2");
+        // Loaded again, the bundle is kept.
+        source.getFeature ("feature2", feature);
+        assert (feature.data () == "payload of feature2");
+        bool rejected = false;
+        try {
+            SrrBundleFeatureSource missing (path, {"feature3"});
+        }
+        catch (const SrrException&) {
+            rejected = true;
+        }
+        assert (rejected);
+        unlink (path.c_str ());
+    }
+
+    // Snapshot: the features of the delta query take precedence over the stored ones.
+    {
+        SrrSnapshotStore store ("", 2, 0);
+        SrrSnapshotStore::manifest snapshot = store.addSnapshot (save, "");
+        RestoreQuery delta;
+        Feature changed;
+        changed.set_version ("1.0");
+        changed.set_data ("changed payload of feature2");
+        (*delta.mutable_map_features_data ())["feature2"] = changed;
+        SrrSnapshotFeatureSource source (store, snapshot, &delta);
+        assert (source.getFeatures () == allFeatures);
+        Feature feature;
+        source.getFeature ("feature1", feature);
+        assert (feature.data () == "payload of feature1");
+        Feature changedFeature;
+        source.getFeature ("feature2", changedFeature);
+        assert (changedFeature.data () == "changed payload of feature2");
+        assert (delta.map_features_data ().at ("feature2").data ().empty ());
+
+        // A content no more in the store is reported.
+        snapshot.featuresHash["feature1"] = SrrSnapshotStore::hash ("unknown");
+        SrrSnapshotFeatureSource removed (store, snapshot);
+        bool rejected = false;
+        try {
+            removed.getFeature ("feature1", feature);
+        }
+        catch (const SrrException&) {
+            rejected = true;
+        }
+        assert (rejected);
+    }
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,111 @@
+/*  =========================================================================
+    fty_srr_feature_source - Fty srr feature sources
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_FEATURE_SOURCE_H_INCLUDED
+#define FTY_SRR_FEATURE_SOURCE_H_INCLUDED
+
+#include "fty_srr_bundle.h"
+#include "fty_srr_snapshot_store.h"
+
+#include <google/protobuf/arena.h>
+
+#include <mutex>
+#include <set>
+
+namespace srr
+{
+    /**
+     * \brief Features to restore, loaded one at a time when the restore needs them.
+     * The steps of a restore load their features in parallel: getFeature is thread safe.
+     */
+    class SrrFeatureSource
+    {
+        public:
+            virtual ~SrrFeatureSource() = default;
+
+            virtual std::set<dto::srr::FeatureName> getFeatures() const = 0;
+            // A feature may be moved out of the source: it can then be loaded only once.
+            virtual void getFeature(const dto::srr::FeatureName& featureName, dto::srr::Feature& feature) = 0;
+            // Arena of the loaded features, features swapped within the same arena are not copied.
+            virtual google::protobuf::Arena* getArena() const { return nullptr; }
+    };
+
+    /**
+     * \brief Features of a restore query, moved out of it when loaded: each one can be loaded once.
+     */
+    class SrrQueryFeatureSource : public SrrFeatureSource
+    {
+        public:
+            explicit SrrQueryFeatureSource(dto::srr::RestoreQuery& query);
+
+            std::set<dto::srr::FeatureName> getFeatures() const override;
+            void getFeature(const dto::srr::FeatureName& featureName, dto::srr::Feature& feature) override;
+            google::protobuf::Arena* getArena() const override { return m_query.GetArena(); }
+
+        private:
+            dto::srr::RestoreQuery& m_query;
+            // Even distinct features of the query map can not be moved out concurrently.
+            std::mutex m_queryMutex;
+    };
+
+    /**
+     * \brief Features of a bundle file, decoded on demand.
+     */
+    class SrrBundleFeatureSource : public SrrFeatureSource
+    {
+        public:
+            // No feature to take them all.
+            SrrBundleFeatureSource(const std::string& path, const std::set<dto::srr::FeatureName>& features);
+
+            const SrrBundle& getBundle() const { return m_bundle; }
+            std::set<dto::srr::FeatureName> getFeatures() const override;
+            void getFeature(const dto::srr::FeatureName& featureName, dto::srr::Feature& feature) override;
+
+        private:
+            SrrBundle m_bundle;
+            std::set<dto::srr::FeatureName> m_features;
+    };
+
+    /**
+     * \brief Features of a stored snapshot. The features of an incremental save
+     * query, if any, take precedence over the stored ones and are moved out of it.
+     */
+    class SrrSnapshotFeatureSource : public SrrFeatureSource
+    {
+        public:
+            SrrSnapshotFeatureSource(SrrSnapshotStore& store, const SrrSnapshotStore::manifest& snapshot, dto::srr::RestoreQuery* deltaQuery = nullptr);
+
+            std::set<dto::srr::FeatureName> getFeatures() const override;
+            void getFeature(const dto::srr::FeatureName& featureName, dto::srr::Feature& feature) override;
+            google::protobuf::Arena* getArena() const override { return m_deltaQuery ? m_deltaQuery->GetArena() : nullptr; }
+
+        private:
+            SrrSnapshotStore& m_store;
+            SrrSnapshotStore::manifest m_snapshot;
+            dto::srr::RestoreQuery* m_deltaQuery;
+            std::mutex m_deltaQueryMutex;
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_feature_source_test (bool verbose);
+
+#endif
@@ -0,0 +1,345 @@
+/*  =========================================================================
+    fty_srr_flight_recorder - Fty srr flight recorder
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_flight_recorder - Fty srr flight recorder
+@discuss
+@end
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    static const char* EVENT_TYPE_NAMES[] = {"start", "end", "agentRequest", "feature"};
+    static const char* OPERATION_NAMES[] = {"-", "save", "restore", "reset", "probe"};
+    static const char* STATUS_NAMES[] = {"-", "success", "partialSuccess", "failed", "timeout", "unreachable", "unavailable"};
+
+    /**
+     * Copy a name in a fixed size field, truncated if needed
+     * @param field
+     * @param size Size of the field, terminating null included
+     * @param name
+     */
+    static void copyName(char* field, size_t size, const std::string& name)
+    {
+        size_t length = std::min(name.size(), size - 1);
+        memcpy(field, name.data(), length);
+        field[length] = '\0';
+    }
+
+    /**
+     * Format an event on one line
+     * @param event
+     * @return The event as text, for example:
+     * 2020-01-01T10:00:00.000000Z agentRequest restore status=timeout agent=fty-config features=2 sent=1024 received=0 duration=60000000us
+     */
+    static std::string formatEvent(const SrrFlightRecorder::Event& event)
+    {
+        time_t seconds = static_cast<time_t>(event.timestamp / 1000000000);
+        struct tm time;
+        gmtime_r(&seconds, &time);
+        char timestamp[32];
+        size_t length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &time);
+        snprintf(timestamp + length, sizeof(timestamp) - length, ".%06ldZ", static_cast<long>(event.timestamp % 1000000000 / 1000));
+
+        std::ostringstream line;
+        line << timestamp << " " << EVENT_TYPE_NAMES[static_cast<size_t>(event.type)] << " " << OPERATION_NAMES[static_cast<size_t>(event.operation)]
+             << " status=" << STATUS_NAMES[static_cast<size_t>(event.status)];
+        if (event.agent[0] != '\0')
+        {
+            line << " agent=" << event.agent;
+        }
+        if (event.feature[0] != '\0')
+        {
+            line << " feature=" << event.feature;
+        }
+        line << " features=" << event.count << " sent=" << event.bytesSent << " received=" << event.bytesReceived << " duration=" << event.duration << "us";
+        return line.str();
+    }
+
+    /**
+     * Constructor
+     * @param capacity Number of events kept, rounded up to a power of 2
+     */
+    SrrFlightRecorder::SrrFlightRecorder(size_t capacity) :
+        m_next(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        m_slots = std::unique_ptr<slot[]>(new slot[size]);
+        for (size_t i = 0; i < size; i++)
+        {
+            m_slots[i].sequence.store(0, std::memory_order_relaxed);
+        }
+        m_mask = size - 1;
+    }
+
+    /**
+     * Record an event, overwrite the oldest one
+     * @param type
+     * @param operation
+     * @param status
+     * @param agent
+     * @param feature
+     * @param count Number of features
+     * @param bytesSent
+     * @param bytesReceived
+     * @param duration
+     */
+    void SrrFlightRecorder::record(EventType type, Operation operation, Status status, const std::string& agent, const std::string& feature,
+        uint32_t count, uint64_t bytesSent, uint64_t bytesReceived, std::chrono::steady_clock::duration duration)
+    {
+        uint64_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+        slot& target = m_slots[index & m_mask];
+        // Readers skip the slot until the event is written.
+        target.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Event& event = target.event;
+        event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        event.bytesSent = bytesSent;
+        event.bytesReceived = bytesReceived;
+        event.duration = static_cast<uint32_t>(std::min<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count(), UINT32_MAX));
+        event.count = count;
+        event.type = type;
+        event.operation = operation;
+        event.status = status;
+        copyName(event.agent, AGENT_SIZE, agent);
+        copyName(event.feature, FEATURE_SIZE, feature);
+        target.sequence.store(2 * index + 2, std::memory_order_release);
+    }
+
+    /**
+     * Get the events recorded, oldest first
+     * @return The events, without the ones being written
+     */
+    std::vector<SrrFlightRecorder::Event> SrrFlightRecorder::getEvents() const
+    {
+        std::vector<Event> events;
+        uint64_t end = m_next.load(std::memory_order_acquire);
+        uint64_t begin = end > m_mask + 1 ? end - (m_mask + 1) : 0;
+        events.reserve(end - begin);
+        for (uint64_t index = begin; index < end; index++)
+        {
+            const slot& source = m_slots[index & m_mask];
+            uint64_t sequence = source.sequence.load(std::memory_order_acquire);
+            if (sequence != 2 * index + 2)
+            {
+                // Not written yet, or already overwritten.
+                continue;
+            }
+            Event event = source.event;
+            // Keep the copy only if no writer took the slot meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (source.sequence.load(std::memory_order_relaxed) == sequence)
+            {
+                events.push_back(event);
+            }
+        }
+        return events;
+    }
+
+    /**
+     * Get the events recorded as text
+     * @return One event by line, oldest first
+     */
+    std::string SrrFlightRecorder::toString() const
+    {
+        std::string text;
+        for (const auto& event : getEvents())
+        {
+            text += formatEvent(event) + "\n";
+        }
+        return text;
+    }
+
+    /**
+     * Write the events recorded in a file, replaced at once for its readers.
+     * @param path
+     */
+    void SrrFlightRecorder::dump(const std::string& path) const
+    {
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::trunc);
+            file << toString();
+            if (!file)
+            {
+                throw SrrException("Flight recorder not written in " + tmpPath);
+            }
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            throw SrrException("Flight recorder not written in " + path);
+        }
+    }
+
+    /**
+     * Get the operation of an agent request
+     * @param action Subject of the request
+     * @return The operation
+     */
+    SrrFlightRecorder::Operation SrrFlightRecorder::getOperation(const std::string& action)
+    {
+        if (action == "save")
+        {
+            return Operation::SAVE;
+        }
+        if (action == "restore")
+        {
+            return Operation::RESTORE;
+        }
+        if (action == "reset")
+        {
+            return Operation::RESET;
+        }
+        return Operation::NONE;
+    }
+
+    /**
+     * Get the status of a failed agent request
+     * @param failure Reason of the failure, as counted in the metrics
+     * @return The status
+     */
+    SrrFlightRecorder::Status SrrFlightRecorder::getStatus(const std::string& failure)
+    {
+        if (failure == "timeout")
+        {
+            return Status::TIMEOUT;
+        }
+        if (failure == "unreachable")
+        {
+            return Status::UNREACHABLE;
+        }
+        if (failure == "unavailable")
+        {
+            return Status::UNAVAILABLE;
+        }
+        return Status::FAILED;
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_flight_recorder_test (bool verbose)
+{
+    printf (" * fty_srr_flight_recorder: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    using EventType = SrrFlightRecorder::EventType;
+    using Operation = SrrFlightRecorder::Operation;
+    using Status = SrrFlightRecorder::Status;
+
+    assert (SrrFlightRecorder::getOperation ("restore") == Operation::RESTORE);
+    assert (SrrFlightRecorder::getOperation ("list") == Operation::NONE);
+    assert (SrrFlightRecorder::getStatus ("timeout") == Status::TIMEOUT);
+    assert (SrrFlightRecorder::getStatus ("error") == Status::FAILED);
+
+    // The capacity is rounded up to a power of 2, the oldest events are overwritten.
+    SrrFlightRecorder recorder (3);
+    assert (recorder.getEvents ().empty ());
+    for (uint32_t i = 0; i < 6; i++) {
+        recorder.record (EventType::FEATURE, Operation::SAVE, Status::SUCCESS, "agent", "feature" + std::to_string (i), i, 0, 0);
+    }
+    std::vector<SrrFlightRecorder::Event> events = recorder.getEvents ();
+    assert (events.size () == 4);
+    for (uint32_t i = 0; i < 4; i++) {
+        assert (events[i].count == i + 2);
+        assert (std::string (events[i].feature) == "feature" + std::to_string (i + 2));
+    }
+
+    // Long names are truncated, one event by line.
+    SrrFlightRecorder small (1);
+    small.record (EventType::AGENT_REQUEST, Operation::RESTORE, Status::TIMEOUT, std::string (100, 'a'), "", 2, 1024, 0, std::chrono::seconds (60));
+    events = small.getEvents ();
+    assert (events.size () == 1);
+    assert (std::string (events[0].agent) == std::string (SrrFlightRecorder::AGENT_SIZE - 1, 'a'));
+    std::string text = small.toString ();
+    assert (text.find (" agentRequest restore status=timeout agent=" + std::string (SrrFlightRecorder::AGENT_SIZE - 1, 'a')
+        + " features=2 sent=1024 received=0 duration=60000000us\n") != std::string::npos);
+    assert (text.find ('\n') == text.size () - 1);
+
+    // Readers never see an event half written by a concurrent writer.
+    {
+        SrrFlightRecorder shared (16);
+        std::atomic<bool> stopped (false);
+        std::thread reader ([&] {
+            while (!stopped) {
+                for (const auto& event : shared.getEvents ()) {
+                    assert (event.count < 4);
+                    assert (std::string (event.feature) == "feature" + std::to_string (event.count));
+                }
+            }
+        });
+        std::vector<std::thread> writers;
+        for (uint32_t writer = 0; writer < 4; writer++) {
+            writers.emplace_back ([&shared, writer] {
+                for (int i = 0; i < 1000; i++) {
+                    shared.record (EventType::FEATURE, Operation::SAVE, Status::SUCCESS, "agent", "feature" + std::to_string (writer), writer, 0, 0);
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join ();
+        }
+        stopped = true;
+        reader.join ();
+        assert (shared.getEvents ().size () == 16);
+    }
+
+    // Dump
+    std::string path = std::string (SELFTEST_DIR_RW) + "/flight-recorder";
+    small.dump (path);
+    {
+        std::ifstream file (path);
+        std::string content ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char> ());
+        assert (content == text);
+    }
+    unlink (path.c_str ());
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,99 @@
+/*  =========================================================================
+    fty_srr_flight_recorder - Fty srr flight recorder
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_FLIGHT_RECORDER_H_INCLUDED
+#define FTY_SRR_FLIGHT_RECORDER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace srr
+{
+    /**
+     * \brief Last events of the saves, restores and resets, always recorded.
+     *
+     * The events are fixed size records in a ring buffer allocated once: the
+     * oldest ones are overwritten. Recording takes no lock and no allocation,
+     * so that it stays on in production; the events are read back as text,
+     * oldest first, through the flightRecorder request or in a file on SIGUSR1.
+     */
+    class SrrFlightRecorder
+    {
+        public:
+            enum class EventType : uint8_t { OPERATION_START, OPERATION_END, AGENT_REQUEST, FEATURE };
+            enum class Operation : uint8_t { NONE, SAVE, RESTORE, RESET, PROBE };
+            enum class Status : uint8_t { NONE, SUCCESS, PARTIAL_SUCCESS, FAILED, TIMEOUT, UNREACHABLE, UNAVAILABLE };
+
+            // Longer names are truncated.
+            static const size_t AGENT_SIZE = 32;
+            static const size_t FEATURE_SIZE = 48;
+
+            struct Event {
+                // Wall clock, ns since the epoch
+                int64_t timestamp;
+                uint64_t bytesSent;
+                uint64_t bytesReceived;
+                // Operations and agent requests only, in µs
+                uint32_t duration;
+                // Number of features
+                uint32_t count;
+                EventType type;
+                Operation operation;
+                Status status;
+                char agent[AGENT_SIZE];
+                char feature[FEATURE_SIZE];
+            };
+
+            explicit SrrFlightRecorder(size_t capacity);
+            ~SrrFlightRecorder() = default;
+
+            void record(EventType type, Operation operation, Status status, const std::string& agent, const std::string& feature,
+                uint32_t count, uint64_t bytesSent, uint64_t bytesReceived, std::chrono::steady_clock::duration duration = {});
+
+            std::vector<Event> getEvents() const;
+            std::string toString() const;
+            void dump(const std::string& path) const;
+
+            static Operation getOperation(const std::string& action);
+            static Status getStatus(const std::string& failure);
+
+        private:
+            struct slot {
+                // 2 * index + 1 while the event of this index is written, 2 * index + 2 once written.
+                std::atomic<uint64_t> sequence;
+                Event event;
+            };
+            std::unique_ptr<slot[]> m_slots;
+            // Capacity - 1, the capacity is a power of 2.
+            uint64_t m_mask;
+            // Index of the next event.
+            std::atomic<uint64_t> m_next;
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_flight_recorder_test (bool verbose);
+
+#endif
@@ -0,0 +1,490 @@
+/*  =========================================================================
+    fty_srr_inprocess_bus - Fty srr in-process message bus
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_inprocess_bus - Fty srr in-process message bus
+@discuss
+@end
+ */
+
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    /**
+     * Clients of an endpoint, the broker lock protects the deliveries
+     * against the destruction of their recipient.
+     */
+    struct SrrInProcessBus::broker {
+        std::mutex mutex;
+        // Client name -> Client
+        std::map<std::string, SrrInProcessBus*> clients;
+        // Queue -> Receiving client and its listener
+        std::map<std::string, std::pair<SrrInProcessBus*, messagebus::MessageListener>> queues;
+        // Topic -> Subscribers
+        std::map<std::string, std::map<SrrInProcessBus*, messagebus::MessageListener>> topics;
+    };
+
+    /**
+     * Get the broker of an endpoint, create it for its first client.
+     * @param endpoint
+     * @return The broker
+     */
+    std::shared_ptr<SrrInProcessBus::broker> SrrInProcessBus::getBroker(const std::string& endpoint)
+    {
+        static std::mutex brokersMutex;
+        static std::map<std::string, std::weak_ptr<broker>> brokers;
+        std::lock_guard<std::mutex> lock(brokersMutex);
+        std::shared_ptr<broker> endpointBroker = brokers[endpoint].lock();
+        if (!endpointBroker)
+        {
+            endpointBroker = std::make_shared<broker>();
+            brokers[endpoint] = endpointBroker;
+        }
+        return endpointBroker;
+    }
+
+    /**
+     * Constructor
+     * @param endpoint
+     * @param clientName Unique on the endpoint, the replies are sent to it
+     * @param replyListenerExpiration Listener of a reply dropped after that, the reply never came
+     */
+    SrrInProcessBus::SrrInProcessBus(const std::string& endpoint, const std::string& clientName, std::chrono::milliseconds replyListenerExpiration) :
+        m_endpoint(endpoint), m_clientName(clientName), m_broker(getBroker(endpoint)), m_replyListenerExpiration(replyListenerExpiration)
+    {
+    }
+
+    /**
+     * Destructor: leave the broker, then wait for the running delivery.
+     */
+    SrrInProcessBus::~SrrInProcessBus()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_broker->mutex);
+            auto client = m_broker->clients.find(m_clientName);
+            if (client != m_broker->clients.end() && client->second == this)
+            {
+                m_broker->clients.erase(client);
+            }
+            for (auto queue = m_broker->queues.begin(); queue != m_broker->queues.end();)
+            {
+                queue = queue->second.first == this ? m_broker->queues.erase(queue) : std::next(queue);
+            }
+            for (auto& topic : m_broker->topics)
+            {
+                topic.second.erase(this);
+            }
+        }
+        if (m_inbox)
+        {
+            m_inbox->stop();
+        }
+    }
+
+    bool SrrInProcessBus::isInProcessEndpoint(const std::string& endpoint)
+    {
+        return endpoint.compare(0, std::string(INPROCESS_ENDPOINT_PREFIX).size(), INPROCESS_ENDPOINT_PREFIX) == 0;
+    }
+
+    void SrrInProcessBus::connect()
+    {
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        if (m_inbox)
+        {
+            return;
+        }
+        if (m_broker->clients.count(m_clientName) > 0)
+        {
+            throw messagebus::MessageBusException("Client " + m_clientName + " already connected to " + m_endpoint);
+        }
+        m_broker->clients[m_clientName] = this;
+        m_inbox = std::unique_ptr<SrrThreadPool>(new SrrThreadPool(1));
+    }
+
+    void SrrInProcessBus::checkConnected() const
+    {
+        if (!m_inbox)
+        {
+            throw messagebus::MessageBusException("Client " + m_clientName + " not connected");
+        }
+    }
+
+    void SrrInProcessBus::publish(const std::string& topic, const messagebus::Message& message)
+    {
+        checkConnected();
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        auto subscribers = m_broker->topics.find(topic);
+        if (subscribers != m_broker->topics.end())
+        {
+            for (const auto& subscriber : subscribers->second)
+            {
+                subscriber.first->deliver(subscriber.second, message);
+            }
+        }
+    }
+
+    void SrrInProcessBus::subscribe(const std::string& topic, messagebus::MessageListener messageListener)
+    {
+        checkConnected();
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        m_broker->topics[topic][this] = std::move(messageListener);
+    }
+
+    void SrrInProcessBus::unsubscribe(const std::string& topic, messagebus::MessageListener /*messageListener*/)
+    {
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        m_broker->topics[topic].erase(this);
+    }
+
+    void SrrInProcessBus::sendRequest(const std::string& requestQueue, const messagebus::Message& message)
+    {
+        checkConnected();
+        messagebus::Message req(message);
+        // Replies come back in the mailbox of the sender, unless the request tells another queue.
+        req.metaData().emplace(messagebus::Message::REPLY_TO, m_clientName);
+        sendToQueue(requestQueue, std::move(req));
+    }
+
+    /**
+     * Send a request, its reply is given to a listener
+     * @param requestQueue
+     * @param message With a correlation id
+     * @param messageListener
+     */
+    void SrrInProcessBus::sendRequest(const std::string& requestQueue, const messagebus::Message& message, messagebus::MessageListener messageListener)
+    {
+        checkConnected();
+        const std::string& correlationId = message.metaData().at(messagebus::Message::CORRELATION_ID);
+        {
+            std::lock_guard<std::mutex> lock(m_repliesMutex);
+            removeExpiredReplyListeners();
+            m_replyListeners[correlationId] = {std::move(messageListener), std::chrono::steady_clock::now()};
+        }
+        try
+        {
+            sendRequest(requestQueue, message);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_repliesMutex);
+            m_replyListeners.erase(correlationId);
+            throw;
+        }
+    }
+
+    /**
+     * Send a reply to the mailbox of a client
+     * @param replyQueue Client name, or a queue received by the client
+     * @param message
+     */
+    void SrrInProcessBus::sendReply(const std::string& replyQueue, const messagebus::Message& message)
+    {
+        checkConnected();
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        auto client = m_broker->clients.find(replyQueue);
+        if (client != m_broker->clients.end())
+        {
+            client->second->deliverReply(replyQueue, message);
+            return;
+        }
+        auto receiver = m_broker->queues.find(replyQueue);
+        if (receiver != m_broker->queues.end())
+        {
+            receiver->second.first->deliverReply(replyQueue, message);
+            return;
+        }
+        // As with a broker, nobody waits for it any more.
+        log_warning("Reply to %s dropped: client gone", replyQueue.c_str());
+    }
+
+    void SrrInProcessBus::receive(const std::string& queue, messagebus::MessageListener messageListener)
+    {
+        checkConnected();
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        auto receiver = m_broker->queues.find(queue);
+        if (receiver != m_broker->queues.end() && receiver->second.first != this)
+        {
+            throw messagebus::MessageBusException("Queue " + queue + " already received by another client");
+        }
+        m_broker->queues[queue] = std::make_pair(this, std::move(messageListener));
+    }
+
+    /**
+     * Send a request and wait for its reply
+     * @param requestQueue
+     * @param message With a correlation id
+     * @param receiveTimeOut In seconds
+     * @return The reply
+     */
+    messagebus::Message SrrInProcessBus::request(const std::string& requestQueue, const messagebus::Message& message, int receiveTimeOut)
+    {
+        checkConnected();
+        std::string correlationId = message.metaData().at(messagebus::Message::CORRELATION_ID);
+        {
+            std::lock_guard<std::mutex> lock(m_repliesMutex);
+            m_pendingReplies[correlationId] = nullptr;
+        }
+        std::unique_lock<std::mutex> lock(m_repliesMutex, std::defer_lock);
+        try
+        {
+            sendRequest(requestQueue, message);
+            lock.lock();
+            bool replied = m_repliesCv.wait_for(lock, std::chrono::seconds(receiveTimeOut), [this, &correlationId]()
+            {
+                return m_pendingReplies.at(correlationId) != nullptr;
+            });
+            if (!replied)
+            {
+                throw messagebus::MessageBusException("Request timed out");
+            }
+        }
+        catch (...)
+        {
+            if (!lock.owns_lock())
+            {
+                lock.lock();
+            }
+            m_pendingReplies.erase(correlationId);
+            throw;
+        }
+        messagebus::Message reply(std::move(*(m_pendingReplies.at(correlationId))));
+        m_pendingReplies.erase(correlationId);
+        return reply;
+    }
+
+    /**
+     * Queue a message for a listener of this client
+     * @param listener
+     * @param message
+     */
+    void SrrInProcessBus::deliver(const messagebus::MessageListener& listener, messagebus::Message message)
+    {
+        if (!m_inbox)
+        {
+            return;
+        }
+        // The message is moved up to the listener.
+        auto sharedMessage = std::make_shared<messagebus::Message>(std::move(message));
+        m_inbox->push([listener, sharedMessage]()
+        {
+            listener(std::move(*sharedMessage));
+        });
+    }
+
+    /**
+     * Give a reply to the request waiting for it, to its listener, or to the listener of its queue.
+     * Broker lock held.
+     * @param replyQueue
+     * @param message
+     */
+    void SrrInProcessBus::deliverReply(const std::string& replyQueue, messagebus::Message message)
+    {
+        auto correlationId = message.metaData().find(messagebus::Message::CORRELATION_ID);
+        if (correlationId == message.metaData().end())
+        {
+            log_warning("Reply to %s dropped: no correlation id", m_clientName.c_str());
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_repliesMutex);
+        auto pendingReply = m_pendingReplies.find(correlationId->second);
+        if (pendingReply != m_pendingReplies.end())
+        {
+            pendingReply->second = std::unique_ptr<messagebus::Message>(new messagebus::Message(std::move(message)));
+            m_repliesCv.notify_all();
+            return;
+        }
+        removeExpiredReplyListeners();
+        auto replyListener = m_replyListeners.find(correlationId->second);
+        if (replyListener != m_replyListeners.end())
+        {
+            deliver(replyListener->second.listener, std::move(message));
+            m_replyListeners.erase(replyListener);
+            return;
+        }
+        auto receiver = m_broker->queues.find(replyQueue);
+        if (receiver != m_broker->queues.end() && receiver->second.first == this)
+        {
+            deliver(receiver->second.second, std::move(message));
+            return;
+        }
+        log_debug("Reply to %s dropped: nobody waits for it", m_clientName.c_str());
+    }
+
+    /**
+     * Queue a request for the client receiving a queue
+     * @param requestQueue
+     * @param message
+     */
+    void SrrInProcessBus::sendToQueue(const std::string& requestQueue, messagebus::Message message)
+    {
+        std::lock_guard<std::mutex> lock(m_broker->mutex);
+        auto receiver = m_broker->queues.find(requestQueue);
+        if (receiver == m_broker->queues.end())
+        {
+            throw messagebus::MessageBusException("No client receives queue " + requestQueue);
+        }
+        receiver->second.first->deliver(receiver->second.second, std::move(message));
+    }
+
+    /**
+     * Drop the listeners of the replies which did not come in time, replies lock held.
+     */
+    void SrrInProcessBus::removeExpiredReplyListeners()
+    {
+        auto expiration = std::chrono::steady_clock::now() - m_replyListenerExpiration;
+        for (auto it = m_replyListeners.begin(); it != m_replyListeners.end();)
+        {
+            it = it->second.registeredAt < expiration ? m_replyListeners.erase(it) : std::next(it);
+        }
+    }
+
+    /**
+     * Create a message bus client
+     * @param endpoint In-process endpoint, malamute endpoint otherwise
+     * @param clientName
+     * @return The client, not connected
+     */
+    messagebus::MessageBus* createMessageBus(const std::string& endpoint, const std::string& clientName)
+    {
+        if (SrrInProcessBus::isInProcessEndpoint(endpoint))
+        {
+            return new SrrInProcessBus(endpoint, clientName);
+        }
+        return messagebus::MlmMessageBus(endpoint, clientName);
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_inprocess_bus_test (bool verbose)
+{
+    printf (" * fty_srr_inprocess_bus: ");
+
+    //  @selftest
+    using namespace srr;
+
+    std::string endpoint = std::string (INPROCESS_ENDPOINT_PREFIX) + "fty-srr-inprocess-bus-test";
+    assert (SrrInProcessBus::isInProcessEndpoint (endpoint));
+    assert (!SrrInProcessBus::isInProcessEndpoint (DEFAULT_ENDPOINT));
+
+    // Server answering the "echo" requests, the others are kept to be answered late
+    SrrInProcessBus server (endpoint, "server");
+    server.connect ();
+    std::mutex heldMutex;
+    std::vector<messagebus::Message> held;
+    auto reply = [&server] (const messagebus::Message& request) {
+        messagebus::Message response;
+        response.userData () = request.userData ();
+        response.metaData ()[messagebus::Message::CORRELATION_ID] = request.metaData ().at (messagebus::Message::CORRELATION_ID);
+        server.sendReply (request.metaData ().at (messagebus::Message::REPLY_TO), response);
+    };
+    server.receive ("queue", [&] (messagebus::Message request) {
+        if (request.metaData ().at (messagebus::Message::SUBJECT) == "echo") {
+            reply (request);
+            return;
+        }
+        std::lock_guard<std::mutex> lock (heldMutex);
+        held.push_back (std::move (request));
+    });
+    auto takeHeld = [&] () {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock (heldMutex);
+                if (!held.empty ()) {
+                    messagebus::Message request = held.front ();
+                    held.erase (held.begin ());
+                    return request;
+                }
+            }
+            std::this_thread::sleep_for (std::chrono::milliseconds (10));
+        }
+    };
+    auto createRequest = [] (const std::string& subject, const std::string& correlationId) {
+        messagebus::Message request;
+        request.userData ().push_back (correlationId);
+        request.metaData ()[messagebus::Message::SUBJECT] = subject;
+        request.metaData ()[messagebus::Message::CORRELATION_ID] = correlationId;
+        return request;
+    };
+
+    SrrInProcessBus client (endpoint, "client", std::chrono::milliseconds (100));
+    client.connect ();
+    // Client names are unique on an endpoint
+    try {
+        SrrInProcessBus (endpoint, "client").connect ();
+        assert (false);
+    }
+    catch (messagebus::MessageBusException&) {
+    }
+    try {
+        client.request ("no-queue", createRequest ("echo", "0"), 1);
+        assert (false);
+    }
+    catch (messagebus::MessageBusException&) {
+    }
+
+    // Request and reply
+    messagebus::Message response = client.request ("queue", createRequest ("echo", "1"), 1);
+    assert (response.metaData ().at (messagebus::Message::CORRELATION_ID) == "1");
+    assert (response.userData ().front () == "1");
+
+    // Time out, then the late reply is dropped
+    try {
+        client.request ("queue", createRequest ("hold", "2"), 1);
+        assert (false);
+    }
+    catch (messagebus::MessageBusException&) {
+    }
+    reply (takeHeld ());
+    response = client.request ("queue", createRequest ("echo", "3"), 1);
+    assert (response.metaData ().at (messagebus::Message::CORRELATION_ID) == "3");
+
+    // Reply given to its listener, the listener of a reply not come in time is dropped
+    std::mutex repliesMutex;
+    std::vector<std::string> replies;
+    std::promise<void> lastReply;
+    auto listener = [&] (messagebus::Message message) {
+        std::lock_guard<std::mutex> lock (repliesMutex);
+        replies.push_back (message.metaData ().at (messagebus::Message::CORRELATION_ID));
+        lastReply.set_value ();
+    };
+    client.sendRequest ("queue", createRequest ("hold", "4"), listener);
+    messagebus::Message expired = takeHeld ();
+    std::this_thread::sleep_for (std::chrono::milliseconds (200));
+    client.sendRequest ("queue", createRequest ("hold", "5"), listener);
+    reply (expired);
+    reply (takeHeld ());
+    // Replies are delivered in order: the dropped one would come first
+    lastReply.get_future ().wait ();
+    assert ((replies == std::vector<std::string> {"5"}));
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,100 @@
+/*  =========================================================================
+    fty_srr_inprocess_bus - Fty srr in-process message bus
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_INPROCESS_BUS_H_INCLUDED
+#define FTY_SRR_INPROCESS_BUS_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include "fty_srr_thread_pool.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace srr
+{
+    /**
+     * \brief Message bus between the clients of the same process, without broker nor serialization.
+     *
+     * The clients of an endpoint share an in-memory broker: queues, topics and client
+     * mailboxes have the malamute semantics. Each client handles its incoming messages
+     * in order on its own thread, and request waits for the reply with the same
+     * correlation id. A message is copied once when sent, then moved up to its listener.
+     */
+    class SrrInProcessBus : public messagebus::MessageBus
+    {
+        public:
+            SrrInProcessBus(const std::string& endpoint, const std::string& clientName, std::chrono::milliseconds replyListenerExpiration = std::chrono::minutes(10));
+            ~SrrInProcessBus();
+            SrrInProcessBus(const SrrInProcessBus&) = delete;
+            SrrInProcessBus& operator=(const SrrInProcessBus&) = delete;
+
+            static bool isInProcessEndpoint(const std::string& endpoint);
+
+            void connect() override;
+            void publish(const std::string& topic, const messagebus::Message& message) override;
+            void subscribe(const std::string& topic, messagebus::MessageListener messageListener) override;
+            void unsubscribe(const std::string& topic, messagebus::MessageListener messageListener = nullptr) override;
+            void sendRequest(const std::string& requestQueue, const messagebus::Message& message) override;
+            void sendRequest(const std::string& requestQueue, const messagebus::Message& message, messagebus::MessageListener messageListener) override;
+            void sendReply(const std::string& replyQueue, const messagebus::Message& message) override;
+            void receive(const std::string& queue, messagebus::MessageListener messageListener) override;
+            messagebus::Message request(const std::string& requestQueue, const messagebus::Message& message, int receiveTimeOut) override;
+
+        private:
+            struct broker;
+
+            std::string m_endpoint;
+            std::string m_clientName;
+            std::shared_ptr<broker> m_broker;
+            // Delivery of the incoming messages, one at a time.
+            std::unique_ptr<SrrThreadPool> m_inbox;
+            // Correlation id -> Reply, empty until it comes
+            std::map<std::string, std::unique_ptr<messagebus::Message>> m_pendingReplies;
+            // Correlation id -> Listener of the reply, dropped when no reply comes in time
+            struct replyListener {
+                messagebus::MessageListener listener;
+                std::chrono::steady_clock::time_point registeredAt;
+            };
+            std::map<std::string, replyListener> m_replyListeners;
+            std::chrono::milliseconds m_replyListenerExpiration;
+            std::mutex m_repliesMutex;
+            std::condition_variable m_repliesCv;
+
+            static std::shared_ptr<broker> getBroker(const std::string& endpoint);
+            void checkConnected() const;
+            void deliver(const messagebus::MessageListener& listener, messagebus::Message message);
+            void deliverReply(const std::string& replyQueue, messagebus::Message message);
+            void sendToQueue(const std::string& requestQueue, messagebus::Message message);
+            void removeExpiredReplyListeners();
+    };
+
+    // In-process bus or malamute client, according to the endpoint.
+    messagebus::MessageBus* createMessageBus(const std::string& endpoint, const std::string& clientName);
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_inprocess_bus_test (bool verbose);
+
+#endif
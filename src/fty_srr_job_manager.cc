@@ -0,0 +1,289 @@
+/*  =========================================================================
+    fty_srr_job_manager - Fty srr job manager
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_job_manager - Fty srr job manager
+@discuss
+@end
+ */
+
+#include <fty_srr_dto.h>
+
+#include <cassert>
+#include <thread>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+namespace srr
+{
+    // Finished jobs whose result is not fetched are dropped after that.
+    static const std::chrono::minutes JOB_RESULT_EXPIRATION(10);
+
+    /**
+     * Get feature progress name
+     * @param progress
+     * @return The progress name
+     */
+    static std::string progressToString(SrrWorker::FeatureProgress progress)
+    {
+        switch (progress)
+        {
+            case SrrWorker::FeatureProgress::PENDING:
+                return FEATURE_PENDING;
+            case SrrWorker::FeatureProgress::IN_PROGRESS:
+                return FEATURE_IN_PROGRESS;
+            case SrrWorker::FeatureProgress::DONE:
+                return FEATURE_DONE;
+            case SrrWorker::FeatureProgress::FAILED:
+                return FEATURE_FAILED;
+        }
+        return FEATURE_FAILED;
+    }
+
+    /**
+     * Constructor
+     * @param srrWorker
+     * @param maxRunningJobs Number of jobs running at once, at least 1
+     */
+    SrrJobManager::SrrJobManager(SrrWorker& srrWorker, size_t maxRunningJobs) :
+        m_srrWorker(srrWorker), m_maxRunningJobs(std::max(maxRunningJobs, size_t(1))), m_runningJobs(0), m_jobPool(m_maxRunningJobs)
+    {
+    }
+
+    /**
+     * Destructor: wait all running jobs.
+     */
+    SrrJobManager::~SrrJobManager()
+    {
+        m_jobPool.stop();
+    }
+
+    /**
+     * Start a save or restore job in background
+     * @param query
+     * @return The job id
+     */
+    std::string SrrJobManager::startJob(const Query& query)
+    {
+        if (query.parameters_case() != Query::ParametersCase::kSave && query.parameters_case() != Query::ParametersCase::kRestore)
+        {
+            throw SrrException("Only save and restore queries can be run as job");
+        }
+        std::string jobId = messagebus::generateUuid();
+        {
+            std::lock_guard<std::mutex> lock(m_jobsMutex);
+            removeExpiredJobs();
+            // Every running job has its thread: none waits in the pool queue.
+            if (m_runningJobs >= m_maxRunningJobs)
+            {
+                throw SrrException("Too many jobs running (" + std::to_string(m_runningJobs) + "), try again later");
+            }
+            m_runningJobs++;
+            m_jobs[jobId].state = JOB_IN_PROGRESS;
+        }
+        SrrTracer::SpanContext traceContext = SrrTracer::getCurrentContext();
+        // The pool task is copyable: the query is moved in the job when it runs.
+        auto jobQuery = std::make_shared<Query>(query);
+        m_jobPool.push([this, jobId, jobQuery, traceContext]()
+        {
+            runJob(jobId, std::move(*jobQuery), traceContext);
+        });
+        log_debug("Job %s started", jobId.c_str());
+        return jobId;
+    }
+
+    /**
+     * Get job status: state, result (empty until finished) then feature and progress pairs.
+     * A finished job is forgotten once its status is given.
+     * @param jobId
+     * @return The job status
+     */
+    dto::UserData SrrJobManager::getJobStatus(const std::string& jobId)
+    {
+        dto::UserData status;
+        std::lock_guard<std::mutex> lock(m_jobsMutex);
+        removeExpiredJobs();
+        auto it = m_jobs.find(jobId);
+        if (it == m_jobs.end())
+        {
+            status.push_back(JOB_UNKNOWN);
+            return status;
+        }
+        status.push_back(it->second.state);
+        status << it->second.result;
+        // A running job is polled again: its progress stays.
+        bool finished = it->second.state == JOB_FINISHED;
+        for (auto& feature : it->second.featuresProgress)
+        {
+            status.push_back(feature.first);
+            status.push_back(finished ? std::move(feature.second) : feature.second);
+        }
+        if (finished)
+        {
+            m_jobs.erase(it);
+        }
+        return status;
+    }
+
+    /**
+     * Run a job
+     * @param jobId
+     * @param query
+     * @param traceContext
+     */
+    void SrrJobManager::runJob(const std::string& jobId, Query query, const SrrTracer::SpanContext& traceContext)
+    {
+        SrrTracer::Span span(m_srrWorker.getTracer(), "job", traceContext);
+        span.setAttribute("jobId", jobId);
+        SrrWorker::ProgressCallback progress = std::bind(&SrrJobManager::setFeatureProgress, this, jobId, std::placeholders::_1, std::placeholders::_2);
+        Response response;
+        try
+        {
+            if (query.parameters_case() == Query::ParametersCase::kSave)
+            {
+                SaveResponse save = m_srrWorker.saveIpm2Configuration(query.save(), progress);
+                response.mutable_save()->Swap(&save);
+            }
+            else
+            {
+                RestoreResponse restore = m_srrWorker.restoreIpm2Configuration(std::move(*(query.mutable_restore())), progress);
+                response.mutable_restore()->Swap(&restore);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            log_error("Job %s failed: %s", jobId.c_str(), e.what());
+        }
+
+        std::lock_guard<std::mutex> lock(m_jobsMutex);
+        m_runningJobs--;
+        auto it = m_jobs.find(jobId);
+        if (it != m_jobs.end())
+        {
+            it->second.result.Swap(&response);
+            it->second.state = JOB_FINISHED;
+            it->second.finishedAt = std::chrono::steady_clock::now();
+        }
+        log_debug("Job %s finished", jobId.c_str());
+    }
+
+    /**
+     * Update the progress of a job feature
+     * @param jobId
+     * @param featureName
+     * @param progress
+     */
+    void SrrJobManager::setFeatureProgress(const std::string& jobId, const std::string& featureName, SrrWorker::FeatureProgress progress)
+    {
+        std::lock_guard<std::mutex> lock(m_jobsMutex);
+        auto it = m_jobs.find(jobId);
+        if (it != m_jobs.end())
+        {
+            it->second.featuresProgress[featureName] = progressToString(progress);
+        }
+    }
+
+    /**
+     * Drop the finished jobs whose result was not fetched in time, lock held.
+     */
+    void SrrJobManager::removeExpiredJobs()
+    {
+        auto expiration = std::chrono::steady_clock::now() - JOB_RESULT_EXPIRATION;
+        for (auto it = m_jobs.begin(); it != m_jobs.end();)
+        {
+            it = (it->second.state == JOB_FINISHED && it->second.finishedAt < expiration) ? m_jobs.erase(it) : std::next(it);
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_job_manager_test (bool verbose)
+{
+    printf (" * fty_srr_job_manager: ");
+
+    //  @selftest
+    using namespace srr;
+
+    // Agent which never answers: the job runs until the probe time out
+    std::string endpoint = std::string (INPROCESS_ENDPOINT_PREFIX) + "fty-srr-job-manager-test";
+    std::unique_ptr<messagebus::MessageBus> agentBus (createMessageBus (endpoint, CONFIG_AGENT_NAME));
+    agentBus->connect ();
+    agentBus->receive (CONFIG_MSG_QUEUE_NAME, [] (messagebus::Message) {});
+    std::map<std::string, std::string> parameters;
+    parameters[ENDPOINT_KEY] = endpoint;
+    parameters[AGENT_NAME_KEY] = AGENT_NAME;
+    parameters[SRR_VERSION_KEY] = ACTIVE_VERSION;
+    parameters[REQUEST_TIMEOUT_KEY] = "1000";
+    parameters[PROBE_TIMEOUT_KEY] = "1000";
+    parameters[RETRY_COUNT_KEY] = "0";
+    parameters[HEALTH_CHECK_INTERVAL_KEY] = "0";
+    parameters[FACTORY_BUNDLE_PATH_KEY] = "";
+    parameters[RESTORE_JOURNAL_PATH_KEY] = "";
+    std::unique_ptr<messagebus::MessageBus> msgBus (createMessageBus (endpoint, AGENT_NAME));
+    msgBus->connect ();
+    SrrWorker worker (*msgBus, parameters);
+    SrrJobManager jobManager (worker, 1);
+
+    try {
+        jobManager.startJob (createResetQuery ({MONITORING_FEATURE_NAME}));
+        assert (false);
+    }
+    catch (SrrException&) {
+    }
+
+    std::string jobId = jobManager.startJob (createSaveQuery ({MONITORING_FEATURE_NAME}, "Srr-selftest-1"));
+    // Only one job at once
+    try {
+        jobManager.startJob (createSaveQuery ({MONITORING_FEATURE_NAME}, "Srr-selftest-1"));
+        assert (false);
+    }
+    catch (SrrException&) {
+    }
+
+    // State, result, then feature and progress pairs
+    dto::UserData status;
+    do {
+        status = jobManager.getJobStatus (jobId);
+        assert (status.front () == JOB_IN_PROGRESS);
+    } while (status.size () < 4 || status.back () != FEATURE_IN_PROGRESS);
+    // Polled again while it runs: same progress
+    dto::UserData statusAgain = jobManager.getJobStatus (jobId);
+    assert (statusAgain == status);
+
+    do {
+        std::this_thread::sleep_for (std::chrono::milliseconds (50));
+        status = jobManager.getJobStatus (jobId);
+    } while (status.front () == JOB_IN_PROGRESS);
+    assert (status.front () == JOB_FINISHED);
+    assert (status.size () == 4);
+    assert (status.back () == FEATURE_FAILED);
+    // Forgotten once fetched
+    assert (jobManager.getJobStatus (jobId).front () == JOB_UNKNOWN);
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,70 @@
+/*  =========================================================================
+    fty_srr_job_manager - Fty srr job manager
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_JOB_MANAGER_H_INCLUDED
+#define FTY_SRR_JOB_MANAGER_H_INCLUDED
+
+#include "fty_srr_thread_pool.h"
+#include "fty_srr_worker.h"
+
+namespace srr
+{
+    /**
+     * \brief Run save and restore queries in background, and keep track of their progress.
+     * A bounded number of jobs run at once, the others are refused. The result of a
+     * finished job is kept until it is fetched, or for a while.
+     */
+    class SrrJobManager
+    {
+        public:
+            SrrJobManager(SrrWorker& srrWorker, size_t maxRunningJobs);
+            ~SrrJobManager();
+
+            std::string startJob(const dto::srr::Query& query);
+            dto::UserData getJobStatus(const std::string& jobId);
+
+        private:
+            struct job {
+                std::string state;
+                std::map<std::string, std::string> featuresProgress;
+                dto::srr::Response result;
+                std::chrono::steady_clock::time_point finishedAt;
+            };
+
+            SrrWorker& m_srrWorker;
+            size_t m_maxRunningJobs;
+            std::mutex m_jobsMutex;
+            std::map<std::string, job> m_jobs;
+            size_t m_runningJobs;
+            // One thread by running job.
+            SrrThreadPool m_jobPool;
+
+            // The job owns its query, the restore consumes it. Its span is a child of the request which started it.
+            void runJob(const std::string& jobId, dto::srr::Query query, const SrrTracer::SpanContext& traceContext);
+            void setFeatureProgress(const std::string& jobId, const std::string& featureName, SrrWorker::FeatureProgress progress);
+            void removeExpiredJobs();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_job_manager_test (bool verbose);
+
+#endif
@@ -26,12 +26,17 @@
 @end
  */
 
+#include <google/protobuf/arena.h>
+
 #include "srr_pb.h"
 #include "fty_srr_classes.h"
 
 using namespace std::placeholders;
 using namespace dto::srr;
 
+// Semaphores of the static probes
+SRR_PROBE_LIST(SRR_PROBE_DEFINE)
+
 namespace srr
 {
     /**
@@ -45,6 +50,21 @@ namespace srr
         init();
     }
     
+    /**
+     * Destructor: wait the running requests before to release anything.
+     */
+    SrrManager::~SrrManager()
+    {
+        if (m_fastLane)
+        {
+            m_fastLane->stop();
+        }
+        if (m_slowLane)
+        {
+            m_slowLane->stop();
+        }
+    }
+    
     /**
      * Class initialization 
      */
@@ -52,29 +72,54 @@ namespace srr
     {
         try
         {
+            // Read-only requests get their own thread, so they are never queued behind a save or a restore.
+            m_fastLane = std::unique_ptr<srr::SrrThreadPool>(new srr::SrrThreadPool(1));
+            m_slowLane = std::unique_ptr<srr::SrrThreadPool>(new srr::SrrThreadPool(std::stoul(m_parameters.at(WORKERS_KEY))));
+            
+            // Payload compression with the clients.
+            m_compression = std::unique_ptr<srr::SrrCompression>(new srr::SrrCompression(
+                m_parameters.at(COMPRESSION_KEY),
+                std::stoi(m_parameters.at(COMPRESSION_LEVEL_KEY)),
+                std::stoul(m_parameters.at(COMPRESSION_MIN_SIZE_KEY))));
+            // Chunked transfer with the clients.
+            m_chunkTransfer = std::unique_ptr<srr::SrrChunkTransfer>(new srr::SrrChunkTransfer(
+                std::stoul(m_parameters.at(CHUNK_SIZE_KEY)),
+                std::stoul(m_parameters.at(MAX_TRANSFER_SIZE_KEY))));
+            
             // Message bus init
-            m_msgBus = std::unique_ptr<messagebus::MessageBus>(messagebus::MlmMessageBus(m_parameters.at(ENDPOINT_KEY), m_parameters.at(AGENT_NAME_KEY)));
+            m_msgBus = std::unique_ptr<messagebus::MessageBus>(createMessageBus(m_parameters.at(ENDPOINT_KEY), m_parameters.at(AGENT_NAME_KEY)));
             m_msgBus->connect();
             
             // Worker creation.
             m_srrworker = std::unique_ptr<srr::SrrWorker>(new srr::SrrWorker(*m_msgBus, m_parameters));
+            // Background jobs.
+            m_jobManager = std::unique_ptr<srr::SrrJobManager>(new srr::SrrJobManager(*m_srrworker, std::stoul(m_parameters.at(MAX_JOBS_KEY))));
+            // Feature list reply, it only depends on the features and the version known at init.
+            m_featureListReply.userData() = *(m_srrworker->getFeatureListManagedData());
+            m_featureListCompressedReply = m_featureListReply;
+            m_compression->encode(m_featureListReply, "");
+            m_compression->encode(m_featureListCompressedReply, m_compression->getEncoding());
             
             // Bind all processor handler.
             m_processor.listFeatureHandler = std::bind(&SrrWorker::getFeatureListManaged, m_srrworker.get(), _1);
             //m_processor.listFeatureHandler = std::bind(&SrrManager::getListFeatureHandler, this, _1);
-            m_processor.saveHandler = std::bind(&SrrWorker::saveIpm2Configuration, m_srrworker.get(), _1);
-            m_processor.restoreHandler = std::bind(&SrrWorker::restoreIpm2Configuration, m_srrworker.get(), _1);
+            m_processor.saveHandler = std::bind(&SrrWorker::saveIpm2Configuration, m_srrworker.get(), _1, nullptr);
+            m_processor.restoreHandler = [this](const RestoreQuery& query) { return m_srrworker->restoreIpm2Configuration(query); };
             m_processor.resetHandler = std::bind(&SrrWorker::resetIpm2Configuration, m_srrworker.get(), _1);
             
             // Listen all incoming request
             //messagebus::Message fct = [&](messagebus::Message msg){this->handleRequest(msg);};
-            auto fct = std::bind(&SrrManager::handleRequest, this, _1);
+            auto fct = std::bind(&SrrManager::dispatchRequest, this, _1);
             m_msgBus->receive(m_parameters.at(SRR_QUEUE_NAME_KEY), fct);
         }        
         catch (messagebus::MessageBusException& ex)
         {
             log_error("Message bus error: %s", ex.what());
             throw SrrException("Failed to open connection with message bus!");
+        }
+        catch (SrrException&)
+        {
+            throw;
         } catch (...)
         {
             log_error("Unexpected error: unknown");
@@ -82,49 +127,380 @@ namespace srr
         }
     }
 
+    /**
+     * Queue incoming request on the right lane
+     * @param msg
+     */
+    void SrrManager::dispatchRequest(messagebus::Message msg)
+    {
+        auto subject = msg.metaData().find(messagebus::Message::SUBJECT);
+        bool readOnly = subject != msg.metaData().end() && (subject->second == LIST_FEATURE_SUBJECT || subject->second == JOB_STATUS_SUBJECT || subject->second == SNAPSHOT_LIST_SUBJECT || subject->second == CHUNK_GET_SUBJECT || subject->second == STATS_SUBJECT || subject->second == FLIGHT_RECORDER_SUBJECT);
+        SrrThreadPool& lane = readOnly ? *m_fastLane : *m_slowLane;
+        lane.push(std::bind(&SrrManager::handleRequest, this, std::move(msg), readOnly ? "fast" : "slow", std::chrono::steady_clock::now()));
+    }
+
+    /**
+     * Get the operation of a query, for the metrics
+     * @param query
+     * @return The operation name
+     */
+    static std::string getQueryOperation(const Query& query)
+    {
+        switch (query.parameters_case())
+        {
+            case Query::ParametersCase::kListFeature:
+                return "list";
+            case Query::ParametersCase::kSave:
+                return "save";
+            case Query::ParametersCase::kRestore:
+                return "restore";
+            case Query::ParametersCase::kReset:
+                return "reset";
+            default:
+                return "unknown";
+        }
+    }
+
+    /**
+     * Get the number of features of a query, for the probes
+     * @param query
+     * @return The feature count, 0 for all the features
+     */
+    static size_t getQueryFeatureCount(const Query& query)
+    {
+        switch (query.parameters_case())
+        {
+            case Query::ParametersCase::kSave:
+                return query.save().features().size();
+            case Query::ParametersCase::kRestore:
+                return query.restore().map_features_data().size();
+            case Query::ParametersCase::kReset:
+                return query.reset().features().size();
+            default:
+                return 0;
+        }
+    }
+
+    /**
+     * Get the size of a payload, for the probes
+     * @param userData
+     * @return The size of all its frames in bytes
+     */
+    static size_t getPayloadSize(const dto::UserData& userData)
+    {
+        size_t size = 0;
+        for (const auto& frame : userData)
+        {
+            size += frame.size();
+        }
+        return size;
+    }
+
     /**
      * Handle all incoming request
-     * @param sender
-     * @param payloadea
-     * @return 
+     * @param msg
+     * @param lane Name of the lane which ran it
+     * @param queued When it was queued
      */
-    void SrrManager::handleRequest(messagebus::Message msg)
+    void SrrManager::handleRequest(messagebus::Message msg, const std::string& lane, std::chrono::steady_clock::time_point queued)
     {
         log_debug("SRR handle request");
+        SrrMetrics& metrics = m_srrworker->getMetrics();
+        metrics.observeDuration(METRIC_QUEUE_WAIT, {{"lane", lane}}, queued);
+        SrrMetrics::InFlight inFlight(metrics, METRIC_REQUESTS_IN_FLIGHT, "", {{"lane", lane}});
+        auto start = std::chrono::steady_clock::now();
+        // Continue the trace of the client, from the time the request was queued.
+        SrrTracer& tracer = m_srrworker->getTracer();
+        SrrTracer::Span span(tracer, "request", SrrTracer::extract(msg), queued);
+        span.setAttribute("lane", lane);
+        auto correlationId = msg.metaData().find(messagebus::Message::CORRELATION_ID);
+        if (correlationId != msg.metaData().end())
+        {
+            span.setAttribute("correlationId", correlationId->second);
+        }
+        tracer.recordSpan("queueWait", span.getContext(), queued, start);
+        // Subject, or kind of query for the plain queries.
+        std::string operation = "unknown";
         try
         {
-            dto::UserData data = msg.userData();
-            // Get the query
-            Query query;
-            data >> query;
-            // Process the query
-            Response response = m_processor.processQuery(query);
-            // Send response
+            const std::string& subject = msg.metaData().at(messagebus::Message::SUBJECT);
+            operation = subject;
+            span.setAttribute("subject", subject);
+            SRR_PROBE5(request_receive, subject.c_str(), lane.c_str(), msg.userData().size(), getPayloadSize(msg.userData()),
+                std::chrono::duration_cast<std::chrono::microseconds>(start - queued).count());
+            if (subject == CHUNK_GET_SUBJECT)
+            {
+                // Next chunk of a reply
+                messagebus::Message chunk = m_chunkTransfer->getStoredChunk(msg);
+                sendReply(msg, chunk);
+                return;
+            }
+            if (SrrChunkTransfer::isChunk(msg) && !m_chunkTransfer->addChunk(msg))
+            {
+                // Acknowledge the chunk, the request is handled with its last chunk.
+                messagebus::Message ack;
+                sendReply(msg, ack);
+                return;
+            }
+            if (subject == STATS_SUBJECT)
+            {
+                // Metrics in the Prometheus text format
+                dto::UserData statsData;
+                statsData.push_back(metrics.toPrometheus());
+                sendResponse(msg, std::move(statsData));
+                return;
+            }
+            if (subject == FLIGHT_RECORDER_SUBJECT)
+            {
+                // Last events of the operations, one by line
+                dto::UserData eventsData;
+                eventsData.push_back(m_srrworker->getFlightRecorder().toString());
+                sendResponse(msg, std::move(eventsData));
+                return;
+            }
+            SrrTracer::Span decodeSpan(tracer, "decode");
+            m_compression->decode(msg);
+            // The request is ours: take its payload as is.
+            dto::UserData data = std::move(msg.userData());
+            decodeSpan.end();
+            auto decodeQuery = [&](Query& query)
+            {
+                SrrTracer::Span decodeQuerySpan(tracer, "decodeQuery");
+                data >> query;
+                SRR_PROBE3(query_decode, subject.c_str(), getQueryOperation(query).c_str(), getQueryFeatureCount(query));
+            };
             dto::UserData respData;
-            respData << response;
-            sendResponse(msg, respData);
+            // Protobuf queries of the request, freed all at once with it.
+            // The responses are built on the heap, as the worker results which are swapped in them.
+            google::protobuf::Arena arena;
+            if (subject == START_JOB_SUBJECT)
+            {
+                // Start the query in background, answer with the job id
+                Query* query = google::protobuf::Arena::CreateMessage<Query>(&arena);
+                decodeQuery(*query);
+                respData.push_back(m_jobManager->startJob(*query));
+            }
+            else if (subject == SAVE_DELTA_SUBJECT)
+            {
+                // Save only what changed since the last snapshot
+                Query* query = google::protobuf::Arena::CreateMessage<Query>(&arena);
+                decodeQuery(*query);
+                if (query->parameters_case() != Query::ParametersCase::kSave)
+                {
+                    throw SrrException("Incremental save needs a save query");
+                }
+                SaveResponse save = m_srrworker->saveIpm2ConfigurationDelta(query->save());
+                Response response;
+                response.mutable_save()->Swap(&save);
+                respData << response;
+            }
+            else if (subject == RESUME_RESTORE_SUBJECT)
+            {
+                // Same restore query as the unfinished one
+                Query* query = google::protobuf::Arena::CreateMessage<Query>(&arena);
+                decodeQuery(*query);
+                if (query->parameters_case() != Query::ParametersCase::kRestore)
+                {
+                    throw SrrException("Resume needs a restore query");
+                }
+                RestoreResponse restore = m_srrworker->restoreIpm2Configuration(std::move(*(query->mutable_restore())), nullptr, true);
+                Response response;
+                response.mutable_restore()->Swap(&restore);
+                respData << response;
+            }
+            else if (subject == SAVE_BUNDLE_SUBJECT)
+            {
+                // Bundle name, then the save query
+                if (data.size() < 2)
+                {
+                    throw SrrException("Missing bundle name or save query");
+                }
+                std::string bundleName = data.front();
+                data.pop_front();
+                Query* query = google::protobuf::Arena::CreateMessage<Query>(&arena);
+                decodeQuery(*query);
+                if (query->parameters_case() != Query::ParametersCase::kSave)
+                {
+                    throw SrrException("Bundle save needs a save query");
+                }
+                SaveResponse save = m_srrworker->saveIpm2ConfigurationToBundle(query->save(), bundleName);
+                Response response;
+                response.mutable_save()->Swap(&save);
+                respData << response;
+            }
+            else if (subject == RESTORE_BUNDLE_SUBJECT)
+            {
+                // Bundle name, passphrase, then the features to restore (all if none)
+                if (data.size() < 2)
+                {
+                    throw SrrException("Missing bundle name or passphrase");
+                }
+                std::string bundleName = data.front();
+                data.pop_front();
+                std::string passphrase = data.front();
+                data.pop_front();
+                std::set<FeatureName> features(data.begin(), data.end());
+                RestoreResponse restore = m_srrworker->restoreIpm2ConfigurationFromBundle(bundleName, passphrase, features);
+                Response response;
+                response.mutable_restore()->Swap(&restore);
+                respData << response;
+            }
+            else if (subject == SNAPSHOT_LIST_SUBJECT)
+            {
+                // One manifest by frame
+                for (const auto& snapshot : m_srrworker->listSnapshots())
+                {
+                    respData.push_back(SrrSnapshotStore::manifestToString(snapshot));
+                }
+            }
+            else if (subject == SNAPSHOT_GET_SUBJECT || subject == SNAPSHOT_DELETE_SUBJECT || subject == SNAPSHOT_RESTORE_SUBJECT)
+            {
+                // Snapshot id as first frame
+                if (data.empty())
+                {
+                    throw SrrException("Missing snapshot id");
+                }
+                const std::string& snapshotId = data.front();
+                Response response;
+                if (subject == SNAPSHOT_GET_SUBJECT)
+                {
+                    SaveResponse save = m_srrworker->getSnapshot(snapshotId);
+                    response.mutable_save()->Swap(&save);
+                    respData << response;
+                }
+                else if (subject == SNAPSHOT_DELETE_SUBJECT)
+                {
+                    respData.push_back(m_srrworker->deleteSnapshot(snapshotId) ? "true" : "false");
+                }
+                else
+                {
+                    // Passphrase as second frame
+                    if (data.size() < 2)
+                    {
+                        throw SrrException("Missing passphrase");
+                    }
+                    RestoreResponse restore = m_srrworker->restoreSnapshot(snapshotId, *std::next(data.begin()));
+                    response.mutable_restore()->Swap(&restore);
+                    respData << response;
+                }
+            }
+            else if (subject == JOB_STATUS_SUBJECT)
+            {
+                // Job id as only frame
+                if (data.empty())
+                {
+                    throw SrrException("Missing job id");
+                }
+                respData = m_jobManager->getJobStatus(data.front());
+            }
+            else
+            {
+                // Get the query
+                operation = "query";
+                Query* query = google::protobuf::Arena::CreateMessage<Query>(&arena);
+                decodeQuery(*query);
+                operation = getQueryOperation(*query);
+                if (query->parameters_case() == Query::ParametersCase::kListFeature)
+                {
+                    // Already serialized and compressed, the reply takes its own copy of the frames.
+                    bool compressed = m_compression->isAcceptedBy(SrrCompression::getAcceptEncoding(msg));
+                    sendEncodedResponse(msg, compressed ? m_featureListCompressedReply : m_featureListReply);
+                    metrics.observeDuration(METRIC_REQUEST_DURATION, {{"operation", operation}}, start);
+                    return;
+                }
+                if (query->parameters_case() == Query::ParametersCase::kRestore)
+                {
+                    // The feature payloads go from the query to the agent requests without copy.
+                    RestoreResponse restore = m_srrworker->restoreIpm2Configuration(std::move(*(query->mutable_restore())));
+                    Response response;
+                    response.mutable_restore()->Swap(&restore);
+                    respData << response;
+                }
+                else
+                {
+                    // Process the query
+                    respData << m_processor.processQuery(*query);
+                }
+            }
+            // Send response
+            sendResponse(msg, std::move(respData));
+            metrics.observeDuration(METRIC_REQUEST_DURATION, {{"operation", operation}}, start);
         }        
         catch (std::exception& ex)
         {
             log_error(ex.what());
+            metrics.increment(METRIC_REQUEST_ERRORS, {{"operation", operation}});
+            span.setAttribute("error", ex.what());
+        }
+        span.setAttribute("operation", operation);
+    }
+
+    /**
+     * Write the last events of the operations in the flight recorder file
+     */
+    void SrrManager::dumpFlightRecorder()
+    {
+        auto path = m_parameters.find(FLIGHT_RECORDER_FILE_KEY);
+        try
+        {
+            m_srrworker->getFlightRecorder().dump(path != m_parameters.end() ? path->second : DEFAULT_FLIGHT_RECORDER_FILE);
+        }
+        catch (const std::exception& e)
+        {
+            log_error("Flight recorder dump failed: %s", e.what());
         }
     }
 
     /**
      * Send response on message bus
      * @param msg
-     * @param userData
+     * @param userData Moved in the reply
+     */
+    void SrrManager::sendResponse(const messagebus::Message& msg, dto::UserData&& userData)
+    {
+        SrrTracer::Span span(m_srrworker->getTracer(), "reply");
+        SRR_PROBE3(reply_serialize_start, msg.metaData().at(messagebus::Message::SUBJECT).c_str(), userData.size(), getPayloadSize(userData));
+        messagebus::Message respMsg;
+        respMsg.userData() = std::move(userData);
+        // Aggregated responses are compressed for the clients which read it,
+        m_compression->encode(respMsg, SrrCompression::getAcceptEncoding(msg));
+        sendEncodedResponse(msg, std::move(respMsg));
+    }
+
+    /**
+     * Send an encoded response on message bus
+     * @param msg The request
+     * @param respMsg The reply, its payload encoded for the client
+     */
+    void SrrManager::sendEncodedResponse(const messagebus::Message& msg, messagebus::Message respMsg)
+    {
+        // Cut in chunks for the clients which pull them.
+        m_chunkTransfer->advertise(respMsg);
+        if (SrrChunkTransfer::acceptsChunks(msg))
+        {
+            respMsg = m_chunkTransfer->storeChunks(msg, std::move(respMsg));
+        }
+        // Size of the first message, the whole reply when it is not cut in chunks.
+        SRR_PROBE3(reply_serialize_done, msg.metaData().at(messagebus::Message::SUBJECT).c_str(), respMsg.userData().size(), getPayloadSize(respMsg.userData()));
+        sendReply(msg, respMsg);
+    }
+
+    /**
+     * Send a reply on message bus
+     * @param msg The request
+     * @param respMsg The reply, without its routing meta data
      */
-    void SrrManager::sendResponse(const messagebus::Message& msg, const dto::UserData& userData)
+    void SrrManager::sendReply(const messagebus::Message& msg, messagebus::Message& respMsg)
     {
         try
         {
-            messagebus::Message respMsg;
-            respMsg.userData() = userData;
-            respMsg.metaData().emplace(messagebus::Message::SUBJECT, msg.metaData().at(messagebus::Message::SUBJECT));
-            respMsg.metaData().emplace(messagebus::Message::FROM, m_parameters.at(AGENT_NAME_KEY));
-            respMsg.metaData().emplace(messagebus::Message::TO, msg.metaData().find(messagebus::Message::FROM)->second);
-            respMsg.metaData().emplace(messagebus::Message::CORRELATION_ID, msg.metaData().find(messagebus::Message::CORRELATION_ID)->second);
+            respMsg.metaData()[messagebus::Message::SUBJECT] = msg.metaData().at(messagebus::Message::SUBJECT);
+            respMsg.metaData()[messagebus::Message::FROM] = m_parameters.at(AGENT_NAME_KEY);
+            respMsg.metaData()[messagebus::Message::TO] = msg.metaData().find(messagebus::Message::FROM)->second;
+            respMsg.metaData()[messagebus::Message::CORRELATION_ID] = msg.metaData().find(messagebus::Message::CORRELATION_ID)->second;
+            // The client finds its trace in the reply.
+            SrrTracer::inject(respMsg);
+            std::lock_guard<std::mutex> lock(m_sendMutex);
             m_msgBus->sendReply(msg.metaData().find(messagebus::Message::REPLY_TO)->second, respMsg);
         }
         catch (messagebus::MessageBusException& ex)
@@ -135,4 +511,4 @@ namespace srr
             throw SrrException("Unknown error on send response to the message bus");
         }
     }
-}
\ No newline at end of file
+}
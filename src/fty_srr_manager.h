@@ -23,6 +23,8 @@
 #define FTY_SRR_MANAGER_H_INCLUDED
 
 #include "fty_srr_worker.h"
+#include "fty_srr_job_manager.h"
+#include "fty_srr_thread_pool.h"
 
 /**
  * \brief Agent srr server
@@ -34,20 +36,35 @@ namespace srr
     {
         public:
             explicit SrrManager(const std::map<std::string, std::string> & parameters);
-            ~SrrManager() = default;
+            ~SrrManager();
             
             dto::srr::ListFeatureResponse getListFeatureHandler(const dto::srr::ListFeatureQuery& q);
+            void dumpFlightRecorder();
             
         private:
             std::map<std::string, std::string> m_parameters;
+            // Request threads, must outlive the message bus.
+            std::unique_ptr<srr::SrrThreadPool> m_fastLane;
+            std::unique_ptr<srr::SrrThreadPool> m_slowLane;
             std::unique_ptr<messagebus::MessageBus> m_msgBus;
+            // Replies are sent from several threads.
+            std::mutex m_sendMutex;
+            std::unique_ptr<srr::SrrCompression> m_compression;
+            std::unique_ptr<srr::SrrChunkTransfer> m_chunkTransfer;
             std::unique_ptr<srr::SrrWorker> m_srrworker;
+            std::unique_ptr<srr::SrrJobManager> m_jobManager;
+            // Feature list reply, encoded once: plain, and compressed for the clients which read it.
+            messagebus::Message m_featureListReply;
+            messagebus::Message m_featureListCompressedReply;
             
             dto::srr::SrrQueryProcessor m_processor;
 
             void init();
-            void handleRequest(messagebus::Message msg);
-            void sendResponse(const messagebus::Message& msg, const dto::UserData& userData);
+            void dispatchRequest(messagebus::Message msg);
+            void handleRequest(messagebus::Message msg, const std::string& lane, std::chrono::steady_clock::time_point queued);
+            void sendResponse(const messagebus::Message& msg, dto::UserData&& userData);
+            void sendEncodedResponse(const messagebus::Message& msg, messagebus::Message respMsg);
+            void sendReply(const messagebus::Message& msg, messagebus::Message& respMsg);
     };
     
 } // namespace srr
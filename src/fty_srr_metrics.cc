@@ -0,0 +1,432 @@
+/*  =========================================================================
+    fty_srr_metrics - Fty srr runtime metrics
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_metrics - Fty srr runtime metrics
+@discuss
+@end
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    const std::vector<double> SrrMetrics::LATENCY_BUCKETS = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300};
+    const std::vector<double> SrrMetrics::SIZE_BUCKETS = {1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216, 67108864, 268435456};
+
+    // Metric name -> help text
+    static const std::map<std::string, std::string> METRICS_HELP = {
+        {METRIC_REQUEST_DURATION, "Time to handle a request of the srr queue, by operation."},
+        {METRIC_REQUEST_ERRORS, "Requests of the srr queue which failed, by operation."},
+        {METRIC_REQUESTS_IN_FLIGHT, "Requests of the srr queue being handled, by lane."},
+        {METRIC_QUEUE_WAIT, "Time a request waits for a thread of its lane."},
+        {METRIC_OPERATION_DURATION, "Time of a whole save, restore or reset, jobs included."},
+        {METRIC_OPERATIONS_IN_FLIGHT, "Saves, restores and resets in progress."},
+        {METRIC_AGENT_REQUEST_DURATION, "Time an agent takes to answer a request attempt, probe and chunks included."},
+        {METRIC_AGENT_REQUEST_BYTES, "Size of the requests sent to an agent, as sent."},
+        {METRIC_AGENT_RESPONSE_BYTES, "Size of the responses of an agent, as received."},
+        {METRIC_AGENT_ERRORS, "Requests to an agent which failed, by reason."},
+        {METRIC_FEATURE_REQUEST_BYTES, "Feature data sent to the agents in restores."},
+        {METRIC_FEATURE_RESPONSE_BYTES, "Feature data received from the agents in saves."}
+    };
+
+    /**
+     * Format a value the way Prometheus reads it
+     * @param value
+     * @return The value as text
+     */
+    static std::string formatValue(double value)
+    {
+        if (std::isinf(value))
+        {
+            return value > 0 ? "+Inf" : "-Inf";
+        }
+        // Shortest text read back as the same value.
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.15g", value);
+        if (std::strtod(buffer, nullptr) != value)
+        {
+            snprintf(buffer, sizeof(buffer), "%.17g", value);
+        }
+        return buffer;
+    }
+
+    /**
+     * Escape a label value
+     * @param value
+     * @return The escaped value
+     */
+    static std::string escapeLabel(const std::string& value)
+    {
+        std::string escaped;
+        for (char c : value)
+        {
+            if (c == '\\' || c == '"')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (c == '\n')
+            {
+                escaped += "\\n";
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    /**
+     * Format labels, sorted by name
+     * @param labels
+     * @return The labels without braces, for example agent="fty-config",action="save"
+     */
+    static std::string formatLabels(const SrrMetrics::Labels& labels)
+    {
+        std::string text;
+        for (const auto& label : labels)
+        {
+            text += (text.empty() ? "" : ",") + label.first + "=\"" + escapeLabel(label.second) + "\"";
+        }
+        return text;
+    }
+
+    /**
+     * Constructor
+     * @param dumpPath File where to write the metrics, empty to disable
+     * @param dumpInterval Time between two writes in ms
+     */
+    SrrMetrics::SrrMetrics(const std::string& dumpPath, unsigned long dumpInterval) :
+        m_dumpPath(dumpPath), m_dumpInterval(dumpInterval), m_stopped(false)
+    {
+        if (!m_dumpPath.empty() && dumpInterval > 0)
+        {
+            m_dumpThread = std::thread(&SrrMetrics::dumpPeriodically, this);
+        }
+    }
+
+    /**
+     * Destructor: stop the periodic dump, after a last one.
+     */
+    SrrMetrics::~SrrMetrics()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_stopCv.notify_all();
+        if (m_dumpThread.joinable())
+        {
+            m_dumpThread.join();
+        }
+    }
+
+    /**
+     * Get a series, create it if needed. Must be called with the lock.
+     * @param name
+     * @param type
+     * @param labels
+     * @return The series
+     */
+    SrrMetrics::series& SrrMetrics::getSeries(const std::string& name, Type type, const Labels& labels)
+    {
+        auto family = m_families.find(name);
+        if (family == m_families.end())
+        {
+            family = m_families.emplace(name, SrrMetrics::family{type, {}}).first;
+        }
+        else if (family->second.type != type)
+        {
+            throw SrrException("Metric " + name + " already defined with another type");
+        }
+        return family->second.values[formatLabels(labels)];
+    }
+
+    /**
+     * Increment a counter
+     * @param name
+     * @param labels
+     * @param value
+     */
+    void SrrMetrics::increment(const std::string& name, const Labels& labels, double value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        getSeries(name, Type::COUNTER, labels).value += value;
+    }
+
+    /**
+     * Change a gauge
+     * @param name
+     * @param labels
+     * @param delta
+     */
+    void SrrMetrics::addGauge(const std::string& name, const Labels& labels, double delta)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        getSeries(name, Type::GAUGE, labels).value += delta;
+    }
+
+    /**
+     * Add a value to a histogram
+     * @param name
+     * @param labels
+     * @param value
+     * @param buckets Upper bounds, sorted, the same for all the observations of the histogram
+     */
+    void SrrMetrics::observe(const std::string& name, const Labels& labels, double value, const std::vector<double>& buckets)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        series& histogram = getSeries(name, Type::HISTOGRAM, labels);
+        if (!histogram.buckets)
+        {
+            histogram.buckets = &buckets;
+            histogram.bucketCounts.resize(buckets.size() + 1, 0);
+        }
+        // Last count for the values above all the bounds.
+        size_t bucket = std::lower_bound(histogram.buckets->begin(), histogram.buckets->end(), value) - histogram.buckets->begin();
+        histogram.bucketCounts[bucket]++;
+        histogram.value += value;
+        histogram.count++;
+    }
+
+    /**
+     * Add the time elapsed since a start to a latency histogram
+     * @param name
+     * @param labels
+     * @param start
+     */
+    void SrrMetrics::observeDuration(const std::string& name, const Labels& labels, std::chrono::steady_clock::time_point start)
+    {
+        observe(name, labels, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), LATENCY_BUCKETS);
+    }
+
+    /**
+     * Get all the metrics in the Prometheus text format
+     * @return The metrics
+     */
+    std::string SrrMetrics::toPrometheus() const
+    {
+        std::ostringstream text;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& family : m_families)
+        {
+            const std::string& name = family.first;
+            auto help = METRICS_HELP.find(name);
+            if (help != METRICS_HELP.end())
+            {
+                text << "# HELP " << name << " " << help->second << "\n";
+            }
+            text << "# TYPE " << name << " " << (family.second.type == Type::COUNTER ? "counter" : family.second.type == Type::GAUGE ? "gauge" : "histogram") << "\n";
+            for (const auto& item : family.second.values)
+            {
+                const std::string& labels = item.first;
+                if (family.second.type != Type::HISTOGRAM)
+                {
+                    text << name << (labels.empty() ? "" : "{" + labels + "}") << " " << formatValue(item.second.value) << "\n";
+                    continue;
+                }
+                std::string separator = labels.empty() ? "" : ",";
+                uint64_t cumulativeCount = 0;
+                for (size_t i = 0; i < item.second.bucketCounts.size(); i++)
+                {
+                    cumulativeCount += item.second.bucketCounts[i];
+                    double bound = i < item.second.buckets->size() ? (*item.second.buckets)[i] : INFINITY;
+                    text << name << "_bucket{" << labels << separator << "le=\"" << formatValue(bound) << "\"} " << cumulativeCount << "\n";
+                }
+                text << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << formatValue(item.second.value) << "\n";
+                text << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << item.second.count << "\n";
+            }
+        }
+        return text.str();
+    }
+
+    /**
+     * Write the metrics in the dump file, replaced at once for its readers.
+     */
+    void SrrMetrics::dump() const
+    {
+        std::string tmpPath = m_dumpPath + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::trunc);
+            file << toPrometheus();
+            if (!file)
+            {
+                throw SrrException("Metrics not written in " + tmpPath);
+            }
+        }
+        if (std::rename(tmpPath.c_str(), m_dumpPath.c_str()) != 0)
+        {
+            throw SrrException("Metrics not written in " + m_dumpPath);
+        }
+    }
+
+    /**
+     * Write the metrics periodically, until the metrics are destroyed.
+     */
+    void SrrMetrics::dumpPeriodically()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        bool stopped = false;
+        while (!stopped)
+        {
+            stopped = m_stopCv.wait_for(lock, m_dumpInterval, [this] { return m_stopped; });
+            lock.unlock();
+            try
+            {
+                dump();
+            }
+            catch (const std::exception& e)
+            {
+                log_error("Metrics dump failed: %s", e.what());
+            }
+            lock.lock();
+        }
+    }
+
+    /**
+     * Constructor: the scope starts
+     * @param metrics
+     * @param gaugeName
+     * @param durationName Latency histogram, empty to only count the scope
+     * @param labels
+     */
+    SrrMetrics::InFlight::InFlight(SrrMetrics& metrics, const std::string& gaugeName, const std::string& durationName, const Labels& labels) :
+        m_metrics(metrics), m_gaugeName(gaugeName), m_durationName(durationName), m_labels(labels), m_start(std::chrono::steady_clock::now())
+    {
+        m_metrics.addGauge(m_gaugeName, m_labels, 1);
+    }
+
+    /**
+     * Destructor: the scope ends
+     */
+    SrrMetrics::InFlight::~InFlight()
+    {
+        try
+        {
+            m_metrics.addGauge(m_gaugeName, m_labels, -1);
+            if (!m_durationName.empty())
+            {
+                m_metrics.observeDuration(m_durationName, m_labels, m_start);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            log_error("Metric %s not updated: %s", m_gaugeName.c_str(), e.what());
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_metrics_test (bool verbose)
+{
+    printf (" * fty_srr_metrics: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    // Values and labels as Prometheus reads them
+    assert (formatValue (0.1) == "0.1");
+    assert (formatValue (3) == "3");
+    assert (formatValue (INFINITY) == "+Inf");
+    assert (escapeLabel ("a\"b\\c\nd") == "a\\\"b\\\\c\\nd");
+    assert (formatLabels ({{"b", "2"}, {"a", "1"}}) == "a=\"1\",b=\"2\"");
+
+    // Counters, gauges and histograms, sorted by name then labels
+    {
+        // The buckets outlive the histogram.
+        std::vector<double> buckets = {1, 10};
+        SrrMetrics metrics ("", 0);
+        metrics.increment (METRIC_REQUEST_ERRORS, {{"action", "save"}});
+        metrics.increment (METRIC_REQUEST_ERRORS, {{"action", "save"}}, 2);
+        metrics.addGauge (METRIC_REQUESTS_IN_FLIGHT, {}, 1);
+        metrics.observe ("test_size", {}, 1, buckets);
+        metrics.observe ("test_size", {}, 5, buckets);
+        metrics.observe ("test_size", {}, 20, buckets);
+        std::string text = metrics.toPrometheus ();
+        assert (text.find ("# TYPE srr_request_errors_total counter\nsrr_request_errors_total{action=\"save\"} 3\n") != std::string::npos);
+        assert (text.find ("# HELP srr_requests_in_flight ") != std::string::npos);
+        assert (text.find ("srr_requests_in_flight 1\n") != std::string::npos);
+        assert (text.find (
+            "# TYPE test_size histogram\n"
+            "test_size_bucket{le=\"1\"} 1\n"
+            "test_size_bucket{le=\"10\"} 2\n"
+            "test_size_bucket{le=\"+Inf\"} 3\n"
+            "test_size_sum 26\n"
+            "test_size_count 3\n") != std::string::npos);
+
+        // A name keeps its type.
+        bool rejected = false;
+        try {
+            metrics.addGauge (METRIC_REQUEST_ERRORS, {}, 1);
+        }
+        catch (const SrrException&) {
+            rejected = true;
+        }
+        assert (rejected);
+
+        // A scope is counted while it runs, its duration observed at its end.
+        {
+            SrrMetrics::InFlight inFlight (metrics, METRIC_OPERATIONS_IN_FLIGHT, METRIC_OPERATION_DURATION, {{"action", "save"}});
+            assert (metrics.toPrometheus ().find ("srr_operations_in_flight{action=\"save\"} 1\n") != std::string::npos);
+        }
+        text = metrics.toPrometheus ();
+        assert (text.find ("srr_operations_in_flight{action=\"save\"} 0\n") != std::string::npos);
+        assert (text.find ("srr_operation_duration_seconds_count{action=\"save\"} 1\n") != std::string::npos);
+    }
+
+    // The dump file is written once more when the metrics are destroyed.
+    std::string path = std::string (SELFTEST_DIR_RW) + "/metrics";
+    {
+        SrrMetrics metrics (path, 60000);
+        metrics.increment (METRIC_REQUEST_ERRORS, {});
+    }
+    {
+        std::ifstream file (path);
+        std::string content ((std::istreambuf_iterator<char> (file)), std::istreambuf_iterator<char> ());
+        assert (content.find ("srr_request_errors_total 1\n") != std::string::npos);
+    }
+    unlink (path.c_str ());
+    //  @end
+
+    printf ("OK\n");
+}
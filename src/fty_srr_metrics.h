@@ -0,0 +1,112 @@
+/*  =========================================================================
+    fty_srr_metrics - Fty srr runtime metrics
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_METRICS_H_INCLUDED
+#define FTY_SRR_METRICS_H_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace srr
+{
+    /**
+     * \brief In-process metrics: counters, gauges and histograms by name and labels.
+     *
+     * The metrics are read in the Prometheus text format, through the stats
+     * request or in a file written periodically when a path is set.
+     */
+    class SrrMetrics
+    {
+        public:
+            using Labels = std::map<std::string, std::string>;
+
+            // Histogram upper bounds, in seconds and in bytes.
+            static const std::vector<double> LATENCY_BUCKETS;
+            static const std::vector<double> SIZE_BUCKETS;
+
+            explicit SrrMetrics(const std::string& dumpPath, unsigned long dumpInterval);
+            ~SrrMetrics();
+
+            void increment(const std::string& name, const Labels& labels, double value = 1);
+            void addGauge(const std::string& name, const Labels& labels, double delta);
+            void observe(const std::string& name, const Labels& labels, double value, const std::vector<double>& buckets);
+            void observeDuration(const std::string& name, const Labels& labels, std::chrono::steady_clock::time_point start);
+
+            std::string toPrometheus() const;
+            void dump() const;
+
+            /**
+             * \brief Scope in progress: counted in a gauge, its duration observed at the end.
+             */
+            class InFlight
+            {
+                public:
+                    InFlight(SrrMetrics& metrics, const std::string& gaugeName, const std::string& durationName, const Labels& labels);
+                    ~InFlight();
+                    InFlight(const InFlight&) = delete;
+                    InFlight& operator=(const InFlight&) = delete;
+
+                private:
+                    SrrMetrics& m_metrics;
+                    std::string m_gaugeName;
+                    std::string m_durationName;
+                    Labels m_labels;
+                    std::chrono::steady_clock::time_point m_start;
+            };
+
+        private:
+            enum class Type { COUNTER, GAUGE, HISTOGRAM };
+            struct series {
+                double value = 0;
+                // Histograms only, bucket counts are not cumulative.
+                const std::vector<double>* buckets = nullptr;
+                std::vector<uint64_t> bucketCounts;
+                uint64_t count = 0;
+            };
+            struct family {
+                Type type;
+                // Prometheus labels text -> series
+                std::map<std::string, series> values;
+            };
+            std::map<std::string, family> m_families;
+            mutable std::mutex m_mutex;
+
+            std::string m_dumpPath;
+            std::chrono::milliseconds m_dumpInterval;
+            std::thread m_dumpThread;
+            std::condition_variable m_stopCv;
+            bool m_stopped;
+
+            series& getSeries(const std::string& name, Type type, const Labels& labels);
+            void dumpPeriodically();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_metrics_test (bool verbose);
+
+#endif
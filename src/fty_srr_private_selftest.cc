@@ -37,6 +37,33 @@
 void
 fty_srr_private_selftest (bool verbose, const char *subtest)
 {
+// Tests for stable private classes:
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_snapshot_store_test"))
+        fty_srr_snapshot_store_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_chunk_transfer_test"))
+        fty_srr_chunk_transfer_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_bundle_test"))
+        fty_srr_bundle_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_compression_test"))
+        fty_srr_compression_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_restore_journal_test"))
+        fty_srr_restore_journal_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_thread_pool_test"))
+        fty_srr_thread_pool_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_worker_test"))
+        fty_srr_worker_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_job_manager_test"))
+        fty_srr_job_manager_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_inprocess_bus_test"))
+        fty_srr_inprocess_bus_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_feature_source_test"))
+        fty_srr_feature_source_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_metrics_test"))
+        fty_srr_metrics_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_tracer_test"))
+        fty_srr_tracer_test (verbose);
+    if (streq (subtest, "$ALL") || streq (subtest, "fty_srr_flight_recorder_test"))
+        fty_srr_flight_recorder_test (verbose);
 }
 /*
 ################################################################################
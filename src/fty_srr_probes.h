@@ -0,0 +1,66 @@
+/*  =========================================================================
+    fty_srr_probes - Fty srr static probes
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_PROBES_H_INCLUDED
+#define FTY_SRR_PROBES_H_INCLUDED
+
+/*
+ * USDT probes of the fty_srr provider, for SystemTap and bpftrace.
+ *
+ * A probe is a nop in the code and a note in the binary. Each probe has a
+ * semaphore the tracer increments while it is attached: the arguments are
+ * only evaluated then, so a probe costs a test of its semaphore otherwise.
+ * SRR_PROBE_ENABLED guards the work done for a probe outside of its
+ * arguments. Strings are given as C strings. Without <sys/sdt.h>, the probes
+ * and their arguments are compiled out.
+ */
+
+// Every probe, its semaphore is defined in fty_srr_manager.cc.
+#define SRR_PROBE_LIST(X) \
+    X(request_receive) X(query_decode) X(passphrase_check_start) X(passphrase_check_done) \
+    X(agent_request_start) X(agent_request_done) X(reply_serialize_start) X(reply_serialize_done)
+
+#ifdef FTY_SRR_HAVE_USDT
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define SRR_PROBE_SEMAPHORE(name) fty_srr_##name##_semaphore
+#define SRR_PROBE_DECLARE(name) extern unsigned short SRR_PROBE_SEMAPHORE(name);
+#define SRR_PROBE_DEFINE(name) unsigned short SRR_PROBE_SEMAPHORE(name) __attribute__((section(".probes")));
+SRR_PROBE_LIST(SRR_PROBE_DECLARE)
+#define SRR_PROBE_ENABLED(name) __builtin_expect(SRR_PROBE_SEMAPHORE(name) != 0, 0)
+#define SRR_PROBE1(name, a1) do { if (SRR_PROBE_ENABLED(name)) STAP_PROBE1(fty_srr, name, a1); } while (0)
+#define SRR_PROBE2(name, a1, a2) do { if (SRR_PROBE_ENABLED(name)) STAP_PROBE2(fty_srr, name, a1, a2); } while (0)
+#define SRR_PROBE3(name, a1, a2, a3) do { if (SRR_PROBE_ENABLED(name)) STAP_PROBE3(fty_srr, name, a1, a2, a3); } while (0)
+#define SRR_PROBE4(name, a1, a2, a3, a4) do { if (SRR_PROBE_ENABLED(name)) STAP_PROBE4(fty_srr, name, a1, a2, a3, a4); } while (0)
+#define SRR_PROBE5(name, a1, a2, a3, a4, a5) do { if (SRR_PROBE_ENABLED(name)) STAP_PROBE5(fty_srr, name, a1, a2, a3, a4, a5); } while (0)
+#else
+#define SRR_PROBE_DEFINE(name)
+#define SRR_PROBE_ENABLED(name) false
+// Arguments not evaluated, but still checked by the compiler.
+#define SRR_PROBE_ARG(a) (void)sizeof(a)
+#define SRR_PROBE1(name, a1) do { SRR_PROBE_ARG(a1); } while (0)
+#define SRR_PROBE2(name, a1, a2) do { SRR_PROBE_ARG(a1); SRR_PROBE_ARG(a2); } while (0)
+#define SRR_PROBE3(name, a1, a2, a3) do { SRR_PROBE_ARG(a1); SRR_PROBE_ARG(a2); SRR_PROBE_ARG(a3); } while (0)
+#define SRR_PROBE4(name, a1, a2, a3, a4) do { SRR_PROBE_ARG(a1); SRR_PROBE_ARG(a2); SRR_PROBE_ARG(a3); SRR_PROBE_ARG(a4); } while (0)
+#define SRR_PROBE5(name, a1, a2, a3, a4, a5) do { SRR_PROBE_ARG(a1); SRR_PROBE_ARG(a2); SRR_PROBE_ARG(a3); SRR_PROBE_ARG(a4); SRR_PROBE_ARG(a5); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,277 @@
+/*  =========================================================================
+    fty_srr_restore_journal - Fty srr restore journal
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_restore_journal - Fty srr restore journal
+@discuss
+@end
+ */
+
+#include <fty_srr_dto.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+namespace srr
+{
+    static const char* JOURNAL_EXTENSION = ".journal";
+
+    /**
+     * Constructor
+     * @param path Journal directory, empty to disable the journal
+     * @param maxAge Time in seconds after its last checkpoint a journal is removed, 0 to keep it
+     */
+    SrrRestoreJournal::SrrRestoreJournal(const std::string& path, std::time_t maxAge) :
+        m_path(path), m_maxAge(maxAge)
+    {
+        if (isEnabled())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            removeExpiredJournals();
+        }
+    }
+
+    /**
+     * Get the id of a restore: the hash of its checksum and of its feature names, the
+     * payloads are not read.
+     * @param features
+     * @param checksum
+     * @return The restore id
+     */
+    std::string SrrRestoreJournal::getRestoreId(const std::set<FeatureName>& features, const std::string& checksum)
+    {
+        std::string content = checksum + '\n';
+        for (const auto& featureName : features)
+        {
+            content += featureName + '\n';
+        }
+        return SrrSnapshotStore::hash(content);
+    }
+
+    /**
+     * Get the features a previous run of a restore applied
+     * @param restoreId
+     * @return The restored features, empty when there is no journal
+     */
+    std::set<FeatureName> SrrRestoreJournal::getRestoredFeatures(const std::string& restoreId)
+    {
+        std::set<FeatureName> features;
+        if (!isEnabled())
+        {
+            return features;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::string journalPath = getJournalPath(restoreId);
+        std::ifstream file(journalPath);
+        std::string line;
+        off_t checkpointSize = 0;
+        // A line cut by a crash has no end of line, it is not a checkpoint.
+        while (std::getline(file, line) && !file.eof())
+        {
+            features.insert(line);
+            checkpointSize += line.size() + 1;
+        }
+        if (!line.empty() && file.eof())
+        {
+            // Drop it, so that the next checkpoint starts on its own line.
+            file.close();
+            if (truncate(journalPath.c_str(), checkpointSize) != 0)
+            {
+                throw SrrException("Unable to truncate " + journalPath + ": " + strerror(errno));
+            }
+        }
+        return features;
+    }
+
+    /**
+     * Record features as restored, back on disk when it returns.
+     * @param restoreId
+     * @param features
+     */
+    void SrrRestoreJournal::addRestoredFeatures(const std::string& restoreId, const std::set<FeatureName>& features)
+    {
+        if (!isEnabled() || features.empty())
+        {
+            return;
+        }
+        std::string lines;
+        for (const auto& feature : features)
+        {
+            lines += feature + '\n';
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (mkdir(m_path.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            throw SrrException("Unable to create " + m_path + ": " + strerror(errno));
+        }
+        removeExpiredJournals();
+        std::string journalPath = getJournalPath(restoreId);
+        int fd = open(journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0600);
+        if (fd < 0)
+        {
+            throw SrrException("Unable to open " + journalPath + ": " + strerror(errno));
+        }
+        bool written = write(fd, lines.data(), lines.size()) == static_cast<ssize_t>(lines.size()) && fsync(fd) == 0;
+        close(fd);
+        if (!written)
+        {
+            throw SrrException("Unable to write " + journalPath);
+        }
+    }
+
+    /**
+     * Remove the journal of a restore
+     * @param restoreId
+     */
+    void SrrRestoreJournal::remove(const std::string& restoreId)
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        unlink(getJournalPath(restoreId).c_str());
+    }
+
+    std::string SrrRestoreJournal::getJournalPath(const std::string& restoreId) const
+    {
+        return m_path + "/" + restoreId + JOURNAL_EXTENSION;
+    }
+
+    /**
+     * Remove the journals older than the maximum age. Must be called with the lock.
+     */
+    void SrrRestoreJournal::removeExpiredJournals()
+    {
+        if (m_maxAge <= 0)
+        {
+            return;
+        }
+        DIR* dir = opendir(m_path.c_str());
+        if (dir == nullptr)
+        {
+            // Created with the first journal.
+            return;
+        }
+        std::time_t now = std::time(nullptr);
+        std::string extension(JOURNAL_EXTENSION);
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string name(entry->d_name);
+            if (name.size() <= extension.size() || name.compare(name.size() - extension.size(), extension.size(), extension) != 0)
+            {
+                continue;
+            }
+            std::string journalPath = m_path + "/" + name;
+            struct stat fileStat;
+            if (stat(journalPath.c_str(), &fileStat) == 0 && now - fileStat.st_mtime > m_maxAge)
+            {
+                log_info("Remove expired restore journal %s", journalPath.c_str());
+                unlink(journalPath.c_str());
+            }
+        }
+        closedir(dir);
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_restore_journal_test (bool verbose)
+{
+    printf (" * fty_srr_restore_journal: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    // The id depends on the checksum and the feature names only.
+    std::string restoreId = SrrRestoreJournal::getRestoreId ({"feature1", "feature2"}, "checksum");
+    assert (SrrSnapshotStore::isValidHash (restoreId));
+    assert (restoreId == SrrRestoreJournal::getRestoreId ({"feature2", "feature1"}, "checksum"));
+    assert (restoreId != SrrRestoreJournal::getRestoreId ({"feature1"}, "checksum"));
+    assert (restoreId != SrrRestoreJournal::getRestoreId ({"feature1", "feature2"}, "checksum2"));
+
+    // Disabled journal: nothing recorded
+    {
+        SrrRestoreJournal journal ("", 0);
+        assert (!journal.isEnabled ());
+        journal.addRestoredFeatures ("restore", {"feature1"});
+        assert (journal.getRestoredFeatures ("restore").empty ());
+    }
+
+    std::string path = std::string (SELFTEST_DIR_RW) + "/journal";
+    std::string journalPath = path + "/restore" + JOURNAL_EXTENSION;
+    SrrRestoreJournal journal (path, 3600);
+    assert (journal.getRestoredFeatures ("restore").empty ());
+    journal.addRestoredFeatures ("restore", {"feature1", "feature2"});
+    assert ((journal.getRestoredFeatures ("restore") == std::set<FeatureName> {"feature1", "feature2"}));
+
+    // Last line cut by a crash: replayed without it, the next checkpoint on its own line
+    {
+        std::ofstream file (journalPath, std::ios::app);
+        file << "feat";
+    }
+    assert ((journal.getRestoredFeatures ("restore") == std::set<FeatureName> {"feature1", "feature2"}));
+    journal.addRestoredFeatures ("restore", {"feature3"});
+    assert ((journal.getRestoredFeatures ("restore") == std::set<FeatureName> {"feature1", "feature2", "feature3"}));
+
+    journal.remove ("restore");
+    assert (journal.getRestoredFeatures ("restore").empty ());
+
+    // The journals not written for longer than the maximum age are removed, at start and at each checkpoint.
+    std::string oldPath = path + "/old" + JOURNAL_EXTENSION;
+    journal.addRestoredFeatures ("old", {"feature1"});
+    struct timeval times[2] = {{std::time (nullptr) - 7200, 0}, {std::time (nullptr) - 7200, 0}};
+    assert (utimes (oldPath.c_str (), times) == 0);
+    journal.addRestoredFeatures ("restore", {"feature1"});
+    assert (access (oldPath.c_str (), F_OK) != 0);
+    assert (access (journalPath.c_str (), F_OK) == 0);
+    assert (utimes (journalPath.c_str (), times) == 0);
+    {
+        SrrRestoreJournal keepAll (path, 0);
+        assert (access (journalPath.c_str (), F_OK) == 0);
+        SrrRestoreJournal restarted (path, 3600);
+        assert (access (journalPath.c_str (), F_OK) != 0);
+    }
+    rmdir (path.c_str ());
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,68 @@
+/*  =========================================================================
+    fty_srr_restore_journal - Fty srr restore journal
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_RESTORE_JOURNAL_H_INCLUDED
+#define FTY_SRR_RESTORE_JOURNAL_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <ctime>
+#include <mutex>
+#include <set>
+
+namespace srr
+{
+    /**
+     * \brief Features already applied by the restores which did not end successfully.
+     *
+     * A restore is identified by its checksum and the names of its features, so sending
+     * the same query again finds its journal back, even after a restart. One file by
+     * restore, with one line by restored feature, synced at each checkpoint. The journals
+     * not written for longer than the maximum age are removed.
+     */
+    class SrrRestoreJournal
+    {
+        public:
+            // Empty path to disable the journal, maxAge in seconds, 0 to keep the journals whatever their age.
+            SrrRestoreJournal(const std::string& path, std::time_t maxAge);
+            ~SrrRestoreJournal() = default;
+
+            static std::string getRestoreId(const std::set<dto::srr::FeatureName>& features, const std::string& checksum);
+
+            bool isEnabled() const { return !m_path.empty(); }
+            std::set<dto::srr::FeatureName> getRestoredFeatures(const std::string& restoreId);
+            void addRestoredFeatures(const std::string& restoreId, const std::set<dto::srr::FeatureName>& features);
+            void remove(const std::string& restoreId);
+
+        private:
+            std::string m_path;
+            std::time_t m_maxAge;
+            std::mutex m_mutex;
+
+            std::string getJournalPath(const std::string& restoreId) const;
+            void removeExpiredJournals();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_restore_journal_test (bool verbose);
+
+#endif
@@ -39,6 +39,108 @@ typedef struct {
 
 static test_item_t
 all_tests [] = {
+#ifdef FTY_SRR_BUILD_DRAFT_API
+// Tests for stable/draft private classes:
+// Now built only with --enable-drafts, so even stable builds are hidden behind the flag
+    {
+        "fty_srr_snapshot_store",
+        NULL,
+        true,
+        false,
+        "fty_srr_snapshot_store_test"
+    },
+    {
+        "fty_srr_chunk_transfer",
+        NULL,
+        true,
+        false,
+        "fty_srr_chunk_transfer_test"
+    },
+    {
+        "fty_srr_bundle",
+        NULL,
+        true,
+        false,
+        "fty_srr_bundle_test"
+    },
+    {
+        "fty_srr_compression",
+        NULL,
+        true,
+        false,
+        "fty_srr_compression_test"
+    },
+    {
+        "fty_srr_restore_journal",
+        NULL,
+        true,
+        false,
+        "fty_srr_restore_journal_test"
+    },
+    {
+        "fty_srr_thread_pool",
+        NULL,
+        true,
+        false,
+        "fty_srr_thread_pool_test"
+    },
+    {
+        "fty_srr_worker",
+        NULL,
+        true,
+        false,
+        "fty_srr_worker_test"
+    },
+    {
+        "fty_srr_job_manager",
+        NULL,
+        true,
+        false,
+        "fty_srr_job_manager_test"
+    },
+    {
+        "fty_srr_inprocess_bus",
+        NULL,
+        true,
+        false,
+        "fty_srr_inprocess_bus_test"
+    },
+    {
+        "fty_srr_feature_source",
+        NULL,
+        true,
+        false,
+        "fty_srr_feature_source_test"
+    },
+    {
+        "fty_srr_metrics",
+        NULL,
+        true,
+        false,
+        "fty_srr_metrics_test"
+    },
+    {
+        "fty_srr_tracer",
+        NULL,
+        true,
+        false,
+        "fty_srr_tracer_test"
+    },
+    {
+        "fty_srr_flight_recorder",
+        NULL,
+        true,
+        false,
+        "fty_srr_flight_recorder_test"
+    },
+    {
+        "private_classes",
+        NULL, // Address of a function is not used for private tests
+        true,
+        false,
+        "$ALL" // Default: run all tests
+    },
+#endif // FTY_SRR_BUILD_DRAFT_API
     {NULL, NULL, 0, 0, NULL}          //  Sentinel
 };
 
@@ -0,0 +1,620 @@
+/*  =========================================================================
+    fty_srr_snapshot_store - Fty srr snapshot store
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_snapshot_store - Fty srr snapshot store
+@discuss
+@end
+ */
+
+#include <fty_srr_dto.h>
+#include <fty_common_json.h>
+#include <cxxtools/serializationinfo.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include <dirent.h>
+#include <openssl/sha.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+using namespace dto::srr;
+
+namespace srr
+{
+    static const char* OBJECTS_DIR = "/objects";
+    static const char* SNAPSHOTS_DIR = "/snapshots";
+    static const char* MANIFEST_EXTENSION = ".json";
+
+    /**
+     * Compute the SHA-256 of data
+     * @param data
+     * @return The hexadecimal digest
+     */
+    static std::string sha256(const std::string& data)
+    {
+        unsigned char digest[SHA256_DIGEST_LENGTH];
+        SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(), digest);
+        std::ostringstream text;
+        for (unsigned char byte : digest)
+        {
+            text << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(byte);
+        }
+        return text.str();
+    }
+
+    /**
+     * Create a directory if it does not exist
+     * @param path
+     */
+    static void makeDirectory(const std::string& path)
+    {
+        if (mkdir(path.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            throw SrrException("Unable to create " + path + ": " + strerror(errno));
+        }
+    }
+
+    /**
+     * Get the names of the regular files of a directory
+     * @param path
+     * @return The file names
+     */
+    static std::vector<std::string> listDirectory(const std::string& path)
+    {
+        std::vector<std::string> files;
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr)
+        {
+            throw SrrException("Unable to open " + path + ": " + strerror(errno));
+        }
+        while (struct dirent* entry = readdir(dir))
+        {
+            if (entry->d_name[0] != '.')
+            {
+                files.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        return files;
+    }
+
+    /**
+     * Write a whole file, atomically
+     * @param path
+     * @param data
+     */
+    static void writeFile(const std::string& path, const std::string& data)
+    {
+        std::string tmpPath = path + ".tmp";
+        {
+            std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+            file.write(data.data(), data.size());
+            if (!file)
+            {
+                throw SrrException("Unable to write " + tmpPath);
+            }
+        }
+        if (rename(tmpPath.c_str(), path.c_str()) != 0)
+        {
+            throw SrrException("Unable to write " + path + ": " + strerror(errno));
+        }
+    }
+
+    /**
+     * Read a whole file
+     * @param path
+     * @param data
+     * @return false if the file can't be read
+     */
+    static bool readFile(const std::string& path, std::string& data)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+        std::ostringstream content;
+        content << file.rdbuf();
+        data = content.str();
+        return true;
+    }
+
+    /**
+     * Constructor
+     * @param path Store directory, empty to keep everything in memory
+     * @param maxSnapshots
+     * @param maxAge
+     */
+    SrrSnapshotStore::SrrSnapshotStore(const std::string& path, size_t maxSnapshots, std::time_t maxAge) :
+        m_path(path), m_maxSnapshots(maxSnapshots), m_maxAge(maxAge)
+    {
+        if (isPersistent())
+        {
+            makeDirectory(m_path);
+            makeDirectory(m_path + OBJECTS_DIR);
+            makeDirectory(m_path + SNAPSHOTS_DIR);
+            load();
+        }
+    }
+
+    /**
+     * Content hash of a feature
+     * @param feature
+     * @return The hash
+     */
+    std::string SrrSnapshotStore::hash(const Feature& feature)
+    {
+        return sha256(feature.version() + '\0' + feature.data());
+    }
+
+    /**
+     * Content hash of any data
+     * @param data
+     * @return The hex SHA-256 of the data
+     */
+    std::string SrrSnapshotStore::hash(const std::string& data)
+    {
+        return sha256(data);
+    }
+
+    /**
+     * Check a content hash or a snapshot id, before it is used in a path
+     * @param hash
+     * @return True if it is a hex SHA-256: 64 lowercase hexadecimal digits
+     */
+    bool SrrSnapshotStore::isValidHash(const std::string& hash)
+    {
+        return hash.size() == 64 && hash.find_first_not_of("0123456789abcdef") == std::string::npos;
+    }
+
+    /**
+     * Serialize a manifest in json
+     * @param snapshot
+     * @return The json manifest
+     */
+    std::string SrrSnapshotStore::manifestToString(const manifest& snapshot)
+    {
+        cxxtools::SerializationInfo si;
+        si.addMember("id") <<= snapshot.id;
+        si.addMember("base") <<= snapshot.baseId;
+        si.addMember("version") <<= snapshot.version;
+        si.addMember("checksum") <<= snapshot.checksum;
+        si.addMember("timestamp") <<= std::to_string(snapshot.timestamp);
+        cxxtools::SerializationInfo& siFeatures = si.addMember("features");
+        for (const auto& feature : snapshot.featuresHash)
+        {
+            siFeatures.addMember(feature.first) <<= feature.second;
+        }
+        return JSON::writeToString(si, false);
+    }
+
+    /**
+     * Deserialize a json manifest
+     * @param data
+     * @return The manifest
+     */
+    SrrSnapshotStore::manifest SrrSnapshotStore::manifestFromString(const std::string& data)
+    {
+        manifest snapshot;
+        cxxtools::SerializationInfo si;
+        JSON::readFromString(data, si);
+        si.getMember("id") >>= snapshot.id;
+        si.getMember("base") >>= snapshot.baseId;
+        si.getMember("version") >>= snapshot.version;
+        if (const cxxtools::SerializationInfo* siChecksum = si.findMember("checksum"))
+        {
+            *siChecksum >>= snapshot.checksum;
+        }
+        if (const cxxtools::SerializationInfo* siTimestamp = si.findMember("timestamp"))
+        {
+            std::string timestamp;
+            *siTimestamp >>= timestamp;
+            snapshot.timestamp = std::stoll(timestamp);
+        }
+        for (const auto& siFeature : si.getMember("features"))
+        {
+            siFeature >>= snapshot.featuresHash[siFeature.name()];
+        }
+        // Ids and hashes name files of the store: nothing else than a hash is accepted.
+        if (!isValidHash(snapshot.id) || !(snapshot.baseId.empty() || isValidHash(snapshot.baseId)))
+        {
+            throw SrrException("Invalid snapshot id in manifest");
+        }
+        for (const auto& feature : snapshot.featuresHash)
+        {
+            if (!isValidHash(feature.second))
+            {
+                throw SrrException("Invalid content hash of " + feature.first + " in manifest");
+            }
+        }
+        return snapshot;
+    }
+
+    /**
+     * Store a feature, once by content.
+     * Must be called with the lock held.
+     * @param feature
+     * @return The feature content hash
+     */
+    std::string SrrSnapshotStore::put(const Feature& feature)
+    {
+        std::string featureHash = hash(feature);
+        if (isPersistent())
+        {
+            std::string path = objectPath(featureHash);
+            if (access(path.c_str(), F_OK) != 0)
+            {
+                std::string data;
+                feature.SerializeToString(&data);
+                writeFile(path, data);
+            }
+        }
+        else if (m_contents.find(featureHash) == m_contents.end())
+        {
+            m_contents.emplace(featureHash, feature);
+        }
+        return featureHash;
+    }
+
+    /**
+     * Get a stored feature
+     * @param featureHash
+     * @param feature
+     * @return false if the content is not stored
+     */
+    bool SrrSnapshotStore::get(const std::string& featureHash, Feature& feature)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (isPersistent())
+        {
+            std::string data;
+            return readFile(objectPath(featureHash), data) && feature.ParseFromString(data);
+        }
+        auto it = m_contents.find(featureHash);
+        if (it == m_contents.end())
+        {
+            return false;
+        }
+        feature = it->second;
+        return true;
+    }
+
+    /**
+     * Check if a content is stored
+     * @param featureHash
+     * @return false if the content is not stored, or no more
+     */
+    bool SrrSnapshotStore::contains(const std::string& featureHash)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (isPersistent())
+        {
+            return isValidHash(featureHash) && access(objectPath(featureHash).c_str(), F_OK) == 0;
+        }
+        return m_contents.find(featureHash) != m_contents.end();
+    }
+
+    /**
+     * Store the features of a save and add its snapshot
+     * @param save
+     * @param baseId Snapshot a delta is relative to, empty for a full snapshot
+     * @return The snapshot manifest
+     */
+    SrrSnapshotStore::manifest SrrSnapshotStore::addSnapshot(const SaveResponse& save, const std::string& baseId)
+    {
+        manifest snapshot;
+        snapshot.baseId = baseId;
+        snapshot.version = save.version();
+        snapshot.checksum = save.checksum();
+        snapshot.timestamp = std::time(nullptr);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // Base, version and checksum in the id too: a delta without change is not taken for its base.
+        std::string content = baseId + '\n' + snapshot.version + '\n' + snapshot.checksum + '\n';
+        for (const auto& feature : save.map_features_data())
+        {
+            std::string featureHash = put(feature.second);
+            snapshot.featuresHash[feature.first] = featureHash;
+            content += feature.first + '=' + featureHash + '\n';
+        }
+        snapshot.id = sha256(content);
+
+        // Same content as a kept snapshot: only refresh it.
+        m_snapshots.erase(std::remove_if(m_snapshots.begin(), m_snapshots.end(), [&snapshot](const manifest& kept) { return kept.id == snapshot.id; }), m_snapshots.end());
+        m_snapshots.push_back(snapshot);
+        if (isPersistent())
+        {
+            writeFile(snapshotPath(snapshot.id), manifestToString(snapshot));
+        }
+        applyRetention();
+        return snapshot;
+    }
+
+    /**
+     * Get the last snapshot
+     * @param snapshot
+     * @return false if there is no snapshot
+     */
+    bool SrrSnapshotStore::getLastSnapshot(manifest& snapshot)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_snapshots.empty())
+        {
+            return false;
+        }
+        snapshot = m_snapshots.back();
+        return true;
+    }
+
+    /**
+     * Get a snapshot
+     * @param id
+     * @param snapshot
+     * @return false if the snapshot is unknown
+     */
+    bool SrrSnapshotStore::getSnapshot(const std::string& id, manifest& snapshot)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto& kept : m_snapshots)
+        {
+            if (kept.id == id)
+            {
+                snapshot = kept;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * List all snapshots, oldest first
+     * @return The snapshots
+     */
+    std::vector<SrrSnapshotStore::manifest> SrrSnapshotStore::listSnapshots()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return std::vector<manifest>(m_snapshots.begin(), m_snapshots.end());
+    }
+
+    /**
+     * Delete a snapshot and the contents no more referenced
+     * @param id
+     * @return false if the snapshot is unknown
+     */
+    bool SrrSnapshotStore::deleteSnapshot(const std::string& id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(m_snapshots.begin(), m_snapshots.end(), [&id](const manifest& kept) { return kept.id == id; });
+        if (it == m_snapshots.end())
+        {
+            return false;
+        }
+        m_snapshots.erase(it);
+        if (isPersistent())
+        {
+            unlink(snapshotPath(id).c_str());
+        }
+        collectGarbage();
+        return true;
+    }
+
+    std::string SrrSnapshotStore::objectPath(const std::string& featureHash) const
+    {
+        if (!isValidHash(featureHash))
+        {
+            throw SrrException("Invalid content hash " + featureHash);
+        }
+        return m_path + OBJECTS_DIR + "/" + featureHash;
+    }
+
+    std::string SrrSnapshotStore::snapshotPath(const std::string& id) const
+    {
+        if (!isValidHash(id))
+        {
+            throw SrrException("Invalid snapshot id " + id);
+        }
+        return m_path + SNAPSHOTS_DIR + "/" + id + MANIFEST_EXTENSION;
+    }
+
+    /**
+     * Load the snapshots stored on disk
+     */
+    void SrrSnapshotStore::load()
+    {
+        for (const auto& file : listDirectory(m_path + SNAPSHOTS_DIR))
+        {
+            std::string data;
+            std::string path = m_path + SNAPSHOTS_DIR + "/" + file;
+            try
+            {
+                if (readFile(path, data))
+                {
+                    m_snapshots.push_back(manifestFromString(data));
+                }
+            }
+            catch (std::exception& ex)
+            {
+                log_warning("Ignore invalid snapshot %s: %s", path.c_str(), ex.what());
+            }
+        }
+        std::sort(m_snapshots.begin(), m_snapshots.end(), [](const manifest& a, const manifest& b) { return a.timestamp < b.timestamp; });
+        log_debug("%zu snapshots loaded from %s", m_snapshots.size(), m_path.c_str());
+        applyRetention();
+    }
+
+    /**
+     * Forget the oldest snapshots, by count and by age.
+     * Must be called with the lock held.
+     */
+    void SrrSnapshotStore::applyRetention()
+    {
+        std::time_t now = std::time(nullptr);
+        bool removed = false;
+        while (!m_snapshots.empty() && (m_snapshots.size() > m_maxSnapshots || (m_maxAge > 0 && now - m_snapshots.front().timestamp > m_maxAge)))
+        {
+            if (isPersistent())
+            {
+                unlink(snapshotPath(m_snapshots.front().id).c_str());
+            }
+            m_snapshots.pop_front();
+            removed = true;
+        }
+        if (removed)
+        {
+            collectGarbage();
+        }
+    }
+
+    /**
+     * Remove the contents no more referenced by a snapshot.
+     * Must be called with the lock held.
+     */
+    void SrrSnapshotStore::collectGarbage()
+    {
+        std::set<std::string> referenced;
+        for (const auto& snapshot : m_snapshots)
+        {
+            for (const auto& feature : snapshot.featuresHash)
+            {
+                referenced.insert(feature.second);
+            }
+        }
+        if (isPersistent())
+        {
+            for (const auto& file : listDirectory(m_path + OBJECTS_DIR))
+            {
+                if (referenced.count(file) == 0)
+                {
+                    unlink((m_path + OBJECTS_DIR + "/" + file).c_str());
+                }
+            }
+        }
+        else
+        {
+            for (auto it = m_contents.begin(); it != m_contents.end();)
+            {
+                it = (referenced.count(it->first) == 0) ? m_contents.erase(it) : std::next(it);
+            }
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_snapshot_store_test (bool verbose)
+{
+    printf (" * fty_srr_snapshot_store: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    // SHA-256 known answers (FIPS 180-2)
+    assert (SrrSnapshotStore::hash ("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    assert (SrrSnapshotStore::hash ("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    assert (SrrSnapshotStore::hash ("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") == "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+    assert (SrrSnapshotStore::hash (std::string (1000000, 'a')) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    // Only hashes can name a file of the store
+    assert (SrrSnapshotStore::isValidHash ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"));
+    assert (!SrrSnapshotStore::isValidHash ("E3B0C44298FC1C149AFBF4C8996FB92427AE41E4649B934CA495991B7852B855"));
+    assert (!SrrSnapshotStore::isValidHash ("../../../../../../../../../../../../../../../../../etc/passwd"));
+    assert (!SrrSnapshotStore::isValidHash (""));
+    bool rejected = false;
+    try {
+        SrrSnapshotStore::manifestFromString ("{\"id\":\"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855\",\"base\":\"\",\"version\":\"1.0\",\"features\":{\"f\":\"../../etc/passwd\"}}");
+    }
+    catch (const SrrException&) {
+        rejected = true;
+    }
+    assert (rejected);
+
+    // Same content: same snapshot, but a delta without change is a snapshot of its own
+    {
+        SrrSnapshotStore store ("", 8, 0);
+        dto::srr::SaveResponse save;
+        save.set_version ("1.0");
+        save.set_checksum ("checksum");
+        (*save.mutable_map_features_data ())["feature1"].set_data ("payload");
+        SrrSnapshotStore::manifest base = store.addSnapshot (save, "");
+        assert (store.addSnapshot (save, "").id == base.id);
+        assert (store.listSnapshots ().size () == 1);
+        SrrSnapshotStore::manifest delta = store.addSnapshot (save, base.id);
+        assert (delta.id != base.id);
+        assert (delta.baseId == base.id);
+        assert (store.listSnapshots ().size () == 2);
+        SrrSnapshotStore::manifest kept;
+        assert (store.getSnapshot (base.id, kept) && kept.baseId.empty ());
+        // Nor a save with another passphrase
+        save.set_checksum ("other checksum");
+        assert (store.addSnapshot (save, "").id != base.id);
+    }
+
+    // Persistent store: contents stored once, read back, removed with their last snapshot
+    {
+        std::string path = std::string (SELFTEST_DIR_RW) + "/snapshots";
+        std::string id;
+        {
+            SrrSnapshotStore store (path, 8, 0);
+            dto::srr::SaveResponse save;
+            save.set_version ("1.0");
+            dto::srr::Feature feature;
+            feature.set_version ("1.0");
+            feature.set_data ("payload");
+            (*save.mutable_map_features_data ())["feature1"] = feature;
+            (*save.mutable_map_features_data ())["feature2"] = feature;
+            SrrSnapshotStore::manifest snapshot = store.addSnapshot (save, "");
+            id = snapshot.id;
+            assert (snapshot.featuresHash.at ("feature1") == snapshot.featuresHash.at ("feature2"));
+        }
+        // Reloaded from disk
+        SrrSnapshotStore store (path, 8, 0);
+        SrrSnapshotStore::manifest snapshot;
+        assert (store.getSnapshot (id, snapshot));
+        assert (SrrSnapshotStore::manifestFromString (SrrSnapshotStore::manifestToString (snapshot)).featuresHash == snapshot.featuresHash);
+        dto::srr::Feature feature;
+        assert (store.get (snapshot.featuresHash.at ("feature1"), feature));
+        assert (feature.data () == "payload");
+        assert (store.deleteSnapshot (id));
+        assert (!store.get (snapshot.featuresHash.at ("feature1"), feature));
+        rmdir ((path + OBJECTS_DIR).c_str ());
+        rmdir ((path + SNAPSHOTS_DIR).c_str ());
+        rmdir (path.c_str ());
+    }
+    //  @end
+
+    printf ("OK\n");
+}
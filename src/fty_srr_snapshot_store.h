@@ -0,0 +1,95 @@
+/*  =========================================================================
+    fty_srr_snapshot_store - Fty srr snapshot store
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_SNAPSHOT_STORE_H_INCLUDED
+#define FTY_SRR_SNAPSHOT_STORE_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <ctime>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace srr
+{
+    /**
+     * \brief Feature payloads stored once by content hash, and snapshots made of feature hashes.
+     * Kept in memory, or on disk when a path is given.
+     */
+    class SrrSnapshotStore
+    {
+        public:
+
+            struct manifest {
+                std::string id;
+                // Snapshot the delta is relative to, empty for a full snapshot.
+                std::string baseId;
+                std::string version;
+                std::string checksum;
+                std::time_t timestamp = 0;
+                // Feature -> Content hash
+                std::map<std::string, std::string> featuresHash;
+            };
+
+            // maxAge in seconds, 0 to keep snapshots whatever their age.
+            SrrSnapshotStore(const std::string& path, size_t maxSnapshots, std::time_t maxAge);
+            ~SrrSnapshotStore() = default;
+
+            static std::string hash(const dto::srr::Feature& feature);
+            static std::string hash(const std::string& data);
+            static std::string manifestToString(const manifest& snapshot);
+            static manifest manifestFromString(const std::string& data);
+            static bool isValidHash(const std::string& hash);
+
+            bool isPersistent() const { return !m_path.empty(); }
+            bool contains(const std::string& featureHash);
+            bool get(const std::string& featureHash, dto::srr::Feature& feature);
+            manifest addSnapshot(const dto::srr::SaveResponse& save, const std::string& baseId);
+            bool getLastSnapshot(manifest& snapshot);
+            bool getSnapshot(const std::string& id, manifest& snapshot);
+            std::vector<manifest> listSnapshots();
+            bool deleteSnapshot(const std::string& id);
+
+        private:
+            std::string m_path;
+            size_t m_maxSnapshots;
+            std::time_t m_maxAge;
+            std::mutex m_mutex;
+            // Content hash -> Feature, when not persistent
+            std::map<std::string, dto::srr::Feature> m_contents;
+            // Kept snapshots, oldest first.
+            std::deque<manifest> m_snapshots;
+
+            std::string put(const dto::srr::Feature& feature);
+            std::string objectPath(const std::string& featureHash) const;
+            std::string snapshotPath(const std::string& id) const;
+            void load();
+            void applyRetention();
+            void collectGarbage();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_snapshot_store_test (bool verbose);
+
+#endif
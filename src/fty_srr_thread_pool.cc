@@ -0,0 +1,182 @@
+/*  =========================================================================
+    fty_srr_thread_pool - Fty srr thread pool
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_thread_pool - Fty srr thread pool
+@discuss
+@end
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <future>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    /**
+     * Constructor
+     * @param threadCount
+     */
+    SrrThreadPool::SrrThreadPool(size_t threadCount) :
+        m_stopped(false)
+    {
+        for (size_t i = 0; i < std::max(threadCount, size_t(1)); i++)
+        {
+            m_threads.emplace_back(&SrrThreadPool::run, this);
+        }
+    }
+
+    /**
+     * Destructor
+     */
+    SrrThreadPool::~SrrThreadPool()
+    {
+        stop();
+    }
+
+    /**
+     * Queue a task
+     * @param task
+     */
+    void SrrThreadPool::push(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_tasksMutex);
+            if (m_stopped)
+            {
+                log_warning("Thread pool stopped, task dropped");
+                return;
+            }
+            m_tasks.push_back(std::move(task));
+        }
+        m_tasksCv.notify_one();
+    }
+
+    /**
+     * Stop all threads, wait the running tasks and drop the queued ones.
+     */
+    void SrrThreadPool::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_tasksMutex);
+            if (m_stopped)
+            {
+                return;
+            }
+            m_stopped = true;
+            m_tasks.clear();
+        }
+        m_tasksCv.notify_all();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    /**
+     * Thread loop
+     */
+    void SrrThreadPool::run()
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_tasksMutex);
+                m_tasksCv.wait(lock, [this] { return m_stopped || !m_tasks.empty(); });
+                if (m_stopped)
+                {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            try
+            {
+                task();
+            }
+            catch (std::exception& ex)
+            {
+                log_error("Task failed: %s", ex.what());
+            }
+        }
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_thread_pool_test (bool verbose)
+{
+    printf (" * fty_srr_thread_pool: ");
+
+    //  @selftest
+    using namespace srr;
+
+    // Every task run, a failed one does not stop its thread.
+    {
+        SrrThreadPool pool (2);
+        std::mutex mutex;
+        std::condition_variable cv;
+        unsigned count = 0;
+        pool.push ([] { throw SrrException ("Task failure"); });
+        for (unsigned i = 0; i < 10; i++) {
+            pool.push ([&] {
+                std::lock_guard<std::mutex> lock (mutex);
+                count++;
+                cv.notify_one ();
+            });
+        }
+        std::unique_lock<std::mutex> lock (mutex);
+        assert (cv.wait_for (lock, std::chrono::seconds (10), [&] { return count == 10; }));
+    }
+
+    // Stop waits for the running task and drops the queued ones.
+    {
+        SrrThreadPool pool (1);
+        std::promise<void> started;
+        std::atomic<bool> running (false);
+        std::atomic<bool> queuedRun (false);
+        pool.push ([&] {
+            running = true;
+            started.set_value ();
+            std::this_thread::sleep_for (std::chrono::milliseconds (100));
+            running = false;
+        });
+        pool.push ([&] { queuedRun = true; });
+        started.get_future ().wait ();
+        pool.stop ();
+        assert (!running);
+        assert (!queuedRun);
+        // Stopped for good
+        pool.push ([&] { queuedRun = true; });
+        pool.stop ();
+        assert (!queuedRun);
+    }
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,60 @@
+/*  =========================================================================
+    fty_srr_thread_pool - Fty srr thread pool
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_THREAD_POOL_H_INCLUDED
+#define FTY_SRR_THREAD_POOL_H_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace srr
+{
+    /**
+     * \brief Fixed number of threads running queued tasks in order.
+     */
+    class SrrThreadPool
+    {
+        public:
+            explicit SrrThreadPool(size_t threadCount);
+            ~SrrThreadPool();
+
+            void push(std::function<void()> task);
+            void stop();
+
+        private:
+            std::vector<std::thread> m_threads;
+            std::deque<std::function<void()>> m_tasks;
+            std::mutex m_tasksMutex;
+            std::condition_variable m_tasksCv;
+            bool m_stopped;
+
+            void run();
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_thread_pool_test (bool verbose);
+
+#endif
@@ -0,0 +1,385 @@
+/*  =========================================================================
+    fty_srr_tracer - Fty srr request tracing
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+ */
+
+/*
+@header
+    fty_srr_tracer - Fty srr request tracing
+@discuss
+@end
+ */
+
+#include <fty_common_json.h>
+#include <cxxtools/serializationinfo.h>
+
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "fty_srr_classes.h"
+
+namespace srr
+{
+    // Trace id and span id sizes, in hexadecimal digits.
+    static const size_t TRACE_ID_SIZE = 32;
+    static const size_t SPAN_ID_SIZE = 16;
+
+    // Innermost open span of the thread.
+    static thread_local SrrTracer::SpanContext t_currentContext;
+
+    /**
+     * Generate a random id
+     * @param size Number of hexadecimal digits
+     * @return The id
+     */
+    static std::string generateId(size_t size)
+    {
+        static thread_local std::mt19937_64 generator(std::random_device{}());
+        static const char digits[] = "0123456789abcdef";
+        std::string id;
+        while (id.size() < size)
+        {
+            uint64_t value = generator();
+            for (unsigned i = 0; i < 16 && id.size() < size; i++)
+            {
+                id += digits[(value >> (i * 4)) & 0xf];
+            }
+        }
+        return id;
+    }
+
+    /**
+     * Check an id of the traceparent meta data
+     * @param id
+     * @param size Expected number of hexadecimal digits
+     * @return True if it is valid
+     */
+    static bool isValidId(const std::string& id, size_t size)
+    {
+        return id.size() == size
+            && id.find_first_not_of("0123456789abcdef") == std::string::npos
+            && id.find_first_not_of('0') != std::string::npos;
+    }
+
+    /**
+     * Constructor
+     * @param path File where to append the spans, empty to disable
+     */
+    SrrTracer::SrrTracer(const std::string& path) :
+        m_path(path)
+    {
+        if (m_path.empty())
+        {
+            return;
+        }
+        m_file.open(m_path, std::ios::app);
+        if (!m_file)
+        {
+            throw SrrException("Trace file " + m_path + " not opened");
+        }
+        // Chrome trace array format, the closing bracket is optional.
+        if (m_file.tellp() == 0)
+        {
+            m_file << "[\n";
+        }
+    }
+
+    bool SrrTracer::isEnabled() const
+    {
+        return !m_path.empty();
+    }
+
+    /**
+     * Record a span already ended
+     * @param name
+     * @param parent
+     * @param start
+     * @param end
+     * @param attributes
+     */
+    void SrrTracer::recordSpan(const std::string& name, const SpanContext& parent, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const Attributes& attributes)
+    {
+        if (isEnabled())
+        {
+            SpanContext context = {parent.isValid() ? parent.traceId : generateId(TRACE_ID_SIZE), generateId(SPAN_ID_SIZE)};
+            write(name, parent, context, start, end, attributes);
+        }
+    }
+
+    /**
+     * Write a span as a complete Chrome trace event
+     * @param name
+     * @param parent
+     * @param context
+     * @param start
+     * @param end
+     * @param attributes
+     */
+    void SrrTracer::write(const std::string& name, const SpanContext& parent, const SpanContext& context, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const Attributes& attributes)
+    {
+        // Wall clock start, to line up with the spans of the agents.
+        auto wallStart = std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - start);
+        cxxtools::SerializationInfo si;
+        si.addMember("name") <<= name;
+        si.addMember("cat") <<= std::string("srr");
+        si.addMember("ph") <<= std::string("X");
+        si.addMember("ts") <<= static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(wallStart.time_since_epoch()).count());
+        si.addMember("dur") <<= static_cast<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+        si.addMember("pid") <<= static_cast<int64_t>(getpid());
+        si.addMember("tid") <<= static_cast<int64_t>(syscall(SYS_gettid));
+        cxxtools::SerializationInfo& siArgs = si.addMember("args");
+        siArgs.addMember("traceId") <<= context.traceId;
+        siArgs.addMember("spanId") <<= context.spanId;
+        siArgs.addMember("parentSpanId") <<= parent.spanId;
+        for (const auto& attribute : attributes)
+        {
+            siArgs.addMember(attribute.first) <<= attribute.second;
+        }
+        std::string event = JSON::writeToString(si, false);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_file << event << ",\n";
+        m_file.flush();
+    }
+
+    /**
+     * Get the innermost open span of this thread
+     * @return Its context, not valid if none
+     */
+    SrrTracer::SpanContext SrrTracer::getCurrentContext()
+    {
+        return t_currentContext;
+    }
+
+    /**
+     * Get the trace context of a message
+     * @param msg
+     * @return The context of the sending span, not valid if none or malformed
+     */
+    SrrTracer::SpanContext SrrTracer::extract(const messagebus::Message& msg)
+    {
+        SpanContext context;
+        auto traceparent = msg.metaData().find(TRACEPARENT_META);
+        // version-traceid-spanid-flags
+        if (traceparent == msg.metaData().end() || traceparent->second.size() != 2 + 1 + TRACE_ID_SIZE + 1 + SPAN_ID_SIZE + 1 + 2)
+        {
+            return context;
+        }
+        std::string traceId = traceparent->second.substr(3, TRACE_ID_SIZE);
+        std::string spanId = traceparent->second.substr(3 + TRACE_ID_SIZE + 1, SPAN_ID_SIZE);
+        if (isValidId(traceId, TRACE_ID_SIZE) && isValidId(spanId, SPAN_ID_SIZE))
+        {
+            context.traceId = traceId;
+            context.spanId = spanId;
+        }
+        return context;
+    }
+
+    /**
+     * Set the trace context of a message to the current span, if any
+     * @param msg
+     */
+    void SrrTracer::inject(messagebus::Message& msg)
+    {
+        if (t_currentContext.isValid())
+        {
+            msg.metaData()[TRACEPARENT_META] = "00-" + t_currentContext.traceId + "-" + t_currentContext.spanId + "-01";
+        }
+    }
+
+    /**
+     * Constructor: start a child of the current span
+     * @param tracer
+     * @param name
+     */
+    SrrTracer::Span::Span(SrrTracer& tracer, const std::string& name) :
+        Span(tracer, name, t_currentContext)
+    {
+    }
+
+    /**
+     * Constructor: start a span, it becomes the current one
+     * @param tracer
+     * @param name
+     * @param parent
+     * @param start
+     */
+    SrrTracer::Span::Span(SrrTracer& tracer, const std::string& name, const SpanContext& parent, std::chrono::steady_clock::time_point start) :
+        m_tracer(tracer), m_name(name), m_parent(parent), m_previous(t_currentContext), m_start(start), m_ended(false)
+    {
+        m_context.traceId = m_parent.isValid() ? m_parent.traceId : generateId(TRACE_ID_SIZE);
+        m_context.spanId = generateId(SPAN_ID_SIZE);
+        t_currentContext = m_context;
+    }
+
+    SrrTracer::Span::~Span()
+    {
+        end();
+    }
+
+    const SrrTracer::SpanContext& SrrTracer::Span::getContext() const
+    {
+        return m_context;
+    }
+
+    void SrrTracer::Span::setAttribute(const std::string& key, const std::string& value)
+    {
+        m_attributes[key] = value;
+    }
+
+    /**
+     * End the span, written once
+     */
+    void SrrTracer::Span::end()
+    {
+        if (m_ended)
+        {
+            return;
+        }
+        m_ended = true;
+        t_currentContext = m_previous;
+        if (m_tracer.isEnabled())
+        {
+            try
+            {
+                m_tracer.write(m_name, m_parent, m_context, m_start, std::chrono::steady_clock::now(), m_attributes);
+            }
+            catch (const std::exception& e)
+            {
+                log_error("Span %s not written: %s", m_name.c_str(), e.what());
+            }
+        }
+    }
+
+    /**
+     * Constructor: make a span current
+     * @param context
+     */
+    SrrTracer::Scope::Scope(const SpanContext& context) :
+        m_previous(t_currentContext)
+    {
+        t_currentContext = context;
+    }
+
+    SrrTracer::Scope::~Scope()
+    {
+        t_currentContext = m_previous;
+    }
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+void
+fty_srr_tracer_test (bool verbose)
+{
+    printf (" * fty_srr_tracer: ");
+
+    //  @selftest
+    //  Note: If your selftest reads SCMed fixture data, please keep it in
+    //  src/selftest-ro; if your test creates filesystem objects, please
+    //  do so under src/selftest-rw.
+    const char *SELFTEST_DIR_RW = "src/selftest-rw";
+    using namespace srr;
+    mkdir (SELFTEST_DIR_RW, 0755);
+
+    // Ids
+    std::string id = generateId (TRACE_ID_SIZE);
+    assert (isValidId (id, TRACE_ID_SIZE));
+    assert (id != generateId (TRACE_ID_SIZE));
+    assert (!isValidId (std::string (SPAN_ID_SIZE, '0'), SPAN_ID_SIZE));
+    assert (!isValidId ("0123456789ABCDEF", SPAN_ID_SIZE));
+    assert (!isValidId ("0123456789abcdef", TRACE_ID_SIZE));
+
+    // Nested spans: the innermost one is current, its parent again once it ends.
+    SrrTracer disabled ("");
+    assert (!disabled.isEnabled ());
+    assert (!SrrTracer::getCurrentContext ().isValid ());
+    {
+        SrrTracer::Span root (disabled, "root");
+        assert (root.getContext ().isValid ());
+        assert (SrrTracer::getCurrentContext ().spanId == root.getContext ().spanId);
+        {
+            SrrTracer::Span child (disabled, "child");
+            assert (child.getContext ().traceId == root.getContext ().traceId);
+            assert (child.getContext ().spanId != root.getContext ().spanId);
+            assert (SrrTracer::getCurrentContext ().spanId == child.getContext ().spanId);
+            child.end ();
+            assert (SrrTracer::getCurrentContext ().spanId == root.getContext ().spanId);
+        }
+
+        // The context travels in the messages, the span which sends one is its parent.
+        messagebus::Message msg;
+        SrrTracer::inject (msg);
+        assert (msg.metaData ()[TRACEPARENT_META] == "00-" + root.getContext ().traceId + "-" + root.getContext ().spanId + "-01");
+        SrrTracer::SpanContext context = SrrTracer::extract (msg);
+        assert (context.traceId == root.getContext ().traceId);
+        assert (context.spanId == root.getContext ().spanId);
+
+        // Another thread takes it with a scope.
+        std::thread ([&] {
+            assert (!SrrTracer::getCurrentContext ().isValid ());
+            SrrTracer::Scope scope (context);
+            SrrTracer::Span task (disabled, "task");
+            assert (task.getContext ().traceId == root.getContext ().traceId);
+        }).join ();
+    }
+    assert (!SrrTracer::getCurrentContext ().isValid ());
+
+    // Without a span or with a malformed one, no context.
+    {
+        messagebus::Message msg;
+        SrrTracer::inject (msg);
+        assert (msg.metaData ().find (TRACEPARENT_META) == msg.metaData ().end ());
+        assert (!SrrTracer::extract (msg).isValid ());
+        msg.metaData ()[TRACEPARENT_META] = "00-" + std::string (TRACE_ID_SIZE, 'x') + "-" + generateId (SPAN_ID_SIZE) + "-01";
+        assert (!SrrTracer::extract (msg).isValid ());
+        msg.metaData ()[TRACEPARENT_META] = "00-" + generateId (TRACE_ID_SIZE) + "-" + generateId (SPAN_ID_SIZE);
+        assert (!SrrTracer::extract (msg).isValid ());
+    }
+
+    // The spans are appended to the trace file, one by line.
+    std::string path = std::string (SELFTEST_DIR_RW) + "/trace";
+    for (int i = 0; i < 2; i++) {
+        SrrTracer tracer (path);
+        assert (tracer.isEnabled ());
+        SrrTracer::Span span (tracer, "span");
+        span.setAttribute ("feature", "feature1");
+        tracer.recordSpan ("recorded", span.getContext (), std::chrono::steady_clock::now (), std::chrono::steady_clock::now ());
+    }
+    {
+        std::ifstream file (path);
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline (file, line)) {
+            lines.push_back (line);
+        }
+        assert (lines.size () == 5);
+        assert (lines[0] == "[");
+    }
+    unlink (path.c_str ());
+    //  @end
+
+    printf ("OK\n");
+}
@@ -0,0 +1,122 @@
+/*  =========================================================================
+    fty_srr_tracer - Fty srr request tracing
+
+    Copyright (C) 2014 - 2018 Eaton
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    =========================================================================
+*/
+
+#ifndef FTY_SRR_TRACER_H_INCLUDED
+#define FTY_SRR_TRACER_H_INCLUDED
+
+#include <fty_common_messagebus.h>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace srr
+{
+    /**
+     * \brief Spans of the requests, linked across fty-srr and its agents.
+     *
+     * The trace context travels in the traceparent meta data (W3C format):
+     * a request which has one continues its trace, each request to an agent
+     * carries the span which sends it. In a thread, the innermost open span is
+     * the parent of the next one; tasks run on other threads take it with a Scope.
+     * When a file is set, the ended spans are appended to it as Chrome trace
+     * events, to be opened in chrome://tracing or Perfetto.
+     */
+    class SrrTracer
+    {
+        public:
+            struct SpanContext {
+                std::string traceId;
+                std::string spanId;
+                bool isValid() const { return !traceId.empty(); }
+            };
+            using Attributes = std::map<std::string, std::string>;
+
+            explicit SrrTracer(const std::string& path);
+            ~SrrTracer() = default;
+
+            bool isEnabled() const;
+            void recordSpan(const std::string& name, const SpanContext& parent, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const Attributes& attributes = {});
+
+            static SpanContext getCurrentContext();
+            static SpanContext extract(const messagebus::Message& msg);
+            static void inject(messagebus::Message& msg);
+
+            /**
+             * \brief Operation timed from its creation to its end, current in its thread meanwhile.
+             */
+            class Span
+            {
+                public:
+                    // Child of the current span, if any.
+                    Span(SrrTracer& tracer, const std::string& name);
+                    // Child of the given span, new trace when it is not valid.
+                    Span(SrrTracer& tracer, const std::string& name, const SpanContext& parent, std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now());
+                    ~Span();
+                    Span(const Span&) = delete;
+                    Span& operator=(const Span&) = delete;
+
+                    const SpanContext& getContext() const;
+                    void setAttribute(const std::string& key, const std::string& value);
+                    void end();
+
+                private:
+                    SrrTracer& m_tracer;
+                    std::string m_name;
+                    SpanContext m_parent;
+                    SpanContext m_context;
+                    // Current span when this one was created, current again at its end.
+                    SpanContext m_previous;
+                    std::chrono::steady_clock::time_point m_start;
+                    Attributes m_attributes;
+                    bool m_ended;
+            };
+
+            /**
+             * \brief Make a span current in this thread, for a task started by another one.
+             */
+            class Scope
+            {
+                public:
+                    explicit Scope(const SpanContext& context);
+                    ~Scope();
+                    Scope(const Scope&) = delete;
+                    Scope& operator=(const Scope&) = delete;
+
+                private:
+                    SpanContext m_previous;
+            };
+
+        private:
+            std::string m_path;
+            std::ofstream m_file;
+            std::mutex m_mutex;
+
+            void write(const std::string& name, const SpanContext& parent, const SpanContext& context, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end, const Attributes& attributes);
+    };
+} // namespace srr
+
+//  Self test of this class
+void fty_srr_tracer_test (bool verbose);
+
+#endif
@@ -29,12 +29,88 @@
 #include <fty_srr_dto.h>
 #include <fty_lib_certificate_library.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <fstream>
+#include <future>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "fty_srr_classes.h"
 
 using namespace dto::srr;
 
 namespace srr
 {    
+    // An agent silent for longer than that is probed before the next request.
+    static const std::chrono::seconds AGENT_PROBE_INTERVAL(30);
+    // Delay between two tries to capture the factory settings, and number of tries.
+    static const std::chrono::seconds FACTORY_CAPTURE_INTERVAL(60);
+    static const unsigned FACTORY_CAPTURE_MAX_TRIES = 30;
+    // Upper bound of the delay between two tries of a request.
+    static const std::chrono::milliseconds MAX_RETRY_DELAY(10000);
+    
+    /**
+     * Report the progress of a set of features, if someone listens to it.
+     * @param progress
+     * @param features
+     * @param state
+     */
+    static void reportProgress(const SrrWorker::ProgressCallback& progress, const std::set<FeatureName>& features, SrrWorker::FeatureProgress state)
+    {
+        if (progress)
+        {
+            for (const auto& feature : features)
+            {
+                progress(feature, state);
+            }
+        }
+    }
+    
+    /**
+     * Set the global status of an operation from its failed features
+     * @param status
+     * @param failures Failed feature -> error
+     * @param featureCount Number of features in the operation
+     */
+    static void setOperationStatus(FeatureStatus& status, const std::map<FeatureName, std::string>& failures, size_t featureCount)
+    {
+        if (failures.empty())
+        {
+            status.set_status(Status::SUCCESS);
+            return;
+        }
+        status.set_status(failures.size() < featureCount ? Status::PARTIAL_SUCCESS : Status::FAILED);
+        std::string errors;
+        for (const auto& failure : failures)
+        {
+            errors += (errors.empty() ? "" : ", ") + failure.first + " (" + failure.second + ")";
+        }
+        status.set_error(TRANSLATE_ME("Failed features: %s", errors.c_str()));
+    }
+
+    /**
+     * Get the flight recorder status of a feature or an operation
+     * @param status
+     * @return The status
+     */
+    static SrrFlightRecorder::Status getRecorderStatus(Status status)
+    {
+        switch (status)
+        {
+            case Status::SUCCESS:
+                return SrrFlightRecorder::Status::SUCCESS;
+            case Status::PARTIAL_SUCCESS:
+                return SrrFlightRecorder::Status::PARTIAL_SUCCESS;
+            default:
+                return SrrFlightRecorder::Status::FAILED;
+        }
+    }
+    
     /**
      * Constructor
      * @param msgBus
@@ -46,6 +122,26 @@ namespace srr
         init();
     }
     
+    /**
+     * Destructor: stop the background threads.
+     */
+    SrrWorker::~SrrWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_healthMutex);
+            m_stopped = true;
+        }
+        m_stopCv.notify_all();
+        if (m_healthThread.joinable())
+        {
+            m_healthThread.join();
+        }
+        if (m_factoryThread.joinable())
+        {
+            m_factoryThread.join();
+        }
+    }
+    
     /**
      * Init srr worker
      */
@@ -55,18 +151,75 @@ namespace srr
         {
             // Build map associations.
             buildMapAssociation();
+            // Check and order feature dependencies.
+            buildFeaturesLevel();
             // Srr version
             m_srrVersion = m_parameters.at(SRR_VERSION_KEY);
+            // Feature list only depends on the features and the version.
+            buildFeatureListCache();
+            // Snapshot store, on disk when a path is set.
+            m_snapshotStore = std::unique_ptr<SrrSnapshotStore>(new SrrSnapshotStore(
+                getParameter(SNAPSHOT_PATH_KEY, ""),
+                std::stoul(getParameter(SNAPSHOT_MAX_COUNT_KEY, DEFAULT_SNAPSHOT_MAX_COUNT)),
+                std::stol(getParameter(SNAPSHOT_MAX_AGE_KEY, "0")) * 3600));
+            // Payload compression with the agents.
+            m_compression = std::unique_ptr<SrrCompression>(new SrrCompression(
+                getParameter(COMPRESSION_KEY, DEFAULT_COMPRESSION),
+                std::stoi(getParameter(COMPRESSION_LEVEL_KEY, DEFAULT_COMPRESSION_LEVEL)),
+                std::stoul(getParameter(COMPRESSION_MIN_SIZE_KEY, DEFAULT_COMPRESSION_MIN_SIZE))));
+            // Chunked transfer with the agents.
+            m_chunkTransfer = std::unique_ptr<SrrChunkTransfer>(new SrrChunkTransfer(
+                std::stoul(getParameter(CHUNK_SIZE_KEY, DEFAULT_CHUNK_SIZE)),
+                std::stoul(getParameter(MAX_TRANSFER_SIZE_KEY, DEFAULT_MAX_TRANSFER_SIZE))));
+            // Features applied by the unfinished restores.
+            m_restoreJournal = std::unique_ptr<SrrRestoreJournal>(new SrrRestoreJournal(
+                getParameter(RESTORE_JOURNAL_PATH_KEY, DEFAULT_RESTORE_JOURNAL_PATH),
+                std::stol(getParameter(RESTORE_JOURNAL_MAX_AGE_KEY, DEFAULT_RESTORE_JOURNAL_MAX_AGE)) * 3600));
+            // Runtime metrics, also written in a file when a path is set.
+            m_metrics = std::unique_ptr<SrrMetrics>(new SrrMetrics(
+                getParameter(METRICS_FILE_KEY, ""),
+                std::stoul(getParameter(METRICS_DUMP_INTERVAL_KEY, DEFAULT_METRICS_DUMP_INTERVAL))));
+            // Request spans, written in a file when a path is set.
+            m_tracer = std::unique_ptr<SrrTracer>(new SrrTracer(getParameter(TRACE_FILE_KEY, "")));
+            // Last events of the operations, always kept.
+            m_flightRecorder = std::unique_ptr<SrrFlightRecorder>(new SrrFlightRecorder(std::stoul(getParameter(FLIGHT_RECORDER_SIZE_KEY, DEFAULT_FLIGHT_RECORDER_SIZE))));
+            // Agent health, probed in background when enabled.
+            m_stopped = false;
+            if (std::stol(getParameter(HEALTH_CHECK_INTERVAL_KEY, DEFAULT_HEALTH_CHECK_INTERVAL)) > 0)
+            {
+                m_healthThread = std::thread(&SrrWorker::checkAgentsHealth, this);
+            }
+            // Factory settings, captured once to be able to reset the features.
+            if (!getParameter(FACTORY_BUNDLE_PATH_KEY, DEFAULT_FACTORY_BUNDLE_PATH).empty())
+            {
+                m_factoryThread = std::thread(&SrrWorker::captureFactorySettings, this);
+            }
         }        
         catch (messagebus::MessageBusException& ex)
         {
             throw SrrException(ex.what());
+        }
+        catch (SrrException&)
+        {
+            throw;
         } catch (...)
         {
             throw SrrException("Unexpected error: unknown");
         }
     }
     
+    /**
+     * Get an optional parameter
+     * @param key
+     * @param defaultValue
+     * @return The parameter value, or the default one if not set
+     */
+    std::string SrrWorker::getParameter(const std::string& key, const std::string& defaultValue) const
+    {
+        auto parameter = m_parameters.find(key);
+        return (parameter != m_parameters.end()) ? parameter->second : defaultValue;
+    }
+    
     /**
      * Set all associations
      */
@@ -81,7 +234,7 @@ namespace srr
         m_featuresToAgent [MASS_MANAGEMENT] = {CONFIG_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + MASS_MANAGEMENT).c_str())};
         m_featuresToAgent [NETWORK] = {CONFIG_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + NETWORK).c_str())};
         // Feature -> Agent (etn-malamute-translator EMC4J)
-        m_featuresToAgent [AUTOMATIONS] = {EMC4J_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + AUTOMATIONS).c_str())};
+        m_featuresToAgent [AUTOMATIONS] = {EMC4J_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + AUTOMATIONS).c_str()), {AUTOMATION_SETTINGS, VIRTUAL_ASSETS}};
         m_featuresToAgent [VIRTUAL_ASSETS] = {EMC4J_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + VIRTUAL_ASSETS).c_str())};
         // Feature -> Agent (security-wallet)
         m_featuresToAgent [SECURITY_WALLET] = {SECU_WALLET_AGENT_NAME, TRANSLATE_ME((std::string(SRR_PREFIX_TRANSLATE_KEY) + SECURITY_WALLET).c_str())};
@@ -90,6 +243,53 @@ namespace srr
         m_agentToQueue [EMC4J_AGENT_NAME] = EMC4J_MSG_QUEUE_NAME;
         m_agentToQueue [SECU_WALLET_AGENT_NAME] = SECU_WALLET_MSG_QUEUE_NAME;
     }
+    
+    /**
+     * Check the feature dependency graph and compute the level of each feature.
+     * Throw an exception on unknown dependency or on dependency cycle.
+     */
+    void SrrWorker::buildFeaturesLevel()
+    {
+        m_featuresLevel.clear();
+        for (const auto& feature : m_featuresToAgent)
+        {
+            std::set<std::string> visiting;
+            computeFeatureLevel(feature.first, visiting);
+        }
+    }
+    
+    /**
+     * Compute the level of a feature: 0 without dependency, otherwise one more
+     * than the highest level of its dependencies.
+     * @param featureName
+     * @param visiting Features being computed, to detect cycles
+     * @return The feature level
+     */
+    unsigned SrrWorker::computeFeatureLevel(const std::string& featureName, std::set<std::string>& visiting)
+    {
+        auto level = m_featuresLevel.find(featureName);
+        if (level != m_featuresLevel.end())
+        {
+            return level->second;
+        }
+        auto feature = m_featuresToAgent.find(featureName);
+        if (feature == m_featuresToAgent.end())
+        {
+            throw SrrException("Unknown feature dependency: " + featureName);
+        }
+        if (!visiting.insert(featureName).second)
+        {
+            throw SrrException("Feature dependency cycle detected on: " + featureName);
+        }
+        unsigned featureLevel = 0;
+        for (const auto& dependency : feature->second.dependencies)
+        {
+            featureLevel = std::max(featureLevel, computeFeatureLevel(dependency, visiting) + 1);
+        }
+        visiting.erase(featureName);
+        m_featuresLevel[featureName] = featureLevel;
+        return featureLevel;
+    }
    
     /**
      * Get feature list managed
@@ -98,78 +298,202 @@ namespace srr
      */
     ListFeatureResponse SrrWorker::getFeatureListManaged(const ListFeatureQuery& query)
     {
-        std::map<const std::string, config> features = m_featuresToAgent;
-        ListFeatureResponse response;
-        
-        // Automation with dependencies
-        ListFeatureResponse featureAutomation;
-        FeatureDependencies automationDep;
-        automationDep.set_description(m_featuresToAgent[AUTOMATIONS].featureDescription);
-        automationDep.add_dependencies(AUTOMATION_SETTINGS);
-        automationDep.add_dependencies(VIRTUAL_ASSETS);
-        featureAutomation.mutable_map_features_dependencies()->insert({AUTOMATIONS, automationDep});
-        
-        // Remove it to do not add twice.
-        features.erase(AUTOMATIONS);
+        std::lock_guard<std::mutex> lock(m_featureListMutex);
+        return *m_featureList;
+    }
+    
+    /**
+     * Get feature list managed, as a serialized response ready to be sent.
+     * @return The serialized response
+     */
+    std::shared_ptr<const dto::UserData> SrrWorker::getFeatureListManagedData()
+    {
+        std::lock_guard<std::mutex> lock(m_featureListMutex);
+        return m_featureListData;
+    }
+    
+    /**
+     * Get the runtime metrics
+     * @return The metrics
+     */
+    SrrMetrics& SrrWorker::getMetrics()
+    {
+        return *m_metrics;
+    }
+    
+    /**
+     * Get the request tracer
+     * @return The tracer
+     */
+    SrrTracer& SrrWorker::getTracer()
+    {
+        return *m_tracer;
+    }
+    
+    /**
+     * Get the flight recorder
+     * @return The flight recorder
+     */
+    SrrFlightRecorder& SrrWorker::getFlightRecorder()
+    {
+        return *m_flightRecorder;
+    }
+    
+    /**
+     * Build the feature list response and its serialized form.
+     * Must be called each time the features or the version change.
+     */
+    void SrrWorker::buildFeatureListCache()
+    {
+        std::shared_ptr<ListFeatureResponse> featureList = std::make_shared<ListFeatureResponse>();
         
-        // Remaining features
-        ListFeatureResponse otherFeatures;
-        for (const auto& feature : features)
+        // Features with their dependencies
+        for (const auto& feature : m_featuresToAgent)
         {
             FeatureDependencies featDep;
             featDep.set_description(feature.second.featureDescription);
-            otherFeatures.mutable_map_features_dependencies()->insert({feature.first, featDep});
+            for (const auto& dependency : feature.second.dependencies)
+            {
+                featDep.add_dependencies(dependency);
+            }
+            featureList->mutable_map_features_dependencies()->insert({feature.first, featDep});
         }
         
-        // Features concatenation        
-        response += featureAutomation;
-        response += otherFeatures;
-        response.set_version(m_srrVersion);
-        response.set_passphrass_definition(fty::getPassphraseFormat());
-        response.set_passphrass_description(TRANSLATE_ME("Passphrase must have %s characters", (fty::getPassphraseFormat()).c_str()));
+        std::string passphraseFormat = fty::getPassphraseFormat();
+        featureList->set_version(m_srrVersion);
+        featureList->set_passphrass_definition(passphraseFormat);
+        featureList->set_passphrass_description(TRANSLATE_ME("Passphrase must have %s characters", passphraseFormat.c_str()));
+        
+        Response response;
+        *(response.mutable_list_feature()) = *featureList;
+        std::shared_ptr<dto::UserData> featureListData = std::make_shared<dto::UserData>();
+        *featureListData << response;
+        
+        std::lock_guard<std::mutex> lock(m_featureListMutex);
+        m_featureList = featureList;
+        m_featureListData = featureListData;
+    }
+    
+    /**
+     * Save an Ipm2 configuration, kept as a snapshot when the store is on disk.
+     * @param query
+     * @param progress
+     */
+    SaveResponse SrrWorker::saveIpm2Configuration(const SaveQuery& query, const ProgressCallback& progress)
+    {
+        SaveResponse response = collectIpm2Configuration(query, progress);
+        if (response.status().status() == Status::SUCCESS && m_snapshotStore->isPersistent())
+        {
+            SrrSnapshotStore::manifest snapshot = m_snapshotStore->addSnapshot(response, "");
+            log_debug("Snapshot %s stored", snapshot.id.c_str());
+        }
         return response;
     }
     
     /**
-     * Save an Ipm2 configuration
-     * @param msg
+     * Get an Ipm2 configuration from all agents
      * @param query
+     * @param progress
      */
-    SaveResponse SrrWorker::saveIpm2Configuration(const SaveQuery& query)
+    SaveResponse SrrWorker::collectIpm2Configuration(const SaveQuery& query, const ProgressCallback& progress)
     {
+        SrrMetrics::InFlight inFlight(*m_metrics, METRIC_OPERATIONS_IN_FLIGHT, METRIC_OPERATION_DURATION, {{"operation", "save"}});
+        SrrTracer::Span span(*m_tracer, "save");
+        auto start = std::chrono::steady_clock::now();
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_START, SrrFlightRecorder::Operation::SAVE, SrrFlightRecorder::Status::NONE, "", "", query.features().size(), 0, 0);
         SaveResponse response;
         FeatureStatus status;
         status.set_status(Status::FAILED);
         try
         {
+            SRR_PROBE1(passphrase_check_start, "save");
             bool checkPassphraseFormat = fty::checkPassphraseFormat(query.passpharse());
+            SRR_PROBE2(passphrase_check_done, "save", checkPassphraseFormat);
             if (checkPassphraseFormat)
             {
                 log_debug("Save IPM2 configuration processing");
                 // Try to factorize all call.
                 std::map<std::string, std::set<FeatureName>> agentAssoc = factorizationSaveCall(query);
+                for(auto const& agent: agentAssoc)
+                {
+                    reportProgress(progress, agent.second, FeatureProgress::PENDING);
+                }
 
+                // Send all save requests in parallel, one per agent.
+                Deadline deadline = getOperationDeadline();
+                std::map<std::string, std::future<SaveResponse>> partialResponses;
                 for(auto const& agent: agentAssoc)
                 {
-                      // Get queue name from agent name
-                      std::string agentNameDest = agent.first;
-                      std::string queueNameDest = m_agentToQueue.at(agentNameDest);
-
-                      log_debug("Saving configuration by: %s ", agentNameDest.c_str());
-                      // Build query
-                      Query saveQuery = createSaveQuery({agent.second}, query.passpharse());
-                      // Send message
-                      dto::UserData reqData;
-                      reqData << saveQuery;
-                      messagebus::Message resp = sendRequest(reqData, "save", queueNameDest, agentNameDest);
-                      log_debug("Save done by %s: ", agentNameDest.c_str());
-
-                      Response partialResp;
-                      resp.userData() >> partialResp;
-                      response += partialResp.save();
+                    const std::string& agentNameDest = agent.first;
+                    const std::set<FeatureName>& features = agent.second;
+                    SrrTracer::SpanContext traceContext = span.getContext();
+                    partialResponses[agentNameDest] = std::async(std::launch::async, [this, &agentNameDest, &features, &query, &progress, deadline, traceContext]()
+                    {
+                        SrrTracer::Scope traceScope(traceContext);
+                        try
+                        {
+                            reportProgress(progress, features, FeatureProgress::IN_PROGRESS);
+                            // Get queue name from agent name
+                            const std::string& queueNameDest = m_agentToQueue.at(agentNameDest);
+
+                            log_debug("Saving configuration by: %s ", agentNameDest.c_str());
+                            // Build query
+                            Query saveQuery = createSaveQuery({features}, query.passpharse());
+                            // Send message
+                            dto::UserData reqData;
+                            reqData << saveQuery;
+                            messagebus::Message resp = sendRequestWithRetry(reqData, features.size(), "save", queueNameDest, agentNameDest, deadline);
+                            log_debug("Save done by %s: ", agentNameDest.c_str());
+
+                            Response partialResp;
+                            resp.userData() >> partialResp;
+                            reportProgress(progress, features, FeatureProgress::DONE);
+                            SaveResponse partialSave;
+                            partialSave.Swap(partialResp.mutable_save());
+                            for(const auto& feature: partialSave.map_features_data())
+                            {
+                                m_metrics->increment(METRIC_FEATURE_RESPONSE_BYTES, {{"feature", feature.first}}, feature.second.data().size());
+                                m_flightRecorder->record(SrrFlightRecorder::EventType::FEATURE, SrrFlightRecorder::Operation::SAVE, SrrFlightRecorder::Status::SUCCESS, agentNameDest, feature.first, 1, 0, feature.second.data().size());
+                            }
+                            return partialSave;
+                        }
+                        catch (...)
+                        {
+                            reportProgress(progress, features, FeatureProgress::FAILED);
+                            throw;
+                        }
+                    });
+                }
+                // Merge all partial responses in agent name order, keep what the other agents gave if one fails.
+                std::map<FeatureName, std::string> failures;
+                size_t featureCount = 0;
+                for(auto& partialResponse: partialResponses)
+                {
+                    const std::set<FeatureName>& features = agentAssoc.at(partialResponse.first);
+                    featureCount += features.size();
+                    try
+                    {
+                        // Move the feature payloads, they are the bulk of the response.
+                        SaveResponse partialSave = partialResponse.second.get();
+                        SrrTracer::Span mergeSpan(*m_tracer, "merge");
+                        mergeSpan.setAttribute("agent", partialResponse.first);
+                        for(auto& feature: *(partialSave.mutable_map_features_data()))
+                        {
+                            (*(response.mutable_map_features_data()))[feature.first].Swap(&feature.second);
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        log_error("Save failed by %s: %s", partialResponse.first.c_str(), e.what());
+                        for(const auto& feature: features)
+                        {
+                            failures[feature] = e.what();
+                            m_flightRecorder->record(SrrFlightRecorder::EventType::FEATURE, SrrFlightRecorder::Operation::SAVE, SrrFlightRecorder::Status::FAILED, partialResponse.first, feature, 1, 0, 0);
+                        }
+                    }
                 }
                 response.set_version(m_srrVersion);
-                status.set_status(Status::SUCCESS);
+                setOperationStatus(status, failures, featureCount);
                 *(response.mutable_status()) = status;
                 response.set_checksum(fty::encrypt(query.passpharse(), query.passpharse()));
             }
@@ -188,6 +512,58 @@ namespace srr
             status.set_error(errorMsg);
             response = (createSaveResponse(m_srrVersion, status)).save();
         }
+        uint64_t savedBytes = 0;
+        for(const auto& feature: response.map_features_data())
+        {
+            savedBytes += feature.second.data().size();
+        }
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_END, SrrFlightRecorder::Operation::SAVE, getRecorderStatus(response.status().status()), "", "",
+            response.map_features_data().size(), 0, savedBytes, std::chrono::steady_clock::now() - start);
+        return response;
+    }
+    
+    /**
+     * Save an Ipm2 configuration, with only the features changed since the last snapshot
+     * and a manifest with the content hash of all features.
+     * @param query
+     */
+    SaveResponse SrrWorker::saveIpm2ConfigurationDelta(const SaveQuery& query)
+    {
+        SaveResponse response = collectIpm2Configuration(query, nullptr);
+        if (response.status().status() != Status::SUCCESS)
+        {
+            return response;
+        }
+        // The unchanged features must outlive a restart to be restored: full save otherwise.
+        if (!m_snapshotStore->isPersistent())
+        {
+            log_warning("No snapshot path set, incremental save done as a full save");
+            return response;
+        }
+        
+        SrrSnapshotStore::manifest base;
+        bool hasBase = m_snapshotStore->getLastSnapshot(base);
+        SrrSnapshotStore::manifest snapshot = m_snapshotStore->addSnapshot(response, hasBase ? base.id : "");
+        
+        std::vector<std::string> unchangedFeatures;
+        for (const auto& feature : snapshot.featuresHash)
+        {
+            auto baseFeature = base.featuresHash.find(feature.first);
+            if (baseFeature != base.featuresHash.end() && baseFeature->second == feature.second)
+            {
+                unchangedFeatures.push_back(feature.first);
+            }
+        }
+        log_debug("Incremental save %s: %zu unchanged features since %s", snapshot.id.c_str(), unchangedFeatures.size(), snapshot.baseId.c_str());
+        
+        for (const auto& featureName : unchangedFeatures)
+        {
+            response.mutable_map_features_data()->erase(featureName);
+        }
+        Feature manifestFeature;
+        manifestFeature.set_version(m_srrVersion);
+        manifestFeature.set_data(SrrSnapshotStore::manifestToString(snapshot));
+        response.mutable_map_features_data()->insert({SRR_MANIFEST_FEATURE, manifestFeature});
         return response;
     }
     
@@ -196,45 +572,304 @@ namespace srr
      * @param msg
      * @param query
      */
-    RestoreResponse SrrWorker::restoreIpm2Configuration(const RestoreQuery& query)
+    RestoreResponse SrrWorker::restoreIpm2Configuration(const RestoreQuery& query, const ProgressCallback& progress, bool resume)
+    {
+        RestoreQuery restoreQuery(query);
+        return restoreIpm2Configuration(std::move(restoreQuery), progress, resume);
+    }
+
+    /**
+     * Restore an Ipm2 Configuration, the feature payloads are moved out of the query to the agent requests.
+     * @param query
+     * @param progress
+     * @param resume
+     */
+    RestoreResponse SrrWorker::restoreIpm2Configuration(RestoreQuery&& query, const ProgressCallback& progress, bool resume)
+    {
+        try
+        {
+            // Incremental save: the unchanged features are taken from the snapshot store when their step needs them.
+            auto manifestFeature = query.map_features_data().find(SRR_MANIFEST_FEATURE);
+            if (manifestFeature != query.map_features_data().end())
+            {
+                SrrSnapshotStore::manifest snapshot = SrrSnapshotStore::manifestFromString(manifestFeature->second.data());
+                // Fail at once rather than feature by feature when the unchanged contents are gone.
+                for (const auto& feature : snapshot.featuresHash)
+                {
+                    if (query.map_features_data().find(feature.first) == query.map_features_data().end() && !m_snapshotStore->contains(feature.second))
+                    {
+                        throw SrrException("Incremental save " + snapshot.id + " can not be restored: its base snapshot " + snapshot.baseId
+                            + " is no more kept (content of " + feature.first + " missing), restore a full save");
+                    }
+                }
+                SrrSnapshotFeatureSource source(*m_snapshotStore, snapshot, &query);
+                return restoreFromSource(source, query.passpharse(), query.version(), query.checksum(), progress, resume);
+            }
+            SrrQueryFeatureSource source(query);
+            return restoreFromSource(source, query.passpharse(), query.version(), query.checksum(), progress, resume);
+        }
+        catch (const std::exception& e)
+        {
+            FeatureStatus status;
+            status.set_status(Status::FAILED);
+            status.set_error(TRANSLATE_ME("Exception on restore Ipm2 configuration: (%s)", e.what()));
+            log_error(status.error().c_str());
+            return (createRestoreResponse(status)).restore();
+        }
+    }
+
+    /**
+     * Restore the features of a source. Each step loads its features only when it starts,
+     * and sends them to its agent in batches bounded by the restore batch size.
+     * @param source
+     * @param passphrase
+     * @param version
+     * @param checksum
+     * @param progress
+     * @param resume Skip the features a previous run restored
+     */
+    RestoreResponse SrrWorker::restoreFromSource(SrrFeatureSource& source, const std::string& passphrase, const std::string& version, const std::string& checksum, const ProgressCallback& progress, bool resume)
     {
+        SrrMetrics::InFlight inFlight(*m_metrics, METRIC_OPERATIONS_IN_FLIGHT, METRIC_OPERATION_DURATION, {{"operation", "restore"}});
+        SrrTracer::Span span(*m_tracer, "restore");
+        auto start = std::chrono::steady_clock::now();
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_START, SrrFlightRecorder::Operation::RESTORE, SrrFlightRecorder::Status::NONE, "", "", 0, 0, 0);
         RestoreResponse response;
         FeatureStatus status;
         status.set_status(Status::FAILED);
         try
         {
-            std::string decryptedData = fty::decrypt(query.checksum(), query.passpharse());
-            if (decryptedData.compare(query.passpharse()) == 0)
+            SRR_PROBE1(passphrase_check_start, "restore");
+            bool checkPassphrase = fty::decrypt(checksum, passphrase).compare(passphrase) == 0;
+            SRR_PROBE2(passphrase_check_done, "restore", checkPassphrase);
+            if (checkPassphrase)
             {
                 log_debug("Restore IPM2 configuration processing");
-                std::string version = query.version();
                 // Test version compatibility.
-                bool compatible = isVerstionCompatible(query.version());
+                bool compatible = isVerstionCompatible(version);
                 if (compatible)
                 {
+                    // Journal of the applied features: skip them when resuming, start from scratch otherwise.
+                    std::set<FeatureName> stepsFeatures = source.getFeatures();
+                    std::string restoreId = SrrRestoreJournal::getRestoreId(stepsFeatures, checksum);
+                    if (resume)
+                    {
+                        std::set<FeatureName> restoredFeatures = m_restoreJournal->getRestoredFeatures(restoreId);
+                        log_info("Resume restore %s: %zu features already restored", restoreId.c_str(), restoredFeatures.size());
+                        for(const auto& feature: restoredFeatures)
+                        {
+                            if (stepsFeatures.erase(feature) > 0)
+                            {
+                                FeatureStatus restoredStatus;
+                                restoredStatus.set_status(Status::SUCCESS);
+                                (*(response.mutable_map_features_status()))[feature] = restoredStatus;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        m_restoreJournal->remove(restoreId);
+                    }
+                    
                     // Try to factorize all call.
-                    std::map<std::string, RestoreQuery> agentAssoc = factorizationRestoreCall(query);
-                    for(auto const& agent: agentAssoc)
+                    std::map<RestoreStep, std::set<FeatureName>> stepAssoc = factorizationRestoreCall(stepsFeatures);
+                    size_t batchSize = std::stoul(getParameter(RESTORE_BATCH_SIZE_KEY, DEFAULT_RESTORE_BATCH_SIZE));
+                    
+                    // Start each step as soon as the steps restoring its dependencies are done.
+                    // Steps are ordered by level, so the prerequisites are always started first.
+                    // The time left is shared between the levels still to restore.
+                    Deadline deadline = getOperationDeadline();
+                    unsigned lastLevel = stepAssoc.empty() ? 0 : stepAssoc.rbegin()->first.first;
+                    std::map<RestoreStep, std::shared_future<RestoreResponse>> partialResponses;
+                    for(auto const& step: stepAssoc)
                     {
-                        // Get queue name from agent name
-                        std::string agentNameDest = agent.first;
-                        std::string queueNameDest = m_agentToQueue.at(agentNameDest);
-                        // Build query
-                        Query restoreQuery;
-                        *(restoreQuery.mutable_restore()) = agent.second;
-                        log_debug("Restoring configuration by: %s ", agentNameDest.c_str());
-                        // Send message
-                        dto::UserData reqData;
-                        reqData << restoreQuery;
-                        messagebus::Message resp = sendRequest(reqData, "restore", queueNameDest, agentNameDest);
-                        log_debug("Restore done by: %s ", agentNameDest.c_str());
-                        Response partialResp;
+                        // Dependency -> step restoring it
+                        std::vector<std::pair<FeatureName, std::shared_future<RestoreResponse>>> prerequisites;
+                        for(const auto& feature: step.second)
+                        {
+                            for(const auto& dependency: getFeatureConfig(feature).dependencies)
+                            {
+                                if (stepsFeatures.count(dependency) > 0)
+                                {
+                                    RestoreStep prerequisite = getRestoreStep(dependency);
+                                    prerequisites.emplace_back(dependency, partialResponses.at(prerequisite));
+                                }
+                            }
+                        }
                         
-                        resp.userData() >> partialResp;
-                        response += partialResp.restore();
+                        const RestoreStep& stepKey = step.first;
+                        const std::set<FeatureName>& features = step.second;
+                        reportProgress(progress, features, FeatureProgress::PENDING);
+                        
+                        // A step never throws: its failure is given by feature, so the other steps go on.
+                        SrrTracer::SpanContext traceContext = span.getContext();
+                        partialResponses[stepKey] = std::async(std::launch::async, [this, &stepKey, &features, &source, &passphrase, prerequisites, &progress, deadline, lastLevel, batchSize, restoreId, traceContext]()
+                        {
+                            SrrTracer::Scope traceScope(traceContext);
+                            SrrTracer::Span stepSpan(*m_tracer, "restoreStep");
+                            stepSpan.setAttribute("agent", stepKey.second);
+                            stepSpan.setAttribute("level", std::to_string(stepKey.first));
+                            RestoreResponse stepResponse;
+                            auto& featuresStatus = *(stepResponse.mutable_map_features_status());
+                            try
+                            {
+                                // Wait dependencies, do not restore over a failed one.
+                                for(const auto& prerequisite: prerequisites)
+                                {
+                                    const auto& dependenciesStatus = prerequisite.second.get().map_features_status();
+                                    auto dependencyStatus = dependenciesStatus.find(prerequisite.first);
+                                    if (dependencyStatus == dependenciesStatus.end() || dependencyStatus->second.status() != Status::SUCCESS)
+                                    {
+                                        throw SrrException("Dependency " + prerequisite.first + " is not restored");
+                                    }
+                                }
+                                reportProgress(progress, features, FeatureProgress::IN_PROGRESS);
+                                // Get queue name from agent name
+                                const std::string& agentNameDest = stepKey.second;
+                                const std::string& queueNameDest = m_agentToQueue.at(agentNameDest);
+                                
+                                // Features of the same step do not depend on each other, each batch stands alone.
+                                auto restoreBatch = [&](const Query& restoreQuery)
+                                {
+                                    const RestoreQuery& batchQuery = restoreQuery.restore();
+                                    RestoreResponse batchResponse;
+                                    try
+                                    {
+                                        log_debug("Restoring %zu features by: %s (level %u)", batchQuery.map_features_data().size(), agentNameDest.c_str(), stepKey.first);
+                                        for(const auto& feature: batchQuery.map_features_data())
+                                        {
+                                            m_metrics->increment(METRIC_FEATURE_REQUEST_BYTES, {{"feature", feature.first}}, feature.second.data().size());
+                                        }
+                                        // Send message
+                                        dto::UserData reqData;
+                                        reqData << restoreQuery;
+                                        messagebus::Message resp = sendRequestWithRetry(reqData, batchQuery.map_features_data().size(), "restore", queueNameDest, agentNameDest, deadline, lastLevel - stepKey.first + 1);
+                                        log_debug("Restore done by: %s (level %u)", agentNameDest.c_str(), stepKey.first);
+                                        Response partialResp;
+                                        resp.userData() >> partialResp;
+                                        batchResponse.Swap(partialResp.mutable_restore());
+                                    }
+                                    catch (const std::exception& e)
+                                    {
+                                        log_error("Restore failed (level %u, %s): %s", stepKey.first, agentNameDest.c_str(), e.what());
+                                        batchResponse.mutable_status()->set_status(Status::FAILED);
+                                        batchResponse.mutable_status()->set_error(e.what());
+                                    }
+                                    // Agents may only give the global status.
+                                    std::set<FeatureName> succeededFeatures;
+                                    for(const auto& feature: batchQuery.map_features_data())
+                                    {
+                                        auto featureStatus = batchResponse.map_features_status().find(feature.first);
+                                        featuresStatus[feature.first] = featureStatus != batchResponse.map_features_status().end() ? featureStatus->second : batchResponse.status();
+                                        bool succeeded = featuresStatus[feature.first].status() == Status::SUCCESS;
+                                        m_flightRecorder->record(SrrFlightRecorder::EventType::FEATURE, SrrFlightRecorder::Operation::RESTORE, getRecorderStatus(featuresStatus[feature.first].status()),
+                                            agentNameDest, feature.first, 1, feature.second.data().size(), 0);
+                                        if (succeeded)
+                                        {
+                                            succeededFeatures.insert(feature.first);
+                                        }
+                                        if (progress)
+                                        {
+                                            progress(feature.first, succeeded ? FeatureProgress::DONE : FeatureProgress::FAILED);
+                                        }
+                                    }
+                                    // Checkpoint
+                                    try
+                                    {
+                                        m_restoreJournal->addRestoredFeatures(restoreId, succeededFeatures);
+                                    }
+                                    catch (const std::exception& e)
+                                    {
+                                        log_error("Restore journal not updated: %s", e.what());
+                                    }
+                                };
+                                
+                                // Load the features one by one, a batch holds at least one feature.
+                                // The batch is built in the query sent, the features are moved in it:
+                                // it lives on the arena of the source, if any, for the moves not to copy.
+                                google::protobuf::Arena* arena = source.getArena();
+                                Query* restoreQuery = google::protobuf::Arena::CreateMessage<Query>(arena);
+                                Feature* feature = google::protobuf::Arena::CreateMessage<Feature>(arena);
+                                std::unique_ptr<Query> heapQuery(arena ? nullptr : restoreQuery);
+                                std::unique_ptr<Feature> heapFeature(arena ? nullptr : feature);
+                                RestoreQuery& batchQuery = *(restoreQuery->mutable_restore());
+                                batchQuery.set_passpharse(passphrase);
+                                size_t batchBytes = 0;
+                                for(const auto& featureName: features)
+                                {
+                                    try
+                                    {
+                                        feature->Clear();
+                                        source.getFeature(featureName, *feature);
+                                    }
+                                    catch (const std::exception& e)
+                                    {
+                                        log_error("Feature %s not loaded: %s", featureName.c_str(), e.what());
+                                        featuresStatus[featureName].set_status(Status::FAILED);
+                                        featuresStatus[featureName].set_error(e.what());
+                                        reportProgress(progress, {featureName}, FeatureProgress::FAILED);
+                                        continue;
+                                    }
+                                    size_t featureBytes = feature->data().size() + feature->version().size();
+                                    if (!batchQuery.map_features_data().empty() && batchSize > 0 && batchBytes + featureBytes > batchSize)
+                                    {
+                                        restoreBatch(*restoreQuery);
+                                        batchQuery.mutable_map_features_data()->clear();
+                                        batchBytes = 0;
+                                    }
+                                    (*(batchQuery.mutable_map_features_data()))[featureName].Swap(feature);
+                                    batchBytes += featureBytes;
+                                }
+                                if (!batchQuery.map_features_data().empty())
+                                {
+                                    restoreBatch(*restoreQuery);
+                                }
+                            }
+                            catch (const std::exception& e)
+                            {
+                                log_error("Restore failed (level %u, %s): %s", stepKey.first, stepKey.second.c_str(), e.what());
+                                for(const auto& feature: features)
+                                {
+                                    if (featuresStatus.find(feature) == featuresStatus.end())
+                                    {
+                                        featuresStatus[feature].set_status(Status::FAILED);
+                                        featuresStatus[feature].set_error(e.what());
+                                        reportProgress(progress, {feature}, FeatureProgress::FAILED);
+                                    }
+                                }
+                            }
+                            std::map<FeatureName, std::string> stepFailures;
+                            for(const auto& featureStatus: featuresStatus)
+                            {
+                                if (featureStatus.second.status() != Status::SUCCESS)
+                                {
+                                    stepFailures[featureStatus.first] = featureStatus.second.error();
+                                }
+                            }
+                            setOperationStatus(*(stepResponse.mutable_status()), stepFailures, features.size());
+                            return stepResponse;
+                        }).share();
+                    }
+                    // Merge all partial responses in step order.
+                    for(auto& partialResponse: partialResponses)
+                    {
+                        response += partialResponse.second.get();
+                    }
+                    std::map<FeatureName, std::string> failures;
+                    for(const auto& featureStatus: response.map_features_status())
+                    {
+                        if (featureStatus.second.status() != Status::SUCCESS)
+                        {
+                            failures[featureStatus.first] = featureStatus.second.error();
+                        }
                     }
-                    status.set_status(Status::SUCCESS);
+                    setOperationStatus(status, failures, response.map_features_status().size());
                     *(response.mutable_status()) = status;
+                    // Nothing left to resume.
+                    if (failures.empty())
+                    {
+                        m_restoreJournal->remove(restoreId);
+                    }
                 }
                 else
                 {
@@ -258,101 +893,1173 @@ namespace srr
         {
             std::string errorMsg = TRANSLATE_ME("Exception on restore Ipm2 configuration: (%s)", e.what());
             log_error(errorMsg.c_str());
-            std::cout << e.what() << std::endl;
             status.set_error(errorMsg);
             response = (createRestoreResponse(status)).restore();
         }
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_END, SrrFlightRecorder::Operation::RESTORE, getRecorderStatus(response.status().status()), "", "",
+            response.map_features_status().size(), 0, 0, std::chrono::steady_clock::now() - start);
         return response;
     }
 
-    
     /**
-     * Reset an Ipm2 Configuration
-     * @param msg
+     * Save an Ipm2 configuration in a bundle file, the response only holds the status.
      * @param query
+     * @param bundleName
      */
-    ResetResponse SrrWorker::resetIpm2Configuration(const dto::srr::ResetQuery& query)
+    SaveResponse SrrWorker::saveIpm2ConfigurationToBundle(const SaveQuery& query, const std::string& bundleName)
     {
-        throw SrrException("Not implemented yet!");
+        SaveResponse response = saveIpm2Configuration(query);
+        if (response.status().status() == Status::SUCCESS)
+        {
+            try
+            {
+                SrrBundle::write(getBundlePath(bundleName), response);
+                response.mutable_map_features_data()->clear();
+            }
+            catch (const std::exception& e)
+            {
+                FeatureStatus status;
+                status.set_status(Status::FAILED);
+                status.set_error(TRANSLATE_ME("Exception on save Ipm2 configuration: (%s)", e.what()));
+                log_error(status.error().c_str());
+                response = (createSaveResponse(m_srrVersion, status)).save();
+            }
+        }
+        return response;
     }
     
     /**
-     * Save factorization by agent name.
-     * @param siFeatureList
-     * @param association
+     * Restore an Ipm2 configuration from a bundle file, decoding only the requested features.
+     * @param bundleName
+     * @param passphrase
+     * @param features Features to restore, all when empty
+     * @param progress
      */
-    std::map<std::string, std::set<FeatureName>> SrrWorker::factorizationSaveCall(const SaveQuery query)
+    RestoreResponse SrrWorker::restoreIpm2ConfigurationFromBundle(const std::string& bundleName, const std::string& passphrase, const std::set<FeatureName>& features, const ProgressCallback& progress)
     {
-        std::map<std::string, std::set<FeatureName>> assoc;
-        for(const auto& featureName: query.features())
+        try
         {
-            std::string agentName = m_featuresToAgent[featureName].agentName;
-            assoc[agentName].insert(featureName);
+            SrrBundleFeatureSource source(getBundlePath(bundleName), features);
+            return restoreFromSource(source, passphrase, source.getBundle().version(), source.getBundle().checksum(), progress);
+        }
+        catch (const std::exception& e)
+        {
+            FeatureStatus status;
+            status.set_status(Status::FAILED);
+            status.set_error(TRANSLATE_ME("Exception on restore Ipm2 configuration: (%s)", e.what()));
+            log_error(status.error().c_str());
+            return (createRestoreResponse(status)).restore();
         }
-        return assoc;
     }
     
     /**
-     * Restore factorization by agent name.
-     * @param siFeatureList
-     * @param association
+     * Get the path of a bundle file, in the bundle directory.
+     * @param bundleName
+     * @return The bundle path
      */
-    std::map<std::string, RestoreQuery> SrrWorker::factorizationRestoreCall(const RestoreQuery query)
-    {  
-        std::map<std::string, RestoreQuery> assoc;
-        std::map<FeatureName, Feature> map1(query.map_features_data().begin(), query.map_features_data().end());
-        for(const auto& item:  map1)
-        {
-            const std::string & agentName = m_featuresToAgent[item.first].agentName;
-            RestoreQuery& request = assoc[agentName];
-            request.set_passpharse(query.passpharse());
-            request.mutable_map_features_data()->insert({item.first, item.second});
-            
+    std::string SrrWorker::getBundlePath(const std::string& bundleName) const
+    {
+        if (bundleName.empty() || bundleName[0] == '.' || bundleName.find('/') != std::string::npos)
+        {
+            throw SrrException("Invalid bundle name: " + bundleName);
         }
-        return assoc;
+        std::string bundleDir = getParameter(BUNDLE_PATH_KEY, DEFAULT_BUNDLE_PATH);
+        if (mkdir(bundleDir.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            throw SrrException("Unable to create " + bundleDir);
+        }
+        return bundleDir + "/" + bundleName;
     }
     
     /**
-     * Send a response on the message bus.
-     * @param msg
-     * @param payload
-     * @param subject
+     * List the stored snapshots
+     * @return The snapshots, oldest first
      */
-    messagebus::Message SrrWorker::sendRequest(const dto::UserData& userData, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest)
+    std::vector<SrrSnapshotStore::manifest> SrrWorker::listSnapshots()
     {
-        messagebus::Message resp;
-        try
+        return m_snapshotStore->listSnapshots();
+    }
+    
+    /**
+     * Get a stored snapshot as a save response
+     * @param id
+     * @return The save response
+     */
+    SaveResponse SrrWorker::getSnapshot(const std::string& id)
+    {
+        SaveResponse response;
+        FeatureStatus status;
+        status.set_status(Status::FAILED);
+        SrrSnapshotStore::manifest snapshot;
+        if (!m_snapshotStore->getSnapshot(id, snapshot))
         {
-            int timeout = std::stoi(m_parameters.at(REQUEST_TIMEOUT_KEY)) / 1000;
-            messagebus::Message req;
-            req.userData() = userData;
-            req.metaData().emplace(messagebus::Message::SUBJECT, action);
-            req.metaData().emplace(messagebus::Message::FROM, m_parameters.at(AGENT_NAME_KEY));
-            req.metaData().emplace(messagebus::Message::TO, agentNameDest);
-            req.metaData().emplace(messagebus::Message::CORRELATION_ID, messagebus::generateUuid());
-            resp = m_msgBus.request(queueNameDest, req, timeout);
+            status.set_error(TRANSLATE_ME("Unknown snapshot: (%s)", id.c_str()));
+            return (createSaveResponse(m_srrVersion, status)).save();
         }
-        catch (messagebus::MessageBusException& ex)
+        for (const auto& feature : snapshot.featuresHash)
         {
-            throw SrrException(ex.what());
-        } catch (...)
-        {
-            throw SrrException("Unknown error on send response to the message bus");
+            Feature storedFeature;
+            if (!m_snapshotStore->get(feature.second, storedFeature))
+            {
+                status.set_error(TRANSLATE_ME("Content of %s is missing from snapshot (%s)", feature.first.c_str(), id.c_str()));
+                return (createSaveResponse(m_srrVersion, status)).save();
+            }
+            response.mutable_map_features_data()->insert({feature.first, storedFeature});
         }
-        return resp;
+        response.set_version(snapshot.version);
+        response.set_checksum(snapshot.checksum);
+        status.set_status(Status::SUCCESS);
+        *(response.mutable_status()) = status;
+        return response;
     }
     
-    bool SrrWorker::isVerstionCompatible(const std::string& version)
+    /**
+     * Delete a stored snapshot
+     * @param id
+     * @return false if the snapshot is unknown
+     */
+    bool SrrWorker::deleteSnapshot(const std::string& id)
     {
-        bool comptible = false;
-        int srrVersion = std::stoi(m_srrVersion);
-        int requestVersion = std::stoi(version);
-        
-        if (srrVersion >= requestVersion)
+        return m_snapshotStore->deleteSnapshot(id);
+    }
+    
+    /**
+     * Restore a stored snapshot
+     * @param id
+     * @param passphrase
+     * @param progress
+     */
+    RestoreResponse SrrWorker::restoreSnapshot(const std::string& id, const std::string& passphrase, const ProgressCallback& progress)
+    {
+        SrrSnapshotStore::manifest snapshot;
+        if (!m_snapshotStore->getSnapshot(id, snapshot))
         {
-            comptible = true;
+            FeatureStatus status;
+            status.set_status(Status::FAILED);
+            status.set_error(TRANSLATE_ME("Unknown snapshot: (%s)", id.c_str()));
+            return (createRestoreResponse(status)).restore();
         }
-        return comptible;
+        SrrSnapshotFeatureSource source(*m_snapshotStore, snapshot);
+        return restoreFromSource(source, passphrase, snapshot.version, snapshot.checksum, progress);
     }
     
-} // namespace srr
+    /**
+     * Reset an Ipm2 Configuration: each agent resets its features, in the restore order.
+     * The features an agent fails to reset are restored from the factory settings.
+     * @param query Features to reset, all when empty
+     */
+    ResetResponse SrrWorker::resetIpm2Configuration(const dto::srr::ResetQuery& query)
+    {
+        SrrMetrics::InFlight inFlight(*m_metrics, METRIC_OPERATIONS_IN_FLIGHT, METRIC_OPERATION_DURATION, {{"operation", "reset"}});
+        SrrTracer::Span span(*m_tracer, "reset");
+        auto start = std::chrono::steady_clock::now();
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_START, SrrFlightRecorder::Operation::RESET, SrrFlightRecorder::Status::NONE, "", "", query.features().size(), 0, 0);
+        ResetResponse response;
+        FeatureStatus status;
+        status.set_status(Status::FAILED);
+        try
+        {
+            log_debug("Reset IPM2 configuration processing");
+            std::set<FeatureName> features(query.features().begin(), query.features().end());
+            if (features.empty())
+            {
+                for (const auto& feature : m_featuresToAgent)
+                {
+                    features.insert(feature.first);
+                }
+            }
+            // Factory settings, if already captured.
+            std::shared_ptr<SrrBundle> factoryBundle;
+            std::string factoryPassphrase;
+            std::string factoryPath = getParameter(FACTORY_BUNDLE_PATH_KEY, DEFAULT_FACTORY_BUNDLE_PATH);
+            std::ifstream factoryKey(getParameter(FACTORY_KEY_PATH_KEY, DEFAULT_FACTORY_KEY_PATH));
+            if (!factoryPath.empty() && std::getline(factoryKey, factoryPassphrase))
+            {
+                factoryBundle = std::make_shared<SrrBundle>(factoryPath);
+            }
+            
+            // Same steps as a restore: by dependency level and agent.
+            std::map<RestoreStep, std::set<FeatureName>> stepAssoc = factorizationRestoreCall(features);
+            Deadline deadline = getOperationDeadline();
+            unsigned lastLevel = stepAssoc.empty() ? 0 : stepAssoc.rbegin()->first.first;
+            std::map<RestoreStep, std::shared_future<ResetResponse>> partialResponses;
+            for (const auto& step : stepAssoc)
+            {
+                // Dependency -> step resetting it
+                std::vector<std::pair<FeatureName, std::shared_future<ResetResponse>>> prerequisites;
+                for (const auto& feature : step.second)
+                {
+                    for (const auto& dependency : getFeatureConfig(feature).dependencies)
+                    {
+                        if (features.count(dependency) > 0)
+                        {
+                            RestoreStep prerequisite = getRestoreStep(dependency);
+                            prerequisites.emplace_back(dependency, partialResponses.at(prerequisite));
+                        }
+                    }
+                }
+                
+                const RestoreStep& stepKey = step.first;
+                const std::set<FeatureName>& stepFeatures = step.second;
+                SrrTracer::SpanContext traceContext = span.getContext();
+                partialResponses[stepKey] = std::async(std::launch::async, [this, &stepKey, &stepFeatures, prerequisites, factoryBundle, &factoryPassphrase, deadline, lastLevel, traceContext]()
+                {
+                    SrrTracer::Scope traceScope(traceContext);
+                    SrrTracer::Span stepSpan(*m_tracer, "resetStep");
+                    stepSpan.setAttribute("agent", stepKey.second);
+                    stepSpan.setAttribute("level", std::to_string(stepKey.first));
+                    ResetResponse stepResponse;
+                    const std::string& agentNameDest = stepKey.second;
+                    const std::string& queueNameDest = m_agentToQueue.at(agentNameDest);
+                    unsigned remainingSteps = lastLevel - stepKey.first + 1;
+                    try
+                    {
+                        // Wait dependencies, do not reset over a failed one.
+                        for (const auto& prerequisite : prerequisites)
+                        {
+                            const auto& dependenciesStatus = prerequisite.second.get().map_features_status();
+                            auto dependencyStatus = dependenciesStatus.find(prerequisite.first);
+                            if (dependencyStatus == dependenciesStatus.end() || dependencyStatus->second.status() != Status::SUCCESS)
+                            {
+                                throw SrrException("Dependency " + prerequisite.first + " is not reset");
+                            }
+                        }
+                        try
+                        {
+                            Query resetQuery;
+                            for (const auto& feature : stepFeatures)
+                            {
+                                resetQuery.mutable_reset()->add_features(feature);
+                            }
+                            log_debug("Resetting configuration by: %s (level %u)", agentNameDest.c_str(), stepKey.first);
+                            dto::UserData reqData;
+                            reqData << resetQuery;
+                            messagebus::Message resp = sendRequestWithRetry(reqData, stepFeatures.size(), "reset", queueNameDest, agentNameDest, deadline, remainingSteps);
+                            Response partialResp;
+                            resp.userData() >> partialResp;
+                            stepResponse = partialResp.reset();
+                        }
+                        catch (const std::exception& e)
+                        {
+                            stepResponse.mutable_status()->set_status(Status::FAILED);
+                            stepResponse.mutable_status()->set_error(e.what());
+                        }
+                        // Agents may only give the global status.
+                        auto& featuresStatus = *(stepResponse.mutable_map_features_status());
+                        for (const auto& feature : stepFeatures)
+                        {
+                            if (featuresStatus.find(feature) == featuresStatus.end())
+                            {
+                                featuresStatus[feature] = stepResponse.status();
+                            }
+                        }
+                        
+                        // The agent did not reset some features: restore their factory settings.
+                        Query restoreQuery;
+                        RestoreQuery& factoryQuery = *(restoreQuery.mutable_restore());
+                        factoryQuery.set_passpharse(factoryPassphrase);
+                        for (const auto& feature : stepFeatures)
+                        {
+                            if (featuresStatus[feature].status() != Status::SUCCESS && factoryBundle && factoryBundle->contains(feature))
+                            {
+                                Feature factoryFeature = factoryBundle->getFeature(feature);
+                                (*(factoryQuery.mutable_map_features_data()))[feature].Swap(&factoryFeature);
+                            }
+                        }
+                        if (!factoryQuery.map_features_data().empty())
+                        {
+                            log_debug("Restoring factory settings by: %s (level %u)", agentNameDest.c_str(), stepKey.first);
+                            dto::UserData reqData;
+                            reqData << restoreQuery;
+                            messagebus::Message resp = sendRequestWithRetry(reqData, factoryQuery.map_features_data().size(), "restore", queueNameDest, agentNameDest, deadline, remainingSteps);
+                            Response partialResp;
+                            resp.userData() >> partialResp;
+                            const RestoreResponse& restoreResponse = partialResp.restore();
+                            for (const auto& feature : factoryQuery.map_features_data())
+                            {
+                                auto restoreStatus = restoreResponse.map_features_status().find(feature.first);
+                                featuresStatus[feature.first] = restoreStatus != restoreResponse.map_features_status().end() ? restoreStatus->second : restoreResponse.status();
+                            }
+                        }
+                    }
+                    catch (const std::exception& e)
+                    {
+                        log_error("Reset failed (level %u, %s): %s", stepKey.first, agentNameDest.c_str(), e.what());
+                        FeatureStatus failedStatus;
+                        failedStatus.set_status(Status::FAILED);
+                        failedStatus.set_error(e.what());
+                        for (const auto& feature : stepFeatures)
+                        {
+                            auto& featuresStatus = *(stepResponse.mutable_map_features_status());
+                            if (featuresStatus.find(feature) == featuresStatus.end() || featuresStatus[feature].status() != Status::SUCCESS)
+                            {
+                                featuresStatus[feature] = failedStatus;
+                            }
+                        }
+                    }
+                    return stepResponse;
+                }).share();
+            }
+            // Merge all partial responses in step order.
+            for (auto& partialResponse : partialResponses)
+            {
+                response += partialResponse.second.get();
+            }
+            std::map<FeatureName, std::string> failures;
+            for (const auto& featureStatus : response.map_features_status())
+            {
+                if (featureStatus.second.status() != Status::SUCCESS)
+                {
+                    failures[featureStatus.first] = featureStatus.second.error();
+                }
+                auto featureConfig = m_featuresToAgent.find(featureStatus.first);
+                m_flightRecorder->record(SrrFlightRecorder::EventType::FEATURE, SrrFlightRecorder::Operation::RESET, getRecorderStatus(featureStatus.second.status()),
+                    featureConfig != m_featuresToAgent.end() ? featureConfig->second.agentName : "", featureStatus.first, 1, 0, 0);
+            }
+            setOperationStatus(status, failures, response.map_features_status().size());
+        }
+        catch (const std::exception& e)
+        {
+            std::string errorMsg = TRANSLATE_ME("Exception on reset Ipm2 configuration: (%s)", e.what());
+            log_error(errorMsg.c_str());
+            status.set_error(errorMsg);
+        }
+        *(response.mutable_status()) = status;
+        m_flightRecorder->record(SrrFlightRecorder::EventType::OPERATION_END, SrrFlightRecorder::Operation::RESET, getRecorderStatus(status.status()), "", "",
+            response.map_features_status().size(), 0, 0, std::chrono::steady_clock::now() - start);
+        return response;
+    }
+    
+    /**
+     * Capture the factory settings of all features, on the first boot of the system only:
+     * while the first boot marker exists. The marker is removed once the capture is done,
+     * or given up after FACTORY_CAPTURE_MAX_TRIES tries, for the user settings not to be
+     * taken as factory ones.
+     */
+    void SrrWorker::captureFactorySettings()
+    {
+        std::string factoryPath = getParameter(FACTORY_BUNDLE_PATH_KEY, DEFAULT_FACTORY_BUNDLE_PATH);
+        std::string keyPath = getParameter(FACTORY_KEY_PATH_KEY, DEFAULT_FACTORY_KEY_PATH);
+        std::string markerPath = getParameter(FIRST_BOOT_MARKER_KEY, DEFAULT_FIRST_BOOT_MARKER);
+        if (access(markerPath.c_str(), F_OK) != 0)
+        {
+            log_debug("Not the first boot (no %s), factory settings not captured", markerPath.c_str());
+            return;
+        }
+        if (access(factoryPath.c_str(), F_OK) == 0)
+        {
+            // Shipped by the image, or captured by a previous start.
+            unlink(markerPath.c_str());
+            return;
+        }
+        std::unique_lock<std::mutex> lock(m_healthMutex);
+        for (unsigned tries = 1;; tries++)
+        {
+            lock.unlock();
+            try
+            {
+                // Random passphrase, only known by fty-srr, kept apart from the bundle.
+                std::string passphrase = messagebus::generateUuid();
+                passphrase.erase(std::remove(passphrase.begin(), passphrase.end(), '-'), passphrase.end());
+                SaveQuery query;
+                query.set_passpharse(passphrase);
+                for (const auto& feature : m_featuresToAgent)
+                {
+                    query.add_features(feature.first);
+                }
+                SaveResponse response = collectIpm2Configuration(query, nullptr);
+                if (response.status().status() == Status::SUCCESS)
+                {
+                    int fd = open(keyPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+                    bool written = fd >= 0 && write(fd, passphrase.data(), passphrase.size()) == static_cast<ssize_t>(passphrase.size()) && fsync(fd) == 0;
+                    if (fd >= 0)
+                    {
+                        close(fd);
+                    }
+                    if (!written)
+                    {
+                        throw SrrException("Unable to write " + keyPath);
+                    }
+                    SrrBundle::write(factoryPath, response);
+                    unlink(markerPath.c_str());
+                    log_info("Factory settings captured in %s", factoryPath.c_str());
+                    return;
+                }
+                log_warning("Factory settings not captured yet: %s", response.status().error().c_str());
+            }
+            catch (const std::exception& e)
+            {
+                log_warning("Factory settings not captured yet: %s", e.what());
+            }
+            if (tries >= FACTORY_CAPTURE_MAX_TRIES)
+            {
+                unlink(markerPath.c_str());
+                log_error("Factory settings not captured after %u tries, given up", tries);
+                return;
+            }
+            lock.lock();
+            if (m_stopCv.wait_for(lock, FACTORY_CAPTURE_INTERVAL, [this] { return m_stopped; }))
+            {
+                return;
+            }
+        }
+    }
+    
+    /**
+     * Get the configuration of a feature
+     * @param featureName
+     * @return The feature configuration
+     */
+    const SrrWorker::config& SrrWorker::getFeatureConfig(const std::string& featureName) const
+    {
+        auto feature = m_featuresToAgent.find(featureName);
+        if (feature == m_featuresToAgent.end())
+        {
+            throw SrrException("Unknown feature: " + featureName);
+        }
+        return feature->second;
+    }
+    
+    /**
+     * Save factorization by agent name.
+     * @param siFeatureList
+     * @param association
+     */
+    std::map<std::string, std::set<FeatureName>> SrrWorker::factorizationSaveCall(const SaveQuery& query)
+    {
+        std::map<std::string, std::set<FeatureName>> assoc;
+        for(const auto& featureName: query.features())
+        {
+            const std::string& agentName = getFeatureConfig(featureName).agentName;
+            assoc[agentName].insert(featureName);
+        }
+        return assoc;
+    }
+    
+    /**
+     * Restore factorization by dependency level and agent name.
+     * @param features
+     * @return Features by restore step
+     */
+    std::map<SrrWorker::RestoreStep, std::set<FeatureName>> SrrWorker::factorizationRestoreCall(const std::set<FeatureName>& features)
+    {  
+        std::map<RestoreStep, std::set<FeatureName>> assoc;
+        for(const auto& feature: features)
+        {
+            assoc[getRestoreStep(feature)].insert(feature);
+        }
+        return assoc;
+    }
+    
+    /**
+     * Get the restore step of a feature.
+     * @param featureName
+     * @return The restore step
+     */
+    SrrWorker::RestoreStep SrrWorker::getRestoreStep(const std::string& featureName) const
+    {
+        const config& featureConfig = getFeatureConfig(featureName);
+        return RestoreStep(m_featuresLevel.at(featureName), featureConfig.agentName);
+    }
+    
+    /**
+     * Get the dedicated requester of an agent, create it if needed.
+     * @param agentName
+     * @return The agent requester
+     */
+    SrrWorker::requester& SrrWorker::getRequester(const std::string& agentName)
+    {
+        std::lock_guard<std::mutex> lock(m_requesterMutex);
+        auto it = m_agentToRequester.find(agentName);
+        if (it == m_agentToRequester.end())
+        {
+            std::unique_ptr<requester> agentRequester(new requester());
+            // getClientId only tells the threads apart: requesters created by the same thread need their own mailbox.
+            agentRequester->clientId = messagebus::getClientId(m_parameters.at(AGENT_NAME_KEY) + "-" + agentName) + "-" + messagebus::generateUuid();
+            agentRequester->msgBus = std::unique_ptr<messagebus::MessageBus>(createMessageBus(m_parameters.at(ENDPOINT_KEY), agentRequester->clientId));
+            agentRequester->msgBus->connect();
+            // One listener for all the replies, registered once: they come back in the requester mailbox.
+            requester* replyRequester = agentRequester.get();
+            agentRequester->msgBus->receive(agentRequester->clientId, [replyRequester](messagebus::Message msg)
+            {
+                setReply(*replyRequester, std::move(msg));
+            });
+            it = m_agentToRequester.emplace(agentName, std::move(agentRequester)).first;
+        }
+        return *(it->second);
+    }
+    
+    /**
+     * Get the deadline of an operation starting now
+     * @return The deadline, far away when the operation time out is 0
+     */
+    SrrWorker::Deadline SrrWorker::getOperationDeadline() const
+    {
+        long operationTimeout = std::stol(getParameter(OPERATION_TIMEOUT_KEY, DEFAULT_OPERATION_TIMEOUT));
+        if (operationTimeout <= 0)
+        {
+            return Deadline::max();
+        }
+        return std::chrono::steady_clock::now() + std::chrono::milliseconds(operationTimeout);
+    }
+    
+    /**
+     * Get the time out of a request: the agent time out, limited to its share of the time left.
+     * @param agentName
+     * @param deadline
+     * @param remainingSteps Number of sequential requests still to send, this one included
+     * @return The time out, chunks included
+     */
+    std::chrono::milliseconds SrrWorker::getRequestTimeout(const std::string& agentName, const Deadline& deadline, unsigned remainingSteps) const
+    {
+        std::chrono::milliseconds timeout(std::stol(getParameter(AGENT_TIMEOUT_KEY_PREFIX + agentName, m_parameters.at(REQUEST_TIMEOUT_KEY))));
+        if (deadline != Deadline::max())
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0)
+            {
+                throw SrrException("Operation time out reached before request to " + agentName);
+            }
+            timeout = std::min(timeout, remaining / std::max(remainingSteps, 1u));
+        }
+        return timeout;
+    }
+    
+    /**
+     * Send a request to an agent and wait for its reply until a deadline.
+     * The synchronous request of the message bus counts in whole seconds, the reply is awaited here to the millisecond.
+     * @param agentRequester Locked requester of the agent
+     * @param queueNameDest
+     * @param req With a correlation id, its sender and reply queue are set here
+     * @param requestDeadline
+     * @return The reply
+     */
+    messagebus::Message SrrWorker::requestUntil(requester& agentRequester, const std::string& queueNameDest, messagebus::Message req, const Deadline& requestDeadline)
+    {
+        std::future<messagebus::Message> future;
+        {
+            std::lock_guard<std::mutex> lock(agentRequester.replyMutex);
+            agentRequester.replyCorrelationId = req.metaData().at(messagebus::Message::CORRELATION_ID);
+            agentRequester.reply = std::promise<messagebus::Message>();
+            future = agentRequester.reply.get_future();
+        }
+        // Replies are sent to the sender, in its reply queue.
+        req.metaData()[messagebus::Message::FROM] = agentRequester.clientId;
+        req.metaData()[messagebus::Message::REPLY_TO] = agentRequester.clientId;
+        bool replied = false;
+        try
+        {
+            agentRequester.msgBus->sendRequest(queueNameDest, req);
+            replied = future.wait_until(requestDeadline) == std::future_status::ready;
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(agentRequester.replyMutex);
+            agentRequester.replyCorrelationId.clear();
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(agentRequester.replyMutex);
+        agentRequester.replyCorrelationId.clear();
+        if (!replied)
+        {
+            throw messagebus::MessageBusException("Request timed out");
+        }
+        return future.get();
+    }
+    
+    /**
+     * Give a reply to the request waiting for it, from the reply listener of a requester
+     * @param agentRequester
+     * @param msg
+     */
+    void SrrWorker::setReply(requester& agentRequester, messagebus::Message msg)
+    {
+        auto correlationId = msg.metaData().find(messagebus::Message::CORRELATION_ID);
+        std::lock_guard<std::mutex> lock(agentRequester.replyMutex);
+        if (correlationId == msg.metaData().end() || agentRequester.replyCorrelationId.empty() || correlationId->second != agentRequester.replyCorrelationId)
+        {
+            // Late reply to a request already timed out.
+            log_debug("Reply to %s dropped: nobody waits for it", agentRequester.clientId.c_str());
+            return;
+        }
+        agentRequester.replyCorrelationId.clear();
+        agentRequester.reply.set_value(std::move(msg));
+    }
+    
+    /**
+     * Check if an agent may be called, i.e. its circuit breaker is not open.
+     * Once the cool down is over, requests are tried again.
+     * @param agentName
+     * @return True if the agent may be called
+     */
+    bool SrrWorker::isAgentAvailable(const std::string& agentName)
+    {
+        std::lock_guard<std::mutex> lock(m_healthMutex);
+        return std::chrono::steady_clock::now() >= m_agentHealth[agentName].unavailableUntil;
+    }
+    
+    /**
+     * Update the health of an agent with the outcome of a request
+     * @param agentName
+     * @param success
+     */
+    void SrrWorker::updateAgentHealth(const std::string& agentName, bool success)
+    {
+        std::lock_guard<std::mutex> lock(m_healthMutex);
+        agentHealth& health = m_agentHealth[agentName];
+        if (success)
+        {
+            if (health.failures >= std::stoul(getParameter(BREAKER_THRESHOLD_KEY, DEFAULT_BREAKER_THRESHOLD)))
+            {
+                log_info("Agent %s is available again", agentName.c_str());
+            }
+            health = agentHealth();
+            return;
+        }
+        health.failures++;
+        if (health.failures >= std::stoul(getParameter(BREAKER_THRESHOLD_KEY, DEFAULT_BREAKER_THRESHOLD)))
+        {
+            long coolDown = std::stol(getParameter(BREAKER_COOLDOWN_KEY, DEFAULT_BREAKER_COOLDOWN));
+            health.unavailableUntil = std::chrono::steady_clock::now() + std::chrono::milliseconds(coolDown);
+            log_warning("Agent %s is unavailable after %u failures, skipped for %ld ms", agentName.c_str(), health.failures, coolDown);
+        }
+    }
+    
+    /**
+     * Probe the agents without recent activity, until the worker is destroyed.
+     */
+    void SrrWorker::checkAgentsHealth()
+    {
+        std::chrono::milliseconds interval(std::stol(getParameter(HEALTH_CHECK_INTERVAL_KEY, DEFAULT_HEALTH_CHECK_INTERVAL)));
+        std::unique_lock<std::mutex> lock(m_healthMutex);
+        while (!m_stopCv.wait_for(lock, interval, [this] { return m_stopped; }))
+        {
+            lock.unlock();
+            for (const auto& agent : m_agentToQueue)
+            {
+                try
+                {
+                    requester& agentRequester = getRequester(agent.first);
+                    // A busy agent is already checked by its running request.
+                    std::unique_lock<std::mutex> requesterLock(agentRequester.mutex, std::try_to_lock);
+                    if (requesterLock.owns_lock() && std::chrono::steady_clock::now() - agentRequester.lastReply > interval)
+                    {
+                        probeAgent(agentRequester, agent.second, agent.first);
+                    }
+                }
+                catch (std::exception& ex)
+                {
+                    log_debug("Agent %s probe failed: %s", agent.first.c_str(), ex.what());
+                }
+            }
+            lock.lock();
+        }
+    }
+    
+    /**
+     * Check an agent is connected with a list request, before sending the real request.
+     * The list has no side effect on the agent, any reply tells it is connected.
+     * @param agentRequester Locked requester of the agent
+     * @param queueNameDest
+     * @param agentNameDest
+     */
+    void SrrWorker::probeAgent(requester& agentRequester, const std::string& queueNameDest, const std::string& agentNameDest)
+    {
+        std::chrono::milliseconds timeout(std::stol(getParameter(PROBE_TIMEOUT_KEY, DEFAULT_PROBE_TIMEOUT)));
+        messagebus::Message req;
+        req.userData() << createListFeatureQuery();
+        req.metaData().emplace(messagebus::Message::SUBJECT, "list");
+        req.metaData().emplace(messagebus::Message::TO, agentNameDest);
+        req.metaData().emplace(messagebus::Message::CORRELATION_ID, messagebus::generateUuid());
+        SrrTracer::inject(req);
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            requestUntil(agentRequester, queueNameDest, std::move(req), start + timeout);
+        }
+        catch (messagebus::MessageBusException& ex)
+        {
+            log_error("Agent %s does not answer: %s", agentNameDest.c_str(), ex.what());
+            updateAgentHealth(agentNameDest, false);
+            m_metrics->increment(METRIC_AGENT_ERRORS, {{"agent", agentNameDest}, {"action", "probe"}, {"reason", "timeout"}});
+            // Failed probes only, the periodic ones would push the operations out.
+            m_flightRecorder->record(SrrFlightRecorder::EventType::AGENT_REQUEST, SrrFlightRecorder::Operation::PROBE, SrrFlightRecorder::Status::TIMEOUT, agentNameDest, "", 0, 0, 0, std::chrono::steady_clock::now() - start);
+            throw SrrException("Agent " + agentNameDest + " is not connected");
+        }
+        agentRequester.lastReply = std::chrono::steady_clock::now();
+        updateAgentHealth(agentNameDest, true);
+    }
+    
+    /**
+     * Send a request to an agent, try again with an increasing delay when it fails to answer.
+     * Only a save is sent again once delivered: a restore or a reset which timed out may have been applied.
+     * @param userData
+     * @param featureCount Number of features of the request
+     * @param action
+     * @param queueNameDest
+     * @param agentNameDest
+     * @param deadline Deadline of the whole operation
+     * @param remainingSteps Number of sequential requests still to send in the operation, this one included
+     */
+    messagebus::Message SrrWorker::sendRequestWithRetry(const dto::UserData& userData, size_t featureCount, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest, const Deadline& deadline, unsigned remainingSteps)
+    {
+        unsigned retryCount = std::stoul(getParameter(RETRY_COUNT_KEY, DEFAULT_RETRY_COUNT));
+        std::chrono::milliseconds delay(std::stol(getParameter(RETRY_DELAY_KEY, DEFAULT_RETRY_DELAY)));
+        for (unsigned attempt = 0;; attempt++)
+        {
+            bool sent = false;
+            try
+            {
+                return sendRequest(userData, featureCount, action, queueNameDest, agentNameDest, deadline, remainingSteps, &sent);
+            }
+            catch (SrrException& ex)
+            {
+                if (sent && action != "save")
+                {
+                    log_error("Request %s to %s failed after it was sent (%s), not tried again", action.c_str(), agentNameDest.c_str(), ex.what());
+                    throw;
+                }
+                // No need to wait for an agent known as down, or after the deadline.
+                if (attempt >= retryCount || !isAgentAvailable(agentNameDest) || std::chrono::steady_clock::now() + delay >= deadline)
+                {
+                    throw;
+                }
+                log_warning("Request %s to %s failed (%s), retry in %ld ms", action.c_str(), agentNameDest.c_str(), ex.what(), static_cast<long>(delay.count()));
+                std::this_thread::sleep_for(delay);
+                delay = std::min(delay * 2, MAX_RETRY_DELAY);
+            }
+        }
+    }
+    
+    /**
+     * Send a request to an agent and wait for its response.
+     * @param userData
+     * @param featureCount Number of features of the request
+     * @param action
+     * @param queueNameDest
+     * @param agentNameDest
+     * @param deadline Deadline of the whole operation
+     * @param remainingSteps Number of sequential requests still to send in the operation, this one included
+     * @param sent Set once the request is given to the message bus, the agent may then have received it
+     */
+    messagebus::Message SrrWorker::sendRequest(const dto::UserData& userData, size_t featureCount, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest, const Deadline& deadline, unsigned remainingSteps, bool* sent)
+    {
+        messagebus::Message resp;
+        auto start = std::chrono::steady_clock::now();
+        SrrMetrics::Labels labels = {{"agent", agentNameDest}, {"action", action}};
+        // Reason of a failure, for the error counter.
+        std::string failure = "error";
+        // The agent spans of the request are children of this one.
+        SrrTracer::Span span(*m_tracer, "agentRequest");
+        span.setAttribute("agent", agentNameDest);
+        span.setAttribute("action", action);
+        // Sizes as sent and as received, compressed or not.
+        size_t requestBytes = 0;
+        size_t responseBytes = 0;
+        SRR_PROBE4(agent_request_start, agentNameDest.c_str(), action.c_str(), featureCount, userData.size());
+        auto countFailure = [&]()
+        {
+            SrrMetrics::Labels errorLabels = labels;
+            errorLabels["reason"] = failure;
+            m_metrics->increment(METRIC_AGENT_ERRORS, errorLabels);
+            span.setAttribute("error", failure);
+            SRR_PROBE5(agent_request_done, agentNameDest.c_str(), action.c_str(), failure.c_str(), requestBytes, responseBytes);
+            m_flightRecorder->record(SrrFlightRecorder::EventType::AGENT_REQUEST, SrrFlightRecorder::getOperation(action), SrrFlightRecorder::getStatus(failure),
+                agentNameDest, "", featureCount, requestBytes, responseBytes, std::chrono::steady_clock::now() - start);
+        };
+        try
+        {
+            messagebus::Message req;
+            req.userData() = userData;
+            req.metaData().emplace(messagebus::Message::SUBJECT, action);
+            req.metaData().emplace(messagebus::Message::TO, agentNameDest);
+            req.metaData().emplace(messagebus::Message::CORRELATION_ID, messagebus::generateUuid());
+            // Do not wait for an agent known as down.
+            if (!isAgentAvailable(agentNameDest))
+            {
+                failure = "unavailable";
+                throw SrrException("Agent " + agentNameDest + " is unavailable");
+            }
+            // One request at a time by agent requester.
+            requester& agentRequester = getRequester(agentNameDest);
+            std::lock_guard<std::mutex> lock(agentRequester.mutex);
+            // A silent agent may be gone: find it out in a probe time out rather than in a request time out.
+            if (std::chrono::steady_clock::now() - agentRequester.lastReply > AGENT_PROBE_INTERVAL)
+            {
+                failure = "unreachable";
+                probeAgent(agentRequester, queueNameDest, agentNameDest);
+                failure = "error";
+            }
+            // Chunks of the request and of the reply share its time out.
+            Deadline requestDeadline = std::chrono::steady_clock::now() + getRequestTimeout(agentNameDest, deadline, remainingSteps);
+            // Compressed and cut in chunks only if the agent said it reads it.
+            m_compression->encode(req, agentRequester.acceptEncoding);
+            m_chunkTransfer->advertise(req);
+            for (const auto& frame : req.userData())
+            {
+                requestBytes += frame.size();
+            }
+            // Cut one at a time as they are sent.
+            SrrChunkTransfer::Chunks chunks(std::move(req), agentRequester.acceptsChunks ? m_chunkTransfer->getChunkSize() : 0);
+            try
+            {
+                if (sent)
+                {
+                    *sent = true;
+                }
+                // Every chunk is acknowledged, the reply comes with the last one.
+                std::string correlationIds;
+                while (chunks.hasNext())
+                {
+                    messagebus::Message chunk = chunks.next();
+                    chunk.metaData()[messagebus::Message::CORRELATION_ID] = messagebus::generateUuid();
+                    SrrTracer::inject(chunk);
+                    correlationIds += (correlationIds.empty() ? "" : ",") + chunk.metaData()[messagebus::Message::CORRELATION_ID];
+                    span.setAttribute("correlationIds", correlationIds);
+                    resp = requestUntil(agentRequester, queueNameDest, std::move(chunk), requestDeadline);
+                }
+                // Pull the rest of a reply sent in chunks.
+                for (unsigned chunkIndex = 1; SrrChunkTransfer::isChunk(resp) && !m_chunkTransfer->addChunk(resp); chunkIndex++)
+                {
+                    messagebus::Message chunkReq = SrrChunkTransfer::createChunkRequest(resp, chunkIndex);
+                    chunkReq.metaData().emplace(messagebus::Message::TO, agentNameDest);
+                    chunkReq.metaData().emplace(messagebus::Message::CORRELATION_ID, messagebus::generateUuid());
+                    SrrTracer::inject(chunkReq);
+                    resp = requestUntil(agentRequester, queueNameDest, std::move(chunkReq), requestDeadline);
+                }
+            }
+            catch (messagebus::MessageBusException&)
+            {
+                updateAgentHealth(agentNameDest, false);
+                failure = "timeout";
+                throw;
+            }
+            agentRequester.lastReply = std::chrono::steady_clock::now();
+            updateAgentHealth(agentNameDest, true);
+            agentRequester.acceptEncoding = SrrCompression::getAcceptEncoding(resp);
+            agentRequester.acceptsChunks = SrrChunkTransfer::acceptsChunks(resp);
+            for (const auto& frame : resp.userData())
+            {
+                responseBytes += frame.size();
+            }
+            m_compression->decode(resp);
+            m_metrics->observeDuration(METRIC_AGENT_REQUEST_DURATION, labels, start);
+            m_metrics->observe(METRIC_AGENT_REQUEST_BYTES, labels, requestBytes, SrrMetrics::SIZE_BUCKETS);
+            m_metrics->observe(METRIC_AGENT_RESPONSE_BYTES, labels, responseBytes, SrrMetrics::SIZE_BUCKETS);
+            SRR_PROBE5(agent_request_done, agentNameDest.c_str(), action.c_str(), "", requestBytes, responseBytes);
+            m_flightRecorder->record(SrrFlightRecorder::EventType::AGENT_REQUEST, SrrFlightRecorder::getOperation(action), SrrFlightRecorder::Status::SUCCESS,
+                agentNameDest, "", featureCount, requestBytes, responseBytes, std::chrono::steady_clock::now() - start);
+        }
+        catch (messagebus::MessageBusException& ex)
+        {
+            countFailure();
+            throw SrrException(ex.what());
+        }
+        catch (SrrException&)
+        {
+            countFailure();
+            throw;
+        } catch (...)
+        {
+            countFailure();
+            throw SrrException("Unknown error on send response to the message bus");
+        }
+        return resp;
+    }
+    
+    bool SrrWorker::isVerstionCompatible(const std::string& version)
+    {
+        bool comptible = false;
+        int srrVersion = std::stoi(m_srrVersion);
+        int requestVersion = std::stoi(version);
+        
+        if (srrVersion >= requestVersion)
+        {
+            comptible = true;
+        }
+        return comptible;
+    }
+    
+} // namespace srr
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+namespace
+{
+    // Order of the requests received by all the test agents.
+    std::atomic<unsigned> testRequestSequence(0);
+
+    /**
+     * Agent answering the worker in process, it records the requests it gets.
+     */
+    class SrrTestAgent
+    {
+        public:
+            struct request {
+                unsigned sequence;
+                std::string subject;
+                std::string from;
+                std::set<std::string> features;
+            };
+
+            SrrTestAgent(const std::string& endpoint, const std::string& agentName, const std::string& queueName) :
+                m_agentName(agentName)
+            {
+                m_msgBus = std::unique_ptr<messagebus::MessageBus>(srr::createMessageBus(endpoint, agentName));
+                m_msgBus->connect();
+                m_msgBus->receive(queueName, std::bind(&SrrTestAgent::handleRequest, this, std::placeholders::_1));
+            }
+
+            std::vector<request> getRequests()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                return m_requests;
+            }
+
+            void clearRequests()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_requests.clear();
+            }
+
+            // Get the last request with a subject and a feature, it must exist.
+            request getRequest(const std::string& subject, const std::string& featureName)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                auto found = std::find_if(m_requests.rbegin(), m_requests.rend(), [&](const request& received)
+                {
+                    return received.subject == subject && received.features.count(featureName) > 0;
+                });
+                assert(found != m_requests.rend());
+                return *found;
+            }
+
+            // The next requests are received, but never answered.
+            void dropRequests(unsigned count)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_drops = count;
+            }
+
+        private:
+            std::string m_agentName;
+            std::mutex m_mutex;
+            std::vector<request> m_requests;
+            unsigned m_drops = 0;
+            std::unique_ptr<messagebus::MessageBus> m_msgBus;
+
+            void handleRequest(messagebus::Message msg)
+            {
+                Query query;
+                msg.userData() >> query;
+                request received;
+                received.sequence = testRequestSequence++;
+                received.subject = msg.metaData().at(messagebus::Message::SUBJECT);
+                received.from = msg.metaData().at(messagebus::Message::FROM);
+                FeatureStatus success;
+                success.set_status(Status::SUCCESS);
+                Response response;
+                if (query.parameters_case() == Query::ParametersCase::kSave)
+                {
+                    SaveResponse& save = *(response.mutable_save());
+                    for (const auto& featureName : query.save().features())
+                    {
+                        received.features.insert(featureName);
+                        Feature feature;
+                        feature.set_version(ACTIVE_VERSION);
+                        feature.set_data(featureName + " data");
+                        (*(save.mutable_map_features_data()))[featureName] = feature;
+                    }
+                    *(save.mutable_status()) = success;
+                }
+                else if (query.parameters_case() == Query::ParametersCase::kRestore)
+                {
+                    RestoreResponse& restore = *(response.mutable_restore());
+                    for (const auto& feature : query.restore().map_features_data())
+                    {
+                        received.features.insert(feature.first);
+                        (*(restore.mutable_map_features_status()))[feature.first] = success;
+                    }
+                    *(restore.mutable_status()) = success;
+                }
+                else if (query.parameters_case() == Query::ParametersCase::kReset)
+                {
+                    ResetResponse& reset = *(response.mutable_reset());
+                    for (const auto& featureName : query.reset().features())
+                    {
+                        received.features.insert(featureName);
+                        (*(reset.mutable_map_features_status()))[featureName] = success;
+                    }
+                    *(reset.mutable_status()) = success;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_requests.push_back(received);
+                    if (m_drops > 0)
+                    {
+                        m_drops--;
+                        return;
+                    }
+                }
+                messagebus::Message reply;
+                reply.userData() << response;
+                reply.metaData()[messagebus::Message::SUBJECT] = received.subject;
+                reply.metaData()[messagebus::Message::FROM] = m_agentName;
+                reply.metaData()[messagebus::Message::TO] = received.from;
+                reply.metaData()[messagebus::Message::CORRELATION_ID] = msg.metaData().at(messagebus::Message::CORRELATION_ID);
+                m_msgBus->sendReply(msg.metaData().at(messagebus::Message::REPLY_TO), reply);
+            }
+    };
+}
+
+void
+fty_srr_worker_test (bool verbose)
+{
+    printf (" * fty_srr_worker: ");
+
+    //  @selftest
+    using namespace srr;
+    const std::string passphrase = "Srr-selftest-1";
+
+    // Agents and worker on the in-process bus, nothing on disk
+    std::string endpoint = std::string (INPROCESS_ENDPOINT_PREFIX) + "fty-srr-worker-test";
+    SrrTestAgent configAgent (endpoint, CONFIG_AGENT_NAME, CONFIG_MSG_QUEUE_NAME);
+    SrrTestAgent emc4jAgent (endpoint, EMC4J_AGENT_NAME, EMC4J_MSG_QUEUE_NAME);
+    SrrTestAgent walletAgent (endpoint, SECU_WALLET_AGENT_NAME, SECU_WALLET_MSG_QUEUE_NAME);
+    std::map<std::string, std::string> parameters;
+    parameters[ENDPOINT_KEY] = endpoint;
+    parameters[AGENT_NAME_KEY] = AGENT_NAME;
+    parameters[SRR_VERSION_KEY] = ACTIVE_VERSION;
+    parameters[REQUEST_TIMEOUT_KEY] = "300";
+    parameters[PROBE_TIMEOUT_KEY] = "100";
+    parameters[RETRY_COUNT_KEY] = "1";
+    parameters[RETRY_DELAY_KEY] = "10";
+    parameters[BREAKER_THRESHOLD_KEY] = "2";
+    parameters[BREAKER_COOLDOWN_KEY] = "60000";
+    parameters[HEALTH_CHECK_INTERVAL_KEY] = "0";
+    parameters[FACTORY_BUNDLE_PATH_KEY] = "";
+    parameters[RESTORE_JOURNAL_PATH_KEY] = "";
+    std::unique_ptr<messagebus::MessageBus> msgBus (createMessageBus (endpoint, AGENT_NAME));
+    msgBus->connect ();
+    SrrWorker worker (*msgBus, parameters);
+
+    // Two requests in a row through the requester of the agent
+    for (const std::string featureName : {MONITORING_FEATURE_NAME, NOTIFICATION_FEATURE_NAME}) {
+        SaveResponse response = worker.saveIpm2Configuration (createSaveQuery ({featureName}, passphrase).save ());
+        assert (response.status ().status () == Status::SUCCESS);
+        assert (response.map_features_data ().size () == 1);
+        assert (response.map_features_data ().at (featureName).data () == featureName + " data");
+    }
+    // The agent is probed first, then all the requests come from the same client
+    std::vector<SrrTestAgent::request> requests = configAgent.getRequests ();
+    assert (requests.size () == 3);
+    assert (requests[0].subject == "list");
+    assert (requests[1].subject == "save" && requests[1].features == std::set<std::string> {MONITORING_FEATURE_NAME});
+    assert (requests[2].subject == "save" && requests[2].features == std::set<std::string> {NOTIFICATION_FEATURE_NAME});
+    assert (requests[0].from == requests[1].from && requests[1].from == requests[2].from);
+
+    // Save fanned out to the agents, their features merged in the response
+    {
+        std::set<FeatureName> features = {MONITORING_FEATURE_NAME, NETWORK, VIRTUAL_ASSETS, AUTOMATIONS};
+        SaveResponse response = worker.saveIpm2Configuration (createSaveQuery (features, passphrase).save ());
+        assert (response.status ().status () == Status::SUCCESS);
+        assert (response.map_features_data ().size () == features.size ());
+        for (const auto& featureName : features) {
+            assert (response.map_features_data ().at (featureName).data () == featureName + " data");
+        }
+        assert ((configAgent.getRequest ("save", NETWORK).features == std::set<std::string> {MONITORING_FEATURE_NAME, NETWORK}));
+        assert ((emc4jAgent.getRequest ("save", AUTOMATIONS).features == std::set<std::string> {VIRTUAL_ASSETS, AUTOMATIONS}));
+    }
+
+    auto restore = [&] (const std::set<FeatureName>& featureNames) {
+        std::map<FeatureName, Feature> features;
+        for (const auto& featureName : featureNames) {
+            features[featureName].set_version (ACTIVE_VERSION);
+            features[featureName].set_data (featureName + " data");
+        }
+        Query query = createRestoreQuery (features, passphrase);
+        query.mutable_restore ()->set_version (ACTIVE_VERSION);
+        query.mutable_restore ()->set_checksum (fty::encrypt (passphrase, passphrase));
+        return worker.restoreIpm2Configuration (query.restore ());
+    };
+
+    // Restore by dependency level: automations after the features it depends on
+    {
+        RestoreResponse response = restore ({MONITORING_FEATURE_NAME, AUTOMATION_SETTINGS, VIRTUAL_ASSETS, AUTOMATIONS});
+        assert (response.status ().status () == Status::SUCCESS);
+        assert (response.map_features_status ().size () == 4);
+        SrrTestAgent::request automations = emc4jAgent.getRequest ("restore", AUTOMATIONS);
+        SrrTestAgent::request virtualAssets = emc4jAgent.getRequest ("restore", VIRTUAL_ASSETS);
+        SrrTestAgent::request automationSettings = configAgent.getRequest ("restore", AUTOMATION_SETTINGS);
+        // One request per level and agent
+        assert ((automations.features == std::set<std::string> {AUTOMATIONS}));
+        assert ((virtualAssets.features == std::set<std::string> {VIRTUAL_ASSETS}));
+        assert ((automationSettings.features == std::set<std::string> {MONITORING_FEATURE_NAME, AUTOMATION_SETTINGS}));
+        assert (automations.sequence > virtualAssets.sequence && automations.sequence > automationSettings.sequence);
+    }
+
+    // Unknown feature: rejected before any request
+    {
+        configAgent.clearRequests ();
+        RestoreResponse response = restore ({MONITORING_FEATURE_NAME, "unknown-feature"});
+        assert (response.status ().status () == Status::FAILED);
+        assert (response.status ().error ().find ("Unknown feature: unknown-feature") != std::string::npos);
+        assert (configAgent.getRequests ().empty ());
+    }
+
+    // Reset by dependency level too
+    {
+        emc4jAgent.clearRequests ();
+        ResetQuery query = createResetQuery ({AUTOMATION_SETTINGS, VIRTUAL_ASSETS, AUTOMATIONS}).reset ();
+        ResetResponse response = worker.resetIpm2Configuration (query);
+        assert (response.status ().status () == Status::SUCCESS);
+        assert (response.map_features_status ().size () == 3);
+        assert (emc4jAgent.getRequests ().size () == 2);
+        SrrTestAgent::request automations = emc4jAgent.getRequest ("reset", AUTOMATIONS);
+        assert ((automations.features == std::set<std::string> {AUTOMATIONS}));
+        assert (automations.sequence > emc4jAgent.getRequest ("reset", VIRTUAL_ASSETS).sequence);
+        assert (automations.sequence > configAgent.getRequest ("reset", AUTOMATION_SETTINGS).sequence);
+    }
+
+    // Save sent again when its reply is lost
+    {
+        configAgent.clearRequests ();
+        configAgent.dropRequests (1);
+        SaveResponse response = worker.saveIpm2Configuration (createSaveQuery ({MONITORING_FEATURE_NAME}, passphrase).save ());
+        assert (response.status ().status () == Status::SUCCESS);
+        requests = configAgent.getRequests ();
+        assert (requests.size () == 2);
+        assert (requests[0].subject == "save" && requests[1].subject == "save");
+    }
+
+    // Restore not sent again once delivered: the agent may have applied it
+    {
+        configAgent.clearRequests ();
+        configAgent.dropRequests (1);
+        RestoreResponse response = restore ({MONITORING_FEATURE_NAME});
+        assert (response.status ().status () == Status::FAILED);
+        requests = configAgent.getRequests ();
+        assert (requests.size () == 1);
+        assert (requests[0].subject == "restore");
+    }
+
+    // Circuit breaker: a silent agent is skipped once it failed too many times,
+    // the features of the other agents are still saved
+    {
+        walletAgent.dropRequests (100);
+        SaveResponse response = worker.saveIpm2Configuration (createSaveQuery ({MONITORING_FEATURE_NAME, SECURITY_WALLET}, passphrase).save ());
+        assert (response.status ().status () == Status::PARTIAL_SUCCESS);
+        assert (response.map_features_data ().size () == 1);
+        assert (response.map_features_data ().count (MONITORING_FEATURE_NAME) == 1);
+        // Probed, then probed again
+        assert (walletAgent.getRequests ().size () == 2);
+
+        response = worker.saveIpm2Configuration (createSaveQuery ({SECURITY_WALLET}, passphrase).save ());
+        assert (response.status ().status () == Status::FAILED);
+        assert (walletAgent.getRequests ().size () == 2);
+    }
+    //  @end
+
+    printf ("OK\n");
+}
@@ -24,24 +24,65 @@
 
 #include <fty_common_messagebus.h>
 
+#include "fty_srr_bundle.h"
+#include "fty_srr_chunk_transfer.h"
+#include "fty_srr_compression.h"
+#include "fty_srr_feature_source.h"
+#include "fty_srr_flight_recorder.h"
+#include "fty_srr_metrics.h"
+#include "fty_srr_restore_journal.h"
+#include "fty_srr_snapshot_store.h"
+#include "fty_srr_tracer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
 namespace srr
 {
     class SrrWorker
     {
+        // Microbenchmarks of the private hot paths.
+        friend class SrrWorkerBench;
+
         public:
             
             struct config {
                 std::string agentName;
                 std::string featureDescription;
+                // Features which must be restored before this one.
+                std::vector<std::string> dependencies;
             };
             
+            // Progress of a feature during a save or a restore.
+            enum class FeatureProgress { PENDING, IN_PROGRESS, DONE, FAILED };
+            using ProgressCallback = std::function<void(const std::string& featureName, FeatureProgress progress)>;
+            
             explicit SrrWorker(messagebus::MessageBus& msgBus, const std::map<std::string, std::string>& parameters);
-            ~SrrWorker() = default;
+            ~SrrWorker();
           
             dto::srr::ListFeatureResponse getFeatureListManaged(const dto::srr::ListFeatureQuery& query);
-            dto::srr::SaveResponse saveIpm2Configuration(const dto::srr::SaveQuery& query);
-            dto::srr::RestoreResponse restoreIpm2Configuration(const dto::srr::RestoreQuery& query);
+            std::shared_ptr<const dto::UserData> getFeatureListManagedData();
+            dto::srr::SaveResponse saveIpm2Configuration(const dto::srr::SaveQuery& query, const ProgressCallback& progress = nullptr);
+            dto::srr::SaveResponse saveIpm2ConfigurationDelta(const dto::srr::SaveQuery& query);
+            dto::srr::RestoreResponse restoreIpm2Configuration(const dto::srr::RestoreQuery& query, const ProgressCallback& progress = nullptr, bool resume = false);
+            dto::srr::RestoreResponse restoreIpm2Configuration(dto::srr::RestoreQuery&& query, const ProgressCallback& progress = nullptr, bool resume = false);
+            dto::srr::SaveResponse saveIpm2ConfigurationToBundle(const dto::srr::SaveQuery& query, const std::string& bundleName);
+            dto::srr::RestoreResponse restoreIpm2ConfigurationFromBundle(const std::string& bundleName, const std::string& passphrase, const std::set<dto::srr::FeatureName>& features, const ProgressCallback& progress = nullptr);
+            std::vector<SrrSnapshotStore::manifest> listSnapshots();
+            dto::srr::SaveResponse getSnapshot(const std::string& id);
+            bool deleteSnapshot(const std::string& id);
+            dto::srr::RestoreResponse restoreSnapshot(const std::string& id, const std::string& passphrase, const ProgressCallback& progress = nullptr);
             dto::srr::ResetResponse resetIpm2Configuration(const dto::srr::ResetQuery& query);
+            SrrMetrics& getMetrics();
+            SrrTracer& getTracer();
+            SrrFlightRecorder& getFlightRecorder();
 
         private:
             messagebus::MessageBus& m_msgBus;
@@ -49,16 +90,92 @@ namespace srr
             std::string m_srrVersion;
             std::map<const std::string, config> m_featuresToAgent;
             std::map<const std::string, std::string> m_agentToQueue;
+            // Feature -> Depth in the dependency graph (0 when no dependency).
+            std::map<const std::string, unsigned> m_featuresLevel;
+            // Feature list response, built once.
+            std::shared_ptr<const dto::srr::ListFeatureResponse> m_featureList;
+            std::shared_ptr<const dto::UserData> m_featureListData;
+            std::mutex m_featureListMutex;
+            // Content of the previous saves, for incremental saves and local snapshots.
+            std::unique_ptr<SrrSnapshotStore> m_snapshotStore;
+            std::unique_ptr<SrrCompression> m_compression;
+            std::unique_ptr<SrrChunkTransfer> m_chunkTransfer;
+            std::unique_ptr<SrrRestoreJournal> m_restoreJournal;
+            std::unique_ptr<SrrMetrics> m_metrics;
+            std::unique_ptr<SrrTracer> m_tracer;
+            std::unique_ptr<SrrFlightRecorder> m_flightRecorder;
+            
+            // Dedicated requester per agent, to be able to send request in parallel.
+            struct requester {
+                // Reply awaited by the request in progress, given by the reply listener.
+                std::mutex replyMutex;
+                std::string replyCorrelationId;
+                std::promise<messagebus::Message> reply;
+                // Destroyed before the reply above, which its listener sets.
+                std::unique_ptr<messagebus::MessageBus> msgBus;
+                // Client name, and queue of the replies.
+                std::string clientId;
+                std::mutex mutex;
+                // Encodings advertised by the agent in its last reply.
+                std::string acceptEncoding;
+                bool acceptsChunks = false;
+                // Last time the agent answered, it is probed first when it is too old.
+                std::chrono::steady_clock::time_point lastReply;
+            };
+            std::map<const std::string, std::unique_ptr<requester>> m_agentToRequester;
+            std::mutex m_requesterMutex;
+            
+            // Circuit breaker by agent: after too many failures in a row, the agent is skipped until the cool down ends.
+            struct agentHealth {
+                unsigned failures = 0;
+                std::chrono::steady_clock::time_point unavailableUntil;
+            };
+            std::map<const std::string, agentHealth> m_agentHealth;
+            std::mutex m_healthMutex;
+            // Periodic probes of the idle agents.
+            std::thread m_healthThread;
+            // Capture of the factory settings, at first boot.
+            std::thread m_factoryThread;
+            // Wakes the background threads up when the worker is destroyed.
+            std::condition_variable m_stopCv;
+            bool m_stopped;
    
             void init();
+            std::string getParameter(const std::string& key, const std::string& defaultValue) const;
+            std::string getBundlePath(const std::string& bundleName) const;
             void buildMapAssociation();
+            void buildFeaturesLevel();
+            void buildFeatureListCache();
+            unsigned computeFeatureLevel(const std::string& featureName, std::set<std::string>& visiting);
             bool isVerstionCompatible(const std::string& version);
 
-            std::map<std::string, std::set<dto::srr::FeatureName>> factorizationSaveCall(const dto::srr::SaveQuery query);
-            std::map<std::string, dto::srr::RestoreQuery> factorizationRestoreCall(const dto::srr::RestoreQuery query);
+            const config& getFeatureConfig(const std::string& featureName) const;
+            std::map<std::string, std::set<dto::srr::FeatureName>> factorizationSaveCall(const dto::srr::SaveQuery& query);
+            // Restore step: (level, agent name)
+            using RestoreStep = std::pair<unsigned, std::string>;
+            std::map<RestoreStep, std::set<dto::srr::FeatureName>> factorizationRestoreCall(const std::set<dto::srr::FeatureName>& features);
+            RestoreStep getRestoreStep(const std::string& featureName) const;
 
-            messagebus::Message sendRequest(const dto::UserData& userData, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest);
+            dto::srr::SaveResponse collectIpm2Configuration(const dto::srr::SaveQuery& query, const ProgressCallback& progress);
+            dto::srr::RestoreResponse restoreFromSource(SrrFeatureSource& source, const std::string& passphrase, const std::string& version, const std::string& checksum, const ProgressCallback& progress, bool resume = false);
+            // Time limit of a whole save or restore operation.
+            using Deadline = std::chrono::steady_clock::time_point;
+            Deadline getOperationDeadline() const;
+            std::chrono::milliseconds getRequestTimeout(const std::string& agentName, const Deadline& deadline, unsigned remainingSteps) const;
+            requester& getRequester(const std::string& agentName);
+            bool isAgentAvailable(const std::string& agentName);
+            void updateAgentHealth(const std::string& agentName, bool success);
+            void checkAgentsHealth();
+            void captureFactorySettings();
+            messagebus::Message requestUntil(requester& agentRequester, const std::string& queueNameDest, messagebus::Message req, const Deadline& requestDeadline);
+            static void setReply(requester& agentRequester, messagebus::Message msg);
+            void probeAgent(requester& agentRequester, const std::string& queueNameDest, const std::string& agentNameDest);
+            messagebus::Message sendRequestWithRetry(const dto::UserData& userData, size_t featureCount, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest, const Deadline& deadline, unsigned remainingSteps = 1);
+            messagebus::Message sendRequest(const dto::UserData& userData, size_t featureCount, const std::string& action, const std::string& queueNameDest, const std::string& agentNameDest, const Deadline& deadline, unsigned remainingSteps = 1, bool* sent = nullptr);
     };    
 }
 
+//  Self test of this class
+void fty_srr_worker_test (bool verbose);
+
 #endif